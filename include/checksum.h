@@ -0,0 +1,66 @@
+#ifndef _TCP_STACK_CHECKSUM_H_
+#define _TCP_STACK_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tcp_stack {
+// Internet checksum (RFC 1071). Sums are of 16 bit words loaded in host
+// order, which gives the checksum in network byte order once stored back, so
+// no byte swapping is needed anywhere.
+enum class ChecksumKernel {
+  kScalar,
+  kSse2,
+  kAvx2,
+};
+
+// The widest kernel the CPU supports is picked at startup
+ChecksumKernel GetChecksumKernel();
+// Returns false, and keeps the current one, if the CPU lacks the kernel
+bool SetChecksumKernel(ChecksumKernel kernel);
+
+// Ones' complement sum of [data, data + size) folded to 16 bits and added to
+// sum. An odd trailing byte is padded with zero.
+uint16_t PartialChecksum(const void *data, size_t size, uint16_t sum = 0);
+
+// Copies like memcpy and returns the PartialChecksum of the bytes in the
+// same pass.
+uint16_t CopyWithChecksum(void *dest, const void *source, size_t size,
+                          uint16_t sum = 0);
+
+// End around carry addition of two partial sums
+inline uint16_t ChecksumAdd(uint16_t a, uint16_t b) {
+  const uint32_t sum = static_cast<uint32_t>(a) + b;
+  return static_cast<uint16_t>((sum & 0xffff) + (sum >> 16));
+}
+
+// The partial sum of bytes which start at an odd offset of the checksummed
+// data, from their own partial sum.
+inline uint16_t ChecksumSwap(uint16_t sum) {
+  return static_cast<uint16_t>(sum << 8 | sum >> 8);
+}
+
+// RFC 1624 eqn. 3, HC' = ~(~HC + ~m + m'), for a 16 bit field of the
+// checksummed data changing from old_value to new_value. The values are as
+// they are stored in the data.
+inline uint16_t UpdateChecksum(uint16_t checksum, uint16_t old_value,
+                               uint16_t new_value) {
+  const uint16_t sum = ChecksumAdd(
+      ChecksumAdd(static_cast<uint16_t>(~checksum),
+                  static_cast<uint16_t>(~old_value)),
+      new_value);
+  return static_cast<uint16_t>(~sum);
+}
+
+// The same for a 32 bit field, aligned to 16 bits
+inline uint16_t UpdateChecksum(uint16_t checksum, uint32_t old_value,
+                               uint32_t new_value) {
+  checksum = UpdateChecksum(checksum, static_cast<uint16_t>(old_value),
+                            static_cast<uint16_t>(new_value));
+  return UpdateChecksum(checksum, static_cast<uint16_t>(old_value >> 16),
+                        static_cast<uint16_t>(new_value >> 16));
+}
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_CHECKSUM_H_
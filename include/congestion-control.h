@@ -0,0 +1,201 @@
+#ifndef _TCP_STACK_CONGESTION_CONTROL_H_
+#define _TCP_STACK_CONGESTION_CONTROL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <chrono>
+#include <memory>
+
+namespace tcp_stack {
+enum class CongestionAlgorithm {
+  kNewReno = 0,
+  kCubic,
+  kBbr
+};
+
+// Decides how many bytes may be in flight, from what the socket tells of
+// its sends, ACKs and losses. Sizes are in bytes.
+class CongestionControl {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  virtual ~CongestionControl() = default;
+
+  // Bytes which may be in flight
+  virtual uint32_t Window() const = 0;
+
+  // bytes went out, in_flight counts them
+  virtual void OnSend(uint32_t bytes, uint32_t in_flight,
+                      Clock::time_point now) {}
+
+  // acked bytes were newly acknowledged out of in_flight. rtt is the round
+  // trip the ACK measured, zero if it measured none.
+  virtual void OnAck(uint32_t acked, uint32_t in_flight, Clock::duration rtt,
+                     Clock::time_point now) = 0;
+
+  // A loss was inferred from the ACKs, reported once per window
+  virtual void OnLoss(uint32_t in_flight, Clock::time_point now) = 0;
+
+  // The retransmission timer expired, what was in flight is taken as lost
+  virtual void OnTimeout(uint32_t in_flight) = 0;
+};
+
+// RFC 6928
+constexpr uint32_t kInitialCongestionWindow = 10;
+// What a scaled receive window may reach
+constexpr uint32_t kMaxCongestionWindow = 1u << 30;
+
+// RFC 5681 and RFC 6582. Slow start, then a segment more per window acked,
+// halved on a loss.
+class NewReno : public CongestionControl {
+public:
+  explicit NewReno(uint32_t segment_size);
+
+  uint32_t Window() const override {
+    return cwnd_;
+  }
+
+  void OnAck(uint32_t acked, uint32_t in_flight, Clock::duration rtt,
+             Clock::time_point now) override;
+  void OnLoss(uint32_t in_flight, Clock::time_point now) override;
+  void OnTimeout(uint32_t in_flight) override;
+
+  uint32_t SlowStartThreshold() const {
+    return ssthresh_;
+  }
+
+private:
+  const uint32_t segment_size_;
+  uint32_t cwnd_;
+  uint32_t ssthresh_ = kMaxCongestionWindow;
+  // Acked toward the next segment of congestion avoidance
+  uint32_t bytes_acked_ = 0;
+};
+
+// RFC 9438. Past slow start the window follows a cubic of the time since
+// the last loss, flat around the window the loss happened at, and never
+// below what Reno would reach.
+class Cubic : public CongestionControl {
+public:
+  explicit Cubic(uint32_t segment_size);
+
+  uint32_t Window() const override {
+    return static_cast<uint32_t>(window_ * segment_size_);
+  }
+
+  void OnSend(uint32_t bytes, uint32_t in_flight,
+              Clock::time_point now) override;
+  void OnAck(uint32_t acked, uint32_t in_flight, Clock::duration rtt,
+             Clock::time_point now) override;
+  void OnLoss(uint32_t in_flight, Clock::time_point now) override;
+  void OnTimeout(uint32_t in_flight) override;
+
+  uint32_t SlowStartThreshold() const {
+    return static_cast<uint32_t>(ssthresh_ * segment_size_);
+  }
+
+  // The window before the last loss, in bytes
+  uint32_t WindowMax() const {
+    return static_cast<uint32_t>(w_max_ * segment_size_);
+  }
+
+private:
+  void Reduce();
+
+  const uint32_t segment_size_;
+  // In segments, from here on
+  double window_;
+  double ssthresh_;
+  double w_max_ = 0;
+  // When the window is back to w_max_, in seconds into the epoch
+  double k_ = 0;
+  // Reno's window over the same epoch (RFC 9438 4.3)
+  double w_est_ = 0;
+  // Starts with the first ACK of congestion avoidance, unset until then
+  Clock::time_point epoch_start_;
+  Clock::time_point last_ack_;
+  Clock::duration min_rtt_ = Clock::duration::max();
+};
+
+// A model based window in the way of BBR. The bottleneck bandwidth is the
+// highest delivery rate of the last rounds, a round being the time the
+// data in flight at its start takes to be acked, and the round trip is
+// the lowest one measured. The window is a gain times their product,
+// regardless of losses. There is no pacing, so the gains apply to the
+// window only.
+class Bbr : public CongestionControl {
+public:
+  enum class Mode {
+    // Doubles the window every round until the bandwidth stops growing
+    kStartup = 0,
+    // Lets the queue startup built drain
+    kDrain,
+    // Cycles the gain above and below one to find more bandwidth
+    kProbeBandwidth,
+    // Shrinks the window to measure the round trip without a queue
+    kProbeRtt
+  };
+
+  explicit Bbr(uint32_t segment_size);
+
+  uint32_t Window() const override;
+
+  void OnSend(uint32_t bytes, uint32_t in_flight,
+              Clock::time_point now) override;
+  void OnAck(uint32_t acked, uint32_t in_flight, Clock::duration rtt,
+             Clock::time_point now) override;
+  void OnLoss(uint32_t in_flight, Clock::time_point now) override;
+  void OnTimeout(uint32_t in_flight) override;
+
+  Mode GetMode() const {
+    return mode_;
+  }
+
+  // Bytes per second, zero until a round ended
+  double Bandwidth() const;
+
+  // Zero until measured
+  Clock::duration MinRtt() const {
+    return min_rtt_ == Clock::duration::max() ? Clock::duration::zero()
+                                              : min_rtt_;
+  }
+
+private:
+  static constexpr size_t kBandwidthRounds = 10;
+
+  void EndRound(Clock::time_point now);
+  // gain times the bandwidth delay product, zero without a model
+  uint32_t Target(double gain) const;
+  double Gain() const;
+
+  const uint32_t segment_size_;
+  Mode mode_ = Mode::kStartup;
+  uint32_t cwnd_;
+
+  std::array<double, kBandwidthRounds> bandwidth_{};
+  uint64_t round_ = 0;
+  // Bytes acked ever, at the start of the round, and by its end
+  uint64_t delivered_ = 0;
+  uint64_t round_start_delivered_ = 0;
+  uint64_t round_end_delivered_ = 0;
+  Clock::time_point round_start_;
+
+  Clock::duration min_rtt_ = Clock::duration::max();
+  Clock::time_point min_rtt_stamp_;
+  Clock::time_point probe_rtt_done_;
+
+  // The bandwidth startup last saw grow by a quarter, and the rounds since
+  double full_bandwidth_ = 0;
+  uint32_t full_bandwidth_rounds_ = 0;
+  bool full_pipe_ = false;
+  size_t cycle_index_ = 0;
+};
+
+std::unique_ptr<CongestionControl> MakeCongestionControl(
+    CongestionAlgorithm algorithm, uint32_t segment_size);
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_CONGESTION_CONTROL_H_
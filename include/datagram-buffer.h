@@ -0,0 +1,116 @@
+#ifndef _TCP_STACK_DATAGRAM_BUFFER_H_
+#define _TCP_STACK_DATAGRAM_BUFFER_H_
+
+#include <cstddef>
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tcp_stack {
+class DatagramBufferPool;
+
+// A receive buffer large enough for any datagram. Packets received into it
+// share it through DatagramBufferRef, the last reference gives it back to
+// its pool.
+class DatagramBuffer {
+public:
+  friend class DatagramBufferPool;
+  friend class DatagramBufferRef;
+
+  static constexpr size_t kSize = 65536;
+
+  char *Data() {
+    return data_;
+  }
+
+private:
+  explicit DatagramBuffer(DatagramBufferPool *pool) : pool_(pool) {}
+
+  std::atomic<int> reference_count_{0};
+  DatagramBufferPool * const pool_;
+
+  alignas(std::max_align_t) char data_[kSize];
+};
+
+class DatagramBufferRef {
+public:
+  DatagramBufferRef() = default;
+
+  explicit DatagramBufferRef(DatagramBuffer *buffer) : buffer_(buffer) {
+    if (buffer_)
+      buffer_->reference_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  DatagramBufferRef(const DatagramBufferRef &x)
+      : DatagramBufferRef(x.buffer_) {}
+
+  DatagramBufferRef(DatagramBufferRef &&x) noexcept
+      : buffer_(std::exchange(x.buffer_, nullptr)) {}
+
+  ~DatagramBufferRef() {
+    Reset();
+  }
+
+  DatagramBufferRef &operator=(DatagramBufferRef x) noexcept {
+    std::swap(buffer_, x.buffer_);
+    return *this;
+  }
+
+  void Reset();
+
+  // Whether no packet holds the buffer besides this reference
+  bool Unique() const {
+    return buffer_->reference_count_.load(std::memory_order_acquire) == 1;
+  }
+
+  DatagramBuffer *operator->() const {
+    return buffer_;
+  }
+
+  explicit operator bool() const {
+    return buffer_;
+  }
+
+private:
+  DatagramBuffer *buffer_ = nullptr;
+};
+
+class DatagramBufferPool {
+public:
+  // Process wide pool, never destroyed so that packets may outlive anything
+  static DatagramBufferPool &Instance();
+
+  explicit DatagramBufferPool(size_t max_free_buffers)
+      : max_free_buffers_(max_free_buffers) {}
+
+  DatagramBufferPool(const DatagramBufferPool &) = delete;
+
+  ~DatagramBufferPool();
+
+  DatagramBufferPool &operator=(const DatagramBufferPool &) = delete;
+
+  DatagramBufferRef Acquire();
+
+private:
+  friend class DatagramBufferRef;
+
+  void Release(DatagramBuffer *buffer);
+
+  const size_t max_free_buffers_;
+
+  std::mutex mtx_;
+  std::vector<DatagramBuffer *> free_buffers_;
+};
+
+inline void DatagramBufferRef::Reset() {
+  if (buffer_ &&
+      buffer_->reference_count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    buffer_->pool_->Release(buffer_);
+  buffer_ = nullptr;
+}
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_DATAGRAM_BUFFER_H_
@@ -0,0 +1,101 @@
+#ifndef _TCP_STACK_IO_URING_H_
+#define _TCP_STACK_IO_URING_H_
+
+#include <sys/socket.h>
+#include <time.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_FEAT_EXT_ARG)
+#define TCP_STACK_HAS_IO_URING 1
+#endif
+
+namespace tcp_stack {
+#ifdef TCP_STACK_HAS_IO_URING
+// A minimal io_uring ring over the raw syscalls, with one provided buffer
+// ring for multishot receives. Not thread safe.
+class IoUring {
+public:
+  // Throws std::runtime_error when io_uring is not available
+  explicit IoUring(unsigned entries);
+
+  IoUring(const IoUring &) = delete;
+
+  ~IoUring();
+
+  IoUring &operator=(const IoUring &) = delete;
+
+  // Returns nullptr if the submission queue is full
+  io_uring_sqe *GetSqe();
+
+  void PrepareMultishotRecv(int fd, uint16_t buffer_group, uint64_t user_data);
+  void PrepareSendMsg(int fd, const msghdr *message, uint64_t user_data);
+
+  // Submits prepared sqes and waits for at least wait_nr cqes or the timeout.
+  // Returns the number of submitted sqes, or -errno.
+  int Submit(unsigned wait_nr, const timespec *timeout = nullptr);
+
+  // Forgets the sqes prepared since the last successful Submit
+  void DropUnsubmitted();
+
+  template <class Fn>
+  unsigned ForEachCqe(Fn fn) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    const unsigned n = tail - head;
+    for (; head != tail; ++head)
+      fn(cqes_[head & *cq_ring_mask_]);
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return n;
+  }
+
+  void RegisterBufferRing(uint16_t group, uint16_t count, size_t size);
+
+  char *GetBuffer(uint16_t id) {
+    return buffers_.get() + id * buffer_size_;
+  }
+
+  void RecycleBuffer(uint16_t id);
+
+private:
+  int ring_fd_ = -1;
+
+  void *sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void *cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_ring_mask_ = nullptr;
+  unsigned *sq_ring_entries_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sqe_tail_ = 0;
+  unsigned sqe_submitted_ = 0;
+
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_ring_mask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+
+  io_uring_buf_ring *buffer_ring_ = nullptr;
+  size_t buffer_ring_size_ = 0;
+  uint16_t buffer_ring_mask_ = 0;
+  size_t buffer_size_ = 0;
+  std::unique_ptr<char[]> buffers_;
+};
+
+#endif // TCP_STACK_HAS_IO_URING
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_IO_URING_H_
@@ -0,0 +1,138 @@
+#ifndef _TCP_STACK_LOOPBACK_TRANSPORT_H_
+#define _TCP_STACK_LOOPBACK_TRANSPORT_H_
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "transport.h"
+
+namespace tcp_stack {
+// Bounded lock-free queue of packets, any number of threads push, one thread
+// pops. The consumer sleeps on an eventfd which producers only write to when
+// it is actually waiting.
+class LoopbackChannel {
+public:
+  // capacity is rounded up to a power of 2
+  explicit LoopbackChannel(size_t capacity);
+
+  LoopbackChannel(const LoopbackChannel &) = delete;
+
+  ~LoopbackChannel();
+
+  LoopbackChannel &operator=(const LoopbackChannel &) = delete;
+
+  // Returns false and leaves packet alone when the channel is full
+  bool Push(PacketPtr &packet);
+
+  // Moves up to max packets to the end of packets, returns how many
+  size_t Pop(PacketBatch &packets, size_t max);
+
+  // Wakes the consumer if it is blocked in Wait
+  void Notify();
+
+  // Blocks until a packet is pushed or the timeout expires
+  void Wait(std::chrono::milliseconds timeout);
+
+  // Claimed by the transport receiving from the channel
+  std::atomic<bool> bound{false};
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    PacketPtr packet;
+  };
+
+  bool Empty() const;
+
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  alignas(64) std::atomic<size_t> enqueue_position_{0};
+  alignas(64) size_t dequeue_position_ = 0;
+  std::atomic<bool> waiting_{false};
+  int event_fd_ = -1;
+};
+
+// Address book of the loopback channels of one process, a channel is created
+// by whichever side mentions its address first.
+class LoopbackNetwork {
+public:
+  explicit LoopbackNetwork(size_t channel_capacity = 4096)
+      : channel_capacity_(channel_capacity) {}
+
+  LoopbackNetwork(const LoopbackNetwork &) = delete;
+  LoopbackNetwork &operator=(const LoopbackNetwork &) = delete;
+
+  std::shared_ptr<LoopbackChannel> GetChannel(const sockaddr_in &address);
+
+  // Packets lost because the receiving channel was full, or to SetLoss
+  uint64_t GetDropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  void AddDropped(uint64_t n) {
+    dropped_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // Drops one packet in every n sent, none if n is 0, to exercise the
+  // resends
+  void SetLoss(uint32_t n) {
+    loss_.store(n, std::memory_order_relaxed);
+  }
+
+  bool Lose() {
+    const auto n = loss_.load(std::memory_order_relaxed);
+    return n && sent_.fetch_add(1, std::memory_order_relaxed) % n == n - 1;
+  }
+
+private:
+  const size_t channel_capacity_;
+
+  std::mutex mtx_;
+  std::unordered_map<uint64_t, std::shared_ptr<LoopbackChannel>> channels_;
+
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint32_t> loss_{0};
+  std::atomic<uint64_t> sent_{0};
+};
+
+// Hands packets to the peer's channel, no kernel involved and no copy. The
+// receiver gets a reference to the very packet the sender keeps for a resend,
+// slices of the send buffer included. Both only read it, a resend patches
+// its ack in a copy while the receiver still holds the packet.
+class LoopbackTransport : public Transport {
+public:
+  LoopbackTransport(LoopbackNetwork &network, const sockaddr_in &host_addr,
+                    const sockaddr_in &peer_addr, size_t batch_size,
+                    std::chrono::microseconds busy_poll);
+
+  LoopbackTransport(const LoopbackTransport &) = delete;
+
+  ~LoopbackTransport() override;
+
+  LoopbackTransport &operator=(const LoopbackTransport &) = delete;
+
+  void Open(size_t) override {}
+  void Close(size_t) override {}
+
+  void Receive(size_t index, std::chrono::milliseconds timeout,
+               PacketBatch &packets) override;
+
+  void Send(PacketBatch &packets) override;
+
+private:
+  LoopbackNetwork &network_;
+  const size_t batch_size_;
+  AdaptiveSpin spin_;
+  std::shared_ptr<LoopbackChannel> host_channel_;
+  std::shared_ptr<LoopbackChannel> peer_channel_;
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_LOOPBACK_TRANSPORT_H_
@@ -2,33 +2,46 @@
 #define _TCP_STACK_NETWORK_H_
 
 #include <arpa/inet.h>
-#include <poll.h>
-#include <sys/socket.h>
-#include <unistd.h>
+
+#include <cassert>
 
 #include <atomic>
+#include <chrono>
 #include <future>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
+#include "loopback-transport.h"
 #include "socket-manager.h"
 #include "safe-log.h"
+#include "transport.h"
+#include "udp-transport.h"
 
 namespace tcp_stack {
 class NetworkService {
  public:
+  using Options = NetworkServiceOptions;
+
   NetworkService(const std::string &host_address, uint16_t host_port,
-                 const std::string &peer_address, uint16_t peer_port)
+                 const std::string &peer_address, uint16_t peer_port,
+                 const Options &options = Options())
       : host_addr_{AF_INET, htons(host_port)},
         host_port_(host_port),
         peer_addr_{AF_INET, htons(peer_port)},
         peer_port_(peer_port),
+        options_(options),
         socket_manager_(ntohl(inet_addr(host_address.c_str())), this) {
+    options_.batch_size = std::clamp<size_t>(options_.batch_size, 1,
+                                             kMaxBatchSize);
+    if (options_.huge_pages)
+      PacketPool::Instance().UseHugePages(true);
     if (inet_pton(AF_INET, host_address.c_str(), &host_addr_.sin_addr) != 1)
       throw std::runtime_error("inet_pton failed with: " + host_address);
     if (inet_pton(AF_INET, peer_address.c_str(), &peer_addr_.sin_addr) != 1)
       throw std::runtime_error("inet_pton failed with: " + peer_address);
+    SetupTransport();
   }
   
   NetworkService(const NetworkService &) = delete;
@@ -44,13 +57,18 @@ class NetworkService {
   template <class... Args>
   static std::shared_ptr<NetworkService> AsyncRun(Args&&... args) {
     auto ptr = std::make_shared<NetworkService>(std::forward<Args>(args)...);
-    std::promise<void> running;
-    auto future = running.get_future();
-    ptr->thread_ = std::thread([ptr, running(std::move(running))]() mutable {
-          ptr->Run(std::move(running));
-        });
+    std::vector<std::future<void>> futures;
+    for (size_t i=0; i<ptr->transport_->ReceiveThreads(); ++i) {
+      std::promise<void> running;
+      futures.push_back(running.get_future());
+      ptr->threads_.emplace_back(
+          [ptr, i, running(std::move(running))]() mutable {
+            ptr->Run(std::move(running), i);
+          });
+    }
     
-    future.get();
+    for (auto &future : futures)
+      future.get();
     return ptr;
   }
   
@@ -58,34 +76,107 @@ class NetworkService {
     return socket_manager_.NewSocket();
   }
 
-  void SendPacket(std::shared_ptr<TcpPacket> packet) {
-    auto [buff, size] = packet->GetBuffer();
-    sendto(host_socket_, buff, size, 0,
-        (sockaddr *)&peer_addr_, sizeof(sockaddr_in));
+  // Packets are queued, and flushed to the transport once the queue is full
+  // or the outermost EgressBatch is closed.
+  void SendPacket(PacketPtr packet) {
+    std::lock_guard guard(egress_mtx_);
+    egress_queue_.push_back(std::move(packet));
+    if (egress_batch_depth_ == 0 ||
+        egress_queue_.size() >= options_.batch_size)
+      FlushEgressQueue(guard);
+  }
+
+  // Defers the flushing of SendPacket until destruction.
+  class EgressBatch {
+  public:
+    explicit EgressBatch(NetworkService *service) : service_(service) {
+      std::lock_guard guard(service_->egress_mtx_);
+      ++service_->egress_batch_depth_;
+    }
+
+    EgressBatch(const EgressBatch &) = delete;
+
+    ~EgressBatch() {
+      std::lock_guard guard(service_->egress_mtx_);
+      if (--service_->egress_batch_depth_ == 0)
+        service_->FlushEgressQueue(guard);
+    }
+
+    EgressBatch &operator=(const EgressBatch &) = delete;
+
+  private:
+    NetworkService * const service_;
+  };
+
+  // The backend in use, which differs from Options::backend after a fallback
+  IoBackend GetBackend() const {
+    return options_.backend;
+  }
+
+  BatchStatistics GetReceiveStatistics() const {
+    return transport_->GetReceiveStatistics();
+  }
+
+  BatchStatistics GetSendStatistics() const {
+    return transport_->GetSendStatistics();
+  }
+
+  BatchStatistics GetGsoStatistics() const {
+    return transport_->GetGsoStatistics();
+  }
+
+  BatchStatistics GetGroStatistics() const {
+    return transport_->GetGroStatistics();
+  }
+
+  BusyPollStatistics GetBusyPollStatistics() const {
+    return transport_->GetBusyPollStatistics();
+  }
+
+  HeaderPredictionStatistics GetHeaderPredictionStatistics() const {
+    return socket_manager_.GetHeaderPredictionStatistics();
   }
 
   void Terminate() {
     terminate_flag_.store(true);
-    if (thread_.joinable())
-      thread_.join();
+    for (auto &thread : threads_) {
+      if (thread.joinable())
+        thread.join();
+    }
   }
   
   void join() {
-    thread_.join();
+    for (auto &thread : threads_)
+      thread.join();
   }
 
  private:
-  void Run(std::promise<void> running);
+  void SetupTransport();
+
+  void Run(std::promise<void> running, size_t index);
+
+  void FlushEgressQueue(const std::lock_guard<std::mutex> &) {
+    if (egress_queue_.empty())
+      return;
+    transport_->Send(egress_queue_);
+    egress_queue_.clear();
+  }
   
   std::atomic<bool> terminate_flag_{false};
-  std::thread thread_;
+  std::vector<std::thread> threads_;
 
   sockaddr_in host_addr_;
   uint16_t host_port_;
   sockaddr_in peer_addr_;
   uint16_t peer_port_;
 
-  int host_socket_;
+  Options options_;
+
+  std::unique_ptr<Transport> transport_;
+
+  std::mutex egress_mtx_;
+  PacketBatch egress_queue_;
+  size_t egress_batch_depth_ = 0;
   
   SocketManager socket_manager_;
 };
@@ -0,0 +1,102 @@
+#ifndef _TCP_STACK_PACKET_POOL_H_
+#define _TCP_STACK_PACKET_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace tcp_stack {
+// hits are allocations served with recycled blocks, misses the ones which
+// had to carve a fresh slab, a batch of blocks at a time, or were too large
+// for any size class and went to the heap.
+struct PacketPoolStatistics {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t slabs = 0;
+  uint64_t huge_page_slabs = 0;
+};
+
+// Size classed slab allocator for packet storage. Each thread keeps a cache
+// of free blocks per size class, and trades them with the shared free lists
+// in batches, so allocating and freeing a packet usually takes no lock at
+// all. Slabs are never given back to the system.
+class PacketPool {
+public:
+  static constexpr size_t kMinBlockSize = 64;
+  static constexpr size_t kClasses = 11;
+  static constexpr size_t kMaxBlockSize = kMinBlockSize << (kClasses - 1);
+  static constexpr size_t kSlabSize = 2 << 20;
+
+  // Process wide pool, never destroyed so that packets may outlive anything
+  static PacketPool &Instance();
+
+  PacketPool(const PacketPool &) = delete;
+  PacketPool &operator=(const PacketPool &) = delete;
+
+  void *Allocate(size_t size);
+  // size must be the one given to Allocate
+  void Deallocate(void *block, size_t size);
+
+  // Slabs mapped from now on try MAP_HUGETLB first, then transparent huge
+  // pages.
+  void UseHugePages(bool enable) {
+    huge_pages_.store(enable, std::memory_order_relaxed);
+  }
+
+  PacketPoolStatistics GetStatistics();
+
+private:
+  struct ThreadCache;
+
+  struct SizeClass {
+    std::mutex mtx;
+    std::vector<void *> free_blocks;
+    char *slab = nullptr;
+    size_t slab_left = 0;
+  };
+
+  PacketPool() = default;
+
+  static size_t ClassIndex(size_t size) {
+    return size <= kMinBlockSize ?
+        0 : 64 - __builtin_clzl(size - 1) - __builtin_ctzl(kMinBlockSize);
+  }
+
+  static size_t BlockSize(size_t index) {
+    return kMinBlockSize << index;
+  }
+
+  // Max number of blocks a thread keeps per class
+  static size_t CacheCapacity(size_t index);
+
+  static ThreadCache *GetThreadCache();
+
+  // Moves up to n blocks of a class from the shared free list to blocks, or
+  // carves n new ones when it is empty. Returns whether it did the latter.
+  bool Refill(size_t index, size_t n, std::vector<void *> &blocks);
+  void Drain(size_t index, size_t n, std::vector<void *> &blocks);
+
+  char *NewSlab();
+
+  std::array<SizeClass, kClasses> classes_;
+  std::atomic<bool> huge_pages_{false};
+  std::atomic<uint64_t> slabs_{0};
+  std::atomic<uint64_t> huge_page_slabs_{0};
+
+  std::mutex caches_mtx_;
+  std::vector<ThreadCache *> caches_;
+  // Counted by threads which have exited
+  uint64_t retired_hits_ = 0;
+  uint64_t retired_misses_ = 0;
+  // Frees after the thread cache is gone, and the oversized blocks
+  std::atomic<uint64_t> uncached_hits_{0};
+  std::atomic<uint64_t> uncached_misses_{0};
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_PACKET_POOL_H_
@@ -0,0 +1,157 @@
+#ifndef _TCP_STACK_REASSEMBLY_QUEUE_H_
+#define _TCP_STACK_REASSEMBLY_QUEUE_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <memory>
+
+#include "sequence-number.h"
+
+namespace tcp_stack {
+// Segments which arrived ahead of rcv_nxt. The control block keeps which
+// ranges of sequence numbers are held, so that the state machine can move
+// rcv_nxt over them once the gap before them fills, and the socket keeps
+// the bytes in a ReassemblyBuffer. Both are bounded.
+
+// Sorted, disjoint and non adjacent [begin, end) ranges, at most kCapacity
+// of them. Trivially copyable, so the control block stays so.
+class SequenceRanges {
+public:
+  static constexpr size_t kCapacity = 8;
+
+  struct Range {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  // Merges [begin, end) with the ranges it overlaps or touches. Returns
+  // false, and changes nothing, if that would make one range too many.
+  bool Add(uint32_t begin, uint32_t end) {
+    size_t first = 0;
+    while (first < size_ && SeqLt(ranges_[first].end, begin))
+      ++first;
+    size_t last = first;
+    for (; last < size_ && SeqLe(ranges_[last].begin, end); ++last) {
+      begin = SeqMin(begin, ranges_[last].begin);
+      end = SeqMax(end, ranges_[last].end);
+    }
+
+    const size_t size = size_ - (last - first) + 1;
+    if (size > kCapacity)
+      return false;
+    if (last == first)
+      std::copy_backward(ranges_ + first, ranges_ + size_,
+                         ranges_ + size_ + 1);
+    else
+      std::copy(ranges_ + last, ranges_ + size_, ranges_ + first + 1);
+    ranges_[first] = {begin, end};
+    size_ = size;
+    return true;
+  }
+
+  // Drops the ranges which rcv_nxt reached, and returns rcv_nxt moved past
+  // the bytes they held
+  uint32_t Advance(uint32_t rcv_nxt) {
+    size_t n = 0;
+    for (; n < size_ && SeqLe(ranges_[n].begin, rcv_nxt); ++n)
+      rcv_nxt = SeqMax(rcv_nxt, ranges_[n].end);
+    if (n) {
+      std::copy(ranges_ + n, ranges_ + size_, ranges_);
+      size_ -= n;
+    }
+    return rcv_nxt;
+  }
+
+  // Whether one range holds all of [begin, end)
+  bool Covers(uint32_t begin, uint32_t end) const {
+    for (size_t i=0; i<size_; ++i)
+      if (SeqLe(ranges_[i].begin, begin) && SeqLe(end, ranges_[i].end))
+        return true;
+    return false;
+  }
+
+  bool Empty() const {
+    return size_ == 0;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  const Range *begin() const {
+    return ranges_;
+  }
+
+  const Range *end() const {
+    return ranges_ + size_;
+  }
+
+private:
+  Range ranges_[kCapacity] = {};
+  size_t size_ = 0;
+};
+
+// The bytes of the held segments, each at its sequence number modulo the
+// capacity, a power of 2 so that the positions carry on across the wrap.
+// Segments are only held up to the capacity past rcv_nxt, so none overwrites
+// another, and overlaps just write the same bytes again. The storage is
+// allocated the first time a segment arrives out of order.
+class ReassemblyBuffer {
+public:
+  static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+  // capacity is rounded up to a power of 2
+  explicit ReassemblyBuffer(size_t capacity = kDefaultCapacity) {
+    Resize(capacity);
+  }
+
+  size_t Capacity() const {
+    return capacity_;
+  }
+
+  // Drops whatever was held
+  void Resize(size_t capacity) {
+    capacity_ = 1;
+    while (capacity_ < capacity)
+      capacity_ <<= 1;
+    data_.reset();
+  }
+
+  void Store(uint32_t seq, const char *first, const char *last) {
+    assert(static_cast<size_t>(last - first) <= capacity_);
+    if (!data_)
+      data_ = std::make_unique<char[]>(capacity_);
+    while (first != last) {
+      const size_t offset = seq & (capacity_ - 1);
+      const size_t n = std::min<size_t>(last - first, capacity_ - offset);
+      std::copy(first, first + n, data_.get() + offset);
+      first += n;
+      seq += n;
+    }
+  }
+
+  // Calls fn(const char *data, size_t size) for the bytes of [seq, end),
+  // which must have been stored
+  template <class Fn>
+  void Load(uint32_t seq, uint32_t end, Fn fn) const {
+    assert(data_);
+    assert(end - seq <= capacity_);
+    while (seq != end) {
+      const size_t offset = seq & (capacity_ - 1);
+      const size_t n = std::min<size_t>(end - seq, capacity_ - offset);
+      fn(static_cast<const char *>(data_.get() + offset), n);
+      seq += n;
+    }
+  }
+
+private:
+  size_t capacity_;
+  std::unique_ptr<char[]> data_;
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_REASSEMBLY_QUEUE_H_
@@ -0,0 +1,91 @@
+#ifndef _TCP_STACK_RTT_ESTIMATOR_H_
+#define _TCP_STACK_RTT_ESTIMATOR_H_
+
+#include <cstdint>
+
+#include <algorithm>
+#include <chrono>
+
+namespace tcp_stack {
+// Snapshot of a connection's round trip estimates. timeouts counts the
+// retransmission timer expiring, backoffs those since the last sample,
+// fast_retransmits the losses duplicate ACKs told of first.
+struct RttStatistics {
+  std::chrono::microseconds srtt{0};
+  std::chrono::microseconds rttvar{0};
+  std::chrono::microseconds rto{0};
+  uint64_t samples = 0;
+  uint64_t timeouts = 0;
+  uint32_t backoffs = 0;
+  uint64_t fast_retransmits = 0;
+};
+
+// RFC 6298. The smoothed round trip and its mean deviation, and the
+// retransmission timeout they make, doubled on each expiry until the next
+// sample. Leaving out samples of resent segments (Karn) is up to the
+// caller.
+class RttEstimator {
+public:
+  using Duration = std::chrono::microseconds;
+
+  explicit RttEstimator(Duration min_rto = std::chrono::milliseconds(200),
+                        Duration max_rto = std::chrono::seconds(60))
+      : min_rto_(min_rto), max_rto_(std::max(min_rto, max_rto)) {}
+
+  void Sample(Duration rtt) {
+    rtt = std::max(rtt, Duration(1));
+    if (samples_ == 0) {
+      srtt_ = rtt;
+      rttvar_ = rtt / 2;
+    } else {
+      const auto delta = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+      rttvar_ = (3 * rttvar_ + delta) / 4;
+      srtt_ = (7 * srtt_ + rtt) / 8;
+    }
+    ++samples_;
+    backoffs_ = 0;
+  }
+
+  // The timer expired
+  void Backoff() {
+    ++timeouts_;
+    if (Rto() < max_rto_)
+      ++backoffs_;
+  }
+
+  Duration Rto() const {
+    auto rto = samples_ ? srtt_ + std::max(kClockGranularity, 4 * rttvar_)
+                        : kInitialRto;
+    rto = std::clamp(rto, min_rto_, max_rto_);
+    for (uint32_t i=0; i<backoffs_ && rto < max_rto_; ++i)
+      rto *= 2;
+    return std::min(rto, max_rto_);
+  }
+
+  RttStatistics GetStatistics() const {
+    RttStatistics statistics;
+    statistics.srtt = srtt_;
+    statistics.rttvar = rttvar_;
+    statistics.rto = Rto();
+    statistics.samples = samples_;
+    statistics.timeouts = timeouts_;
+    statistics.backoffs = backoffs_;
+    return statistics;
+  }
+
+private:
+  static constexpr Duration kInitialRto = std::chrono::seconds(1);
+  static constexpr Duration kClockGranularity = std::chrono::milliseconds(1);
+
+  Duration min_rto_;
+  Duration max_rto_;
+  Duration srtt_{0};
+  Duration rttvar_{0};
+  uint64_t samples_ = 0;
+  uint64_t timeouts_ = 0;
+  uint32_t backoffs_ = 0;
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_RTT_ESTIMATOR_H_
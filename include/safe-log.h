@@ -5,11 +5,14 @@
 #include <sstream>
 
 namespace tcp_stack {
+// Define TCP_STACK_DISABLE_LOG to compile logging out, e.g. for benchmarks.
 template <class... Args>
 void Log(const Args&... args) {
+#ifndef TCP_STACK_DISABLE_LOG
   std::ostringstream output;
   (output << ... << args) << std::endl << std::flush;
   std::clog << output.rdbuf()->str();
+#endif
 }
 
 } // namespace tcp_stack
@@ -0,0 +1,128 @@
+#ifndef _TCP_STACK_SEND_CHUNK_H_
+#define _TCP_STACK_SEND_CHUNK_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "packet-pool.h"
+
+namespace tcp_stack {
+class SendChunkRef;
+
+// A piece of a send buffer. Application data is copied into chunks once,
+// in-flight packets then reference slices of them until they are acked and
+// no resend needs them any more. Bytes are only ever appended, so a packet
+// never sees its slice change.
+class SendChunk {
+public:
+  friend class SendChunkRef;
+
+  static constexpr size_t kBlockSize = 4096;
+
+  static SendChunkRef New();
+
+  SendChunk(const SendChunk &) = delete;
+  SendChunk &operator=(const SendChunk &) = delete;
+
+  const char *Data() const {
+    return data_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  size_t Room() const {
+    return sizeof(data_) - size_;
+  }
+
+  static constexpr size_t Capacity() {
+    return sizeof(data_);
+  }
+
+  // Returns the number of bytes taken
+  size_t Append(const char *source, size_t size) {
+    const auto n = std::min(size, Room());
+    std::copy(source, source + n, data_ + size_);
+    size_ += n;
+    return n;
+  }
+
+private:
+  SendChunk() = default;
+
+  std::atomic<uint32_t> references_{1};
+  uint32_t size_ = 0;
+  char data_[kBlockSize - 2 * sizeof(uint32_t)];
+};
+
+// Like PacketPtr, the count is only touched atomically while shared, but
+// copies are allowed, a slice is a copy.
+class SendChunkRef {
+public:
+  SendChunkRef() = default;
+
+  SendChunkRef(const SendChunkRef &x) : chunk_(x.chunk_) {
+    if (chunk_)
+      chunk_->references_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  SendChunkRef(SendChunkRef &&x) noexcept
+      : chunk_(std::exchange(x.chunk_, nullptr)) {}
+
+  ~SendChunkRef() {
+    Reset();
+  }
+
+  SendChunkRef &operator=(SendChunkRef x) noexcept {
+    std::swap(chunk_, x.chunk_);
+    return *this;
+  }
+
+  void Reset() {
+    if (chunk_ &&
+        (chunk_->references_.load(std::memory_order_acquire) == 1 ||
+         chunk_->references_.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+      chunk_->~SendChunk();
+      PacketPool::Instance().Deallocate(chunk_, sizeof(SendChunk));
+    }
+    chunk_ = nullptr;
+  }
+
+  SendChunk *operator->() const {
+    return chunk_;
+  }
+
+  SendChunk &operator*() const {
+    return *chunk_;
+  }
+
+private:
+  friend class SendChunk;
+
+  // Adopts a reference
+  explicit SendChunkRef(SendChunk *chunk) : chunk_(chunk) {}
+
+  SendChunk *chunk_ = nullptr;
+};
+
+inline SendChunkRef SendChunk::New() {
+  void * const block = PacketPool::Instance().Allocate(sizeof(SendChunk));
+  return SendChunkRef(new(block) SendChunk);
+}
+
+// Bytes of a send buffer carried by a packet
+struct PayloadSlice {
+  SendChunkRef chunk;
+  const char *data;
+  size_t size;
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_SEND_CHUNK_H_
@@ -0,0 +1,36 @@
+#ifndef _TCP_STACK_SEQUENCE_NUMBER_H_
+#define _TCP_STACK_SEQUENCE_NUMBER_H_
+
+#include <cstdint>
+
+namespace tcp_stack {
+// Sequence and acknowledgement numbers wrap at 2^32, so they are compared
+// the RFC 1982 way: a is before b when b is less than 2^31 ahead of it,
+// modulo 2^32. This holds as long as no window spans 2^31 bytes.
+constexpr bool SeqLt(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) < 0;
+}
+
+constexpr bool SeqLe(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) <= 0;
+}
+
+constexpr bool SeqGt(uint32_t a, uint32_t b) {
+  return SeqLt(b, a);
+}
+
+constexpr bool SeqGe(uint32_t a, uint32_t b) {
+  return SeqLe(b, a);
+}
+
+constexpr uint32_t SeqMax(uint32_t a, uint32_t b) {
+  return SeqLt(a, b) ? b : a;
+}
+
+constexpr uint32_t SeqMin(uint32_t a, uint32_t b) {
+  return SeqLt(a, b) ? a : b;
+}
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_SEQUENCE_NUMBER_H_
@@ -1,7 +1,11 @@
 #ifndef _TCP_STACK_SOCKET_INTERNAL_H_
 #define _TCP_STACK_SOCKET_INTERNAL_H_
 
+#include <cstdint>
+
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <functional>
@@ -9,24 +13,27 @@
 #include <mutex>
 #include <tuple>
 
+#include "congestion-control.h"
+#include "rtt-estimator.h"
 #include "safe-log.h"
 #include "state.h"
 #include "tcp-buffer.h"
+#include "tcp-options.h"
 
 namespace tcp_stack {
 inline void SynHeader(uint32_t seq, uint16_t window, TcpHeader *header) {
   header->SetSyn(true);
 
-  header->SequenceNumber() = seq;
-  header->Window() = window;
+  header->SetSequenceNumber(seq);
+  header->SetWindow(window);
 }
 
 inline void AckHeader(uint32_t seq, uint32_t ack, uint16_t window, TcpHeader *header) {
   header->SetAck(true);
 
-  header->SequenceNumber() = seq;
-  header->AcknowledgementNumber() = ack;
-  header->Window() = window;
+  header->SetSequenceNumber(seq);
+  header->SetAcknowledgementNumber(ack);
+  header->SetWindow(window);
 }
 
 inline void SynAckHeader(uint32_t seq, uint32_t ack, uint16_t window,
@@ -42,7 +49,7 @@ inline void FinHeader(uint32_t seq, uint32_t ack, uint16_t window, TcpHeader *he
 
 inline void RstHeader(uint32_t seq, TcpHeader *header) {
   header->SetRst(true);
-  header->SequenceNumber() = seq;
+  header->SetSequenceNumber(seq);
 }
 
 inline void RstHeader(const TcpHeader &source_header, TcpHeader *header) {
@@ -50,13 +57,13 @@ inline void RstHeader(const TcpHeader &source_header, TcpHeader *header) {
 }
 
 inline void SetSource(uint32_t ip, uint16_t port, TcpHeader *header) {
-  header->SourceAddress() = ip;
-  header->SourcePort() = port;
+  header->SetSourceAddress(ip);
+  header->SetSourcePort(port);
 }
 
 inline void SetDestination(uint32_t ip, uint16_t port, TcpHeader *header) {
-  header->DestinationAddress() = ip;
-  header->DestinationPort() = port;
+  header->SetDestinationAddress(ip);
+  header->SetDestinationPort(port);
 }
 
 struct SocketIdentifier {
@@ -133,21 +140,56 @@ private:
 
 class SocketManager;
 
+// Duplicate ACKs which tell of a loss (RFC 5681 DupThresh)
+constexpr uint32_t kDuplicateAckThreshold = 3;
+
+// Per socket settings. A listening socket hands its own to the connections
+// it accepts.
+struct SocketOptions {
+  // Offer selective acknowledgements (RFC 2018) in the handshake
+  bool selective_ack = true;
+  // In order data is acked after at most this long, or with the second
+  // segment, whichever comes first. Zero acks every segment at once.
+  std::chrono::milliseconds delayed_ack{40};
+  // Sends a segment shorter than a full one even while data is in flight,
+  // instead of holding it back for the ACK (Nagle, RFC 896)
+  bool no_delay = false;
+  // Offer window scaling (RFC 7323) in the handshake, without it the
+  // window stays below 64 KiB
+  bool window_scale = true;
+  // Bytes Send buffers before it blocks, sent or not
+  uint32_t send_buffer = 256 * 1024;
+  // Bytes the peer may send past what was read, the window advertised
+  uint32_t receive_buffer = 256 * 1024;
+  // How the congestion window is computed, taken on Connect or Accept
+  CongestionAlgorithm congestion_control = CongestionAlgorithm::kCubic;
+  // Bounds of the retransmission timeout, taken on Connect or Accept.
+  // RFC 6298 asks for at least a second, Linux takes 200 ms.
+  std::chrono::milliseconds min_rto{200};
+  std::chrono::seconds max_rto{60};
+};
+
 class SocketInternal : private SocketInternalInterface,
                        public std::enable_shared_from_this<SocketInternal> {
 public:
-  SocketInternal(std::shared_ptr<TcpPacket> packet, SocketManager *manager)
+  SocketInternal(PacketPtr packet, SocketManager *manager,
+                 const SocketOptions &options)
       : host_ip_(packet->GetHeader().DestinationAddress()),
         host_port_(packet->GetHeader().DestinationPort()),
         peer_ip_(packet->GetHeader().SourceAddress()),
         peer_port_(packet->GetHeader().SourcePort()),
+        options_(options),
         manager_(manager) {
     Log("SocketInternal from packet");
+    OfferWindow();
+    StartCongestionControl();
     RecvPacket(std::move(packet), true);
   }
 
   SocketInternal(uint32_t host_ip, uint16_t host_port, SocketManager *manager)
-      : host_ip_(host_ip), host_port_(host_port), manager_(manager) {}
+      : host_ip_(host_ip), host_port_(host_port), manager_(manager) {
+    StartCongestionControl();
+  }
   
   SocketInternal(const SocketInternal &) = delete;
 
@@ -158,16 +200,48 @@ public:
   SocketInternal &operator=(const SocketInternal &) = delete;
 
   // API for SocketManager
-  void RecvPacket(std::shared_ptr<TcpPacket> packet, bool check_sum_validate) {
+
+  // Returns whether header prediction took the packet
+  bool RecvPacket(PacketPtr packet, bool check_sum_validate) {
     if (!check_sum_validate) {
       Log("Invalide Checksum");
       state_.InvalideCheckSum()(this);
-    } else {
-      std::lock_guard guard(*this);
-      Log("RecvPacket");
-      current_packet_ = packet;
-      state_(packet->GetHeader())(this);
+      return false;
     }
+
+    std::lock_guard guard(*this);
+    const auto &header = packet->GetHeader();
+    if (header.Syn())
+      NegotiateWindowScale(*packet);
+    if (sack_permitted_ && header.Ack() && packet->OptionsSize())
+      RecvSack(*packet);
+    const auto prediction = state_.Predict(header);
+    if (prediction != Prediction::kMiss) {
+      // What Estab would react with, minus the dispatching
+      const auto &b = state_.GetControlBlock();
+      RecvAck(header.SequenceNumber(), header.AcknowledgementNumber(),
+              WindowField(b));
+      if (prediction == Prediction::kData) {
+        Deliver(*packet);
+        if (header.Psh())
+          SendAck(b.snd_nxt, b.rcv_nxt, WindowField(b));
+        else
+          DelayAck(b.snd_nxt, b.rcv_nxt, WindowField(b));
+      }
+      // An ACK may let through what Nagle held back
+      max_peer_window_ = std::max(max_peer_window_, b.rcv_wnd);
+      Flush(guard);
+      return true;
+    }
+
+    Log("RecvPacket");
+    current_packet_ = &packet;
+    state_(header)(this);
+    current_packet_ = nullptr;
+    max_peer_window_ = std::max(max_peer_window_,
+                                state_.GetControlBlock().rcv_wnd);
+    Flush(guard);
+    return false;
   }
 
   bool IsClosed() {
@@ -179,23 +253,57 @@ public:
     wait_until_readable_.notify_all();
   }
 
-  bool IsAnyPacketForSending(const std::lock_guard<SocketInternal> &) {
-    return !send_buffer_.Empty();
+  // Whether a segment may go out now. It is at most a full segment, and
+  // fits in what the peer's and the congestion window leave. A shorter one
+  // goes out when pushed, or if it is half the largest window the peer
+  // offered. Else it waits for a window cut it short to open (RFC 1122
+  // 4.2.3.4), while anything is unacknowledged, unless no_delay is set,
+  // and while the socket is corked.
+  bool IsAnyPacketForSending(const std::lock_guard<SocketInternal> &,
+                             bool push = false) const {
+    const auto &b = state_.GetControlBlock();
+    if (b.state != State::kEstab && b.state != State::kCloseWait)
+      return false;
+    const uint32_t in_flight = b.snd_nxt - b.snd_una;
+    const uint32_t window = SendWindow();
+    if (send_buffer_.Empty() || in_flight >= window)
+      return false;
+
+    const size_t size = std::min<size_t>(send_buffer_.Unsent(),
+                                         window - in_flight);
+    if (size >= kMaxSegmentSize || size >= max_peer_window_ / 2 || push)
+      return true;
+    if (size < send_buffer_.Unsent() || corked_)
+      return false;
+    return options_.no_delay || in_flight == 0;
   }
 
   auto GetPacketForSending(
       const std::lock_guard<SocketInternal> &) {
     if (send_buffer_.Empty())
-      return std::make_pair(std::shared_ptr<TcpPacket>(), ResendPredicate());
+      return std::make_pair(PacketPtr(), ResendPredicate());
     
-    auto packet = send_buffer_.GetAsTcpPacket(0, state_.Window());
+    const auto &b = state_.GetControlBlock();
+    auto packet = send_buffer_.GetAsTcpPacket(
+        0, std::min(kMaxSegmentSize, b.snd_una + SendWindow() - b.snd_nxt));
     
     state_(Event::kSend, &packet->GetHeader())(this);
+    const auto now = CongestionControl::Clock::now();
+    // One segment at a time is timed
+    if (!rtt_timing_) {
+      rtt_timing_ = true;
+      rtt_seq_ = b.snd_nxt;
+      rtt_start_ = now;
+    }
+    congestion_->OnSend(packet->GetHeader().TcpLength(),
+                        b.snd_nxt - b.snd_una, now);
+    // Carries the ACK
+    AckSent();
     SetSource(host_ip_, host_port_, &packet->GetHeader());
     SetDestination(peer_ip_, peer_port_, &packet->GetHeader());
     
-    TcpHeaderH2N(packet->GetHeader());
-    return std::make_pair(packet, ResendPredicate(weak_from_this()));
+    return std::make_pair(std::move(packet),
+                          ResendPredicate(weak_from_this(), rtt_.Rto()));
   }
 
   void Reset() {
@@ -209,11 +317,39 @@ public:
 
     send_buffer_.Clear();
     recv_buffer_.clear();
+    sack_permitted_ = false;
+    sacked_ = SequenceRanges();
+    AckSent();
+    corked_ = false;
+    window_scale_ = false;
+    max_peer_window_ = 0;
+    StartCongestionControl();
+    wait_until_writable_.notify_all();
     
     state_.Reset();
   }
 
   // API for TcpSocket
+  SocketOptions GetOptions() {
+    std::lock_guard lck(*this);
+    return options_;
+  }
+
+  // The handshake options take effect with the next handshake
+  void SetOptions(const SocketOptions &options) {
+    std::lock_guard lck(*this);
+    options_ = options;
+    Flush(lck);
+  }
+
+  // Corked, only full segments go out, until uncorked pushes the rest
+  void SocketCork(bool cork) {
+    std::lock_guard lck(*this);
+    corked_ = cork;
+    if (!cork)
+      Flush(lck, true);
+  }
+
   void SocketListen(uint16_t port) {
     std::lock_guard lck(*this);
     next_host_port_ = port;
@@ -226,6 +362,8 @@ public:
     next_peer_port_ = port;
 
     auto lck = SelfUniqueLock();
+    OfferWindow();
+    StartCongestionControl();
     state_(Event::kConnect, nullptr)(this);
 
     wait_until_readable_.wait(lck,
@@ -236,23 +374,44 @@ public:
 
   void SocketSend(const char *first, size_t size);
 
+  // Blocks until size bytes arrived. More than half the receive buffer
+  // is taken in parts, so that the window reopens for the rest.
   size_t SocketRecv(char *first, size_t size) {
     std::unique_lock lck(mtx_);
     
-    bytes_demand_.store(size);
-    wait_until_readable_.wait(lck, [this, size] {
-          return recv_buffer_.size() >= size;
-        });
+    while (size) {
+      const size_t demand = std::clamp<size_t>(
+          options_.receive_buffer / 2, 1, size);
+      bytes_demand_.store(demand);
+      wait_until_readable_.wait(lck, [this, demand] {
+            return recv_buffer_.size() >= demand;
+          });
       
-    const auto source_first = recv_buffer_.begin();
-    const auto source_last =
-        recv_buffer_.begin() + std::min(size, recv_buffer_.size());
-    std::copy(source_first, source_last, first);
-    recv_buffer_.erase(source_first, source_last);
+      const auto n = std::min(size, recv_buffer_.size());
+      const auto source_first = recv_buffer_.begin();
+      const auto source_last = recv_buffer_.begin() + n;
+      std::copy(source_first, source_last, first);
+      recv_buffer_.erase(source_first, source_last);
+      first += n;
+      size -= n;
+      OpenWindow();
+    }
     bytes_demand_.store(0);
     return 0;
   }
 
+  size_t SocketAvailable() {
+    std::lock_guard lck(*this);
+    return recv_buffer_.size();
+  }
+
+  RttStatistics SocketRttStatistics() {
+    std::lock_guard lck(*this);
+    auto statistics = rtt_.GetStatistics();
+    statistics.fast_retransmits = fast_retransmits_;
+    return statistics;
+  }
+
   void SocketClose() {
     std::lock_guard lck(*this);
     state_(Event::kClose, nullptr)(this);
@@ -277,27 +436,175 @@ public:
   }
 
 private:
-  void SendPacket(std::shared_ptr<TcpPacket> packet);
-  void SendPacketWithResend(std::shared_ptr<TcpPacket> packet);
+  void SendPacket(PacketPtr packet);
+  void SendPacketWithResend(PacketPtr packet);
+  void ArmDelayedAckTimer();
+  void ArmPersistTimer();
+  // Sends the segments IsAnyPacketForSending lets through
+  void Flush(const std::lock_guard<SocketInternal> &guard, bool push = false);
+
+  // The window the receive buffer makes for, and the shift it takes. Data
+  // past a gap is held anywhere in the window, so the reassembly buffer
+  // spans it.
+  void OfferWindow() {
+    const auto window = options_.receive_buffer;
+    reassembly_.Resize(window);
+    state_.SetWindow(window,
+                     options_.window_scale ? WindowScaleFor(window) : 0);
+  }
+
+  void StartCongestionControl() {
+    congestion_ = MakeCongestionControl(options_.congestion_control,
+                                        kMaxSegmentSize);
+    rtt_ = RttEstimator(options_.min_rto, options_.max_rto);
+    rtt_timing_ = false;
+    duplicate_acks_ = 0;
+    in_recovery_ = false;
+    inflation_ = 0;
+  }
+
+  // What may be in flight, the congestion window inflated during fast
+  // recovery
+  uint32_t SendWindow() const {
+    return std::min(state_.GetControlBlock().rcv_wnd,
+                    congestion_->Window() + inflation_);
+  }
+
+  // RFC 7323 2.2, the windows are scaled only if both SYNs offered it
+  void NegotiateWindowScale(const TcpPacket &packet) {
+    const int shift = WindowScaleOf(packet);
+    window_scale_ = options_.window_scale && shift >= 0;
+    if (window_scale_)
+      state_.SetWindowScale(state_.GetControlBlock().snd_wscale, shift);
+    else
+      state_.SetWindowScale(0, 0);
+  }
+
+  // Receiver side SWS avoidance (RFC 1122 4.2.3.3). Reading makes room,
+  // and the window reopens by a full segment, or half the buffer, at a
+  // time. The peer hears of it at once if it may be waiting for it.
+  void OpenWindow() {
+    const auto &b = state_.GetControlBlock();
+    // A receive buffer grown since the handshake is not held past a gap
+    const auto buffer = static_cast<uint32_t>(std::min<size_t>(
+        options_.receive_buffer, reassembly_.Capacity()));
+    const uint32_t room =
+        buffer - std::min<size_t>(recv_buffer_.size(), buffer);
+    if (room < b.snd_wnd + std::min(buffer / 2, kMaxSegmentSize))
+      return;
+
+    const bool starved = b.snd_wnd < buffer / 2;
+    state_.Window() = room;
+    if (starved && (b.state == State::kEstab ||
+                    b.state == State::kFinWait1 ||
+                    b.state == State::kFinWait2))
+      SendAck(b.snd_nxt, b.rcv_nxt, WindowField(b));
+  }
+
+  // The peer's window left nothing to send and nothing is in flight, so
+  // no ACK is coming to open it. The timer sends what a window which
+  // opened a little lets through, or probes a closed one.
+  bool PersistTimeout(const std::lock_guard<SocketInternal> &guard) {
+    const auto &b = state_.GetControlBlock();
+    if (!WaitsForWindow()) {
+      persist_timer_armed_ = false;
+      return false;
+    }
+    if (b.rcv_wnd)
+      Flush(guard, true);
+    else
+      SendWindowProbe();
+    return true;
+  }
+
+  bool WaitsForWindow() const {
+    const auto &b = state_.GetControlBlock();
+    return (b.state == State::kEstab || b.state == State::kCloseWait) &&
+        !send_buffer_.Empty() && b.snd_nxt == b.snd_una && !corked_;
+  }
+
+  // A segment the peer already has, which it acks with its window, the
+  // way keepalives do (RFC 1122 4.2.3.6)
+  void SendWindowProbe() {
+    const auto &b = state_.GetControlBlock();
+    auto packet = MakeTcpPacket(0);
+    AckHeader(b.snd_una - 1, b.rcv_nxt, WindowField(b), &packet->GetHeader());
+    SendPacket(std::move(packet));
+  }
+
+  // Bytes Send may buffer before it blocks, unbounded until connected
+  size_t SendRoom() const {
+    const auto state = state_.GetState();
+    if (state != State::kEstab && state != State::kCloseWait)
+      return SIZE_MAX;
+    return options_.send_buffer - std::min<size_t>(send_buffer_.Size(),
+                                                   options_.send_buffer);
+  }
 
   void SendSyn(uint32_t seq, uint16_t window) override;
 
   void SendSynAck(uint32_t seq, uint32_t ack, uint16_t window) override {
-    auto packet = MakeTcpPacket(0);
+    // Accept took the SYN, so SACK is permitted only if the peer offered
+    TcpOptions options;
+    if (sack_permitted_)
+      options.AddSackPermitted();
+    if (window_scale_)
+      options.AddWindowScale(state_.GetControlBlock().snd_wscale);
+    auto packet = MakeOptionPacket(options.Data(), options.Size());
     SynAckHeader(seq, ack, window, &packet->GetHeader());
     send_buffer_.InitializeAckNumber(seq + 1);
+    recover_ = seq;
 
     SendPacketWithResend(std::move(packet));
   }
 
   void SendAck(uint32_t seq, uint32_t ack, uint16_t window) override {
-    auto packet = MakeTcpPacket(0);
+    // The receiver tells what it holds past a gap
+    TcpOptions options;
+    if (sack_permitted_)
+      options.AddSack(state_.GetControlBlock().out_of_order);
+    auto packet = MakeOptionPacket(options.Data(), options.Size());
     AckHeader(seq, ack, window, &packet->GetHeader());
 
     Log("Ack", packet->GetHeader().TcpLength());
+    AckSent();
     SendPacket(std::move(packet));
   }
 
+  // RFC 1122 4.2.3.2, the ACK waits for a second segment or the timer
+  void DelayAck(uint32_t seq, uint32_t ack, uint16_t window) override {
+    if (options_.delayed_ack.count() == 0 || ++segments_unacked_ >= 2) {
+      SendAck(seq, ack, window);
+      return;
+    }
+
+    ack_deadline_ = std::chrono::steady_clock::now() + options_.delayed_ack;
+    if (!ack_timer_armed_) {
+      ack_timer_armed_ = true;
+      ArmDelayedAckTimer();
+    }
+  }
+
+  // The timer is armed once, for as long as ACKs are being delayed, and
+  // checks the deadline every delayed_ack period
+  bool DelayedAckTimeout() {
+    if (segments_unacked_ == 0 || state_.GetState() != State::kEstab) {
+      ack_timer_armed_ = false;
+      return false;
+    }
+    if (std::chrono::steady_clock::now() < ack_deadline_)
+      return true;
+
+    const auto &b = state_.GetControlBlock();
+    SendAck(b.snd_nxt, b.rcv_nxt, WindowField(b));
+    ack_timer_armed_ = false;
+    return false;
+  }
+
+  void AckSent() {
+    segments_unacked_ = 0;
+  }
+
   void SendFin(uint32_t seq, uint32_t ack, uint16_t window) override {
     auto packet = MakeTcpPacket(0);
     FinHeader(seq, ack, window, &packet->GetHeader());
@@ -308,7 +615,125 @@ private:
 
   void RecvAck(
       uint32_t seq_recv, uint32_t ack_recv, uint16_t window_recv) override {
+    const auto &b = state_.GetControlBlock();
+    const auto last_ack = send_buffer_.LastAck();
+    const bool advanced = SeqLt(last_ack, ack_recv);
+    const bool duplicate = !advanced && IsDuplicateAck(ack_recv);
+    last_peer_window_ = b.rcv_wnd;
     send_buffer_.Ack(ack_recv);
+    sacked_.Advance(b.snd_una);
+    if (advanced)
+      NewAck(ack_recv, ack_recv - last_ack);
+    else if (duplicate)
+      DuplicateAck();
+    wait_until_writable_.notify_all();
+  }
+
+  void NewAck(uint32_t ack, uint32_t acked) {
+    const auto &b = state_.GetControlBlock();
+    const auto now = CongestionControl::Clock::now();
+    CongestionControl::Clock::duration rtt{0};
+    if (rtt_timing_ && SeqLe(rtt_seq_, ack)) {
+      rtt = now - rtt_start_;
+      rtt_.Sample(std::chrono::duration_cast<RttEstimator::Duration>(rtt));
+      rtt_timing_ = false;
+    }
+    duplicate_acks_ = 0;
+
+    if (!in_recovery_) {
+      congestion_->OnAck(acked, b.snd_nxt - b.snd_una + acked, rtt, now);
+      return;
+    }
+    // RFC 6582 3.2 (5), a partial ACK resends the next hole at once and
+    // deflates the window by what left the network
+    if (SeqLt(b.snd_una, recover_)) {
+      inflation_ = inflation_ - std::min(inflation_, acked) + kMaxSegmentSize;
+      ResendHole();
+      return;
+    }
+    in_recovery_ = false;
+    inflation_ = 0;
+  }
+
+  // RFC 5681 2, an ACK which moves nothing, carries nothing and leaves the
+  // window as it was, while data is in flight
+  bool IsDuplicateAck(uint32_t ack) const {
+    const auto &b = state_.GetControlBlock();
+    if (!current_packet_ || ack != b.snd_una || b.snd_nxt == b.snd_una ||
+        b.rcv_wnd != last_peer_window_)
+      return false;
+    const auto &header = (*current_packet_)->GetHeader();
+    return header.TcpLength() == 0 && !header.Syn() && !header.Fin();
+  }
+
+  // The third duplicate ACK resends the segment it asks for and starts fast
+  // recovery (RFC 5681 3.2, RFC 6582), at most once per window. Every
+  // duplicate ACK is a segment which left the network, the window grows
+  // by it so that new data keeps the pipe full.
+  void DuplicateAck() {
+    const auto &b = state_.GetControlBlock();
+    ++duplicate_acks_;
+    if (in_recovery_) {
+      inflation_ += kMaxSegmentSize;
+      // The scoreboard tells the other holes
+      if (sack_permitted_)
+        ResendHole();
+      return;
+    }
+    if (duplicate_acks_ < kDuplicateAckThreshold ||
+        SeqLt(b.snd_una, recover_))
+      return;
+
+    congestion_->OnLoss(b.snd_nxt - b.snd_una,
+                        CongestionControl::Clock::now());
+    in_recovery_ = true;
+    recover_ = b.snd_nxt;
+    resent_ = b.snd_una;
+    inflation_ = kDuplicateAckThreshold * kMaxSegmentSize;
+    ++fast_retransmits_;
+    ResendHole();
+  }
+
+  // Resends a segment of the first hole past what recovery resent. Without
+  // SACK only the hole at snd_una is known, with it every hole below the
+  // highest block (RFC 6675).
+  void ResendHole() {
+    const auto &b = state_.GetControlBlock();
+    uint32_t seq = SeqMax(resent_, b.snd_una);
+    for (const auto &range : sacked_)
+      if (SeqLe(range.begin, seq) && SeqLt(seq, range.end))
+        seq = range.end;
+    if (sacked_.Empty() ? seq != b.snd_una
+                        : !SeqLt(seq, (sacked_.end() - 1)->end))
+      return;
+    // Up to the next block
+    uint32_t end = seq + kMaxSegmentSize;
+    for (const auto &range : sacked_)
+      if (SeqLt(seq, range.begin))
+        end = SeqMin(end, range.begin);
+
+    const uint32_t offset = seq - b.snd_una;
+    if (offset >= send_buffer_.Size())
+      return;
+    auto packet = send_buffer_.GetAsResendPacket(
+        offset, std::min<size_t>(end - b.snd_una, send_buffer_.Size()));
+    AckHeader(seq, b.rcv_nxt, WindowField(b), &packet->GetHeader());
+    resent_ = seq + packet->GetHeader().TcpLength();
+    // Karn, the ACK may be for either copy
+    rtt_timing_ = false;
+    SendPacket(std::move(packet));
+  }
+
+  // Adds the blocks of an ACK to the scoreboard. Those not within what is
+  // in flight are ignored, as are new holes once the scoreboard is full,
+  // which only costs resends.
+  void RecvSack(const TcpPacket &packet) {
+    const auto &b = state_.GetControlBlock();
+    ForEachSackBlock(packet, [this, &b](uint32_t begin, uint32_t end) {
+          if (SeqLt(b.snd_una, begin) && SeqLt(begin, end) &&
+              SeqLe(end, b.snd_nxt))
+            sacked_.Add(begin, end);
+        });
   }
 
   void RecvFin(
@@ -322,21 +747,56 @@ private:
 
   void Accept() override {
     Log(__func__);
-    auto packet = current_packet_.lock();
-    if (packet->GetHeader().TcpLength() > 0) {
+    const auto &packet = **current_packet_;
+    // A SYN, or the SYN-ACK to ours, settles whether SACK is used
+    if (packet.GetHeader().Syn())
+      sack_permitted_ = options_.selective_ack && HasSackPermitted(packet);
+    Deliver(packet);
+  }
+
+  // Hands the payload to the reader
+  void Deliver(const TcpPacket &packet) {
+    if (packet.GetHeader().TcpLength() > 0) {
       
-      recv_buffer_.insert(recv_buffer_.end(), packet->begin(), packet->end());
+      packet.ForEachPayloadSpan([this](const char *data, size_t size) {
+            recv_buffer_.insert(recv_buffer_.end(), data, data + size);
+          });
       Log("With Content");
-      if (bytes_demand_.load() != 0 &&
-          recv_buffer_.size() >= bytes_demand_.load())
-        wait_until_readable_.notify_all();
+      NotifyReadable();
     }
   }
 
+  void NotifyReadable() {
+    if (bytes_demand_.load() != 0 &&
+        recv_buffer_.size() >= bytes_demand_.load())
+      wait_until_readable_.notify_all();
+  }
+
   void Discard() override {
     Log(__func__);
   }
 
+  void Hold(uint32_t seq) override {
+    Log(__func__);
+    const auto &packet = **current_packet_;
+    size_t skip = seq - packet.GetHeader().SequenceNumber();
+    packet.ForEachPayloadSpan([this, &seq, &skip](const char *data,
+                                                  size_t size) {
+          const auto n = std::min(skip, size);
+          skip -= n;
+          reassembly_.Store(seq, data + n, data + size);
+          seq += static_cast<uint32_t>(size - n);
+        });
+  }
+
+  void Reassemble(uint32_t seq, uint32_t end) override {
+    Log(__func__, " ", end - seq);
+    reassembly_.Load(seq, end, [this](const char *data, size_t size) {
+          recv_buffer_.insert(recv_buffer_.end(), data, data + size);
+        });
+    NotifyReadable();
+  }
+
   void SeqOutofRange(uint16_t window) override {
     assert(false);
   }
@@ -360,33 +820,69 @@ private:
     return SocketIdentifier(host_ip_, host_port_, peer_ip_, peer_port_);
   }
 
+  // The segment at seq timed out and goes again. Resent segments are not
+  // timed (Karn), and the oldest one timing out loses the window and
+  // backs the timer off.
+  void RetransmissionTimeout(uint32_t seq) {
+    const auto &b = state_.GetControlBlock();
+    rtt_timing_ = false;
+    if (seq == b.snd_una) {
+      rtt_.Backoff();
+      congestion_->OnTimeout(b.snd_nxt - b.snd_una);
+      // RFC 6582 4, no fast retransmit for what was sent before
+      in_recovery_ = false;
+      inflation_ = 0;
+      recover_ = b.snd_nxt;
+    }
+  }
+
   class ResendPredicate {
   public:
     ResendPredicate() = default;
 
-    ResendPredicate(std::weak_ptr<SocketInternal> &&internal)
-        : internal_(std::move(internal)) {}
+    ResendPredicate(std::weak_ptr<SocketInternal> &&internal,
+                    RttEstimator::Duration timeout)
+        : internal_(std::move(internal)), timeout_(timeout) {}
+
+    // How long the segment waits for its ACK before the next resend
+    RttEstimator::Duration Timeout() const {
+      return timeout_;
+    }
 
-    bool operator()(std::shared_ptr<TcpPacket> &packet) {
+    bool operator()(PacketPtr &packet) {
       auto shared_self = internal_.lock();
       if (!shared_self)
         return false;
       
       std::lock_guard guard(*shared_self);
-      packet->GetHeader().AcknowledgementNumber() =
-          htonl(shared_self->state_.GetControlBlock().rcv_nxt);
-      const auto seq = ntohl(packet->GetHeader().SequenceNumber());
-      if (shared_self->state_.GetState() == State::kClosed) {
+      // The last send may still be read by the receiver or the transport,
+      // the ack is patched in a copy then
+      if (!packet.Unique())
+        packet = MakeNetPacket(*packet);
+      auto &header = packet->GetHeader();
+      header.PatchAcknowledgementNumber(
+          shared_self->state_.GetControlBlock().rcv_nxt);
+      if (shared_self->state_.GetState() == State::kClosed)
         return false;
-      } else if (packet->GetHeader().Syn() || packet->GetHeader().Fin()) {
-        return shared_self->state_.GetControlBlock().snd_una < seq + 1;
-      } else {
-        return shared_self->state_.GetControlBlock().snd_una < seq;
+      // Resent until the ACK covers the end of the segment, SYN and FIN
+      // take one sequence number
+      const auto seq = header.SequenceNumber();
+      const auto end = seq + header.TcpLength() +
+                       (header.Syn() || header.Fin() ? 1 : 0);
+      // The receiver holds what it selectively acked, only holes are resent
+      const bool resend =
+          SeqLt(shared_self->state_.GetControlBlock().snd_una, end) &&
+          !shared_self->sacked_.Covers(seq, end);
+      if (resend) {
+        shared_self->RetransmissionTimeout(seq);
+        timeout_ = shared_self->rtt_.Rto();
       }
+      return resend;
     }
 
   private:
     std::weak_ptr<SocketInternal> internal_;
+    RttEstimator::Duration timeout_{0};
   };
 
   uint32_t host_ip_ = 0;
@@ -400,10 +896,45 @@ private:
   uint32_t next_peer_ip_ = 0;
   uint16_t next_peer_port_ = 0;
 
-  std::weak_ptr<TcpPacket> current_packet_;
+  SocketOptions options_;
+  // Negotiated in the handshake
+  bool sack_permitted_ = false;
+  // What the peer selectively acked, past snd_una
+  SequenceRanges sacked_;
+  // Negotiated in the handshake
+  bool window_scale_ = false;
+  // The largest window the peer offered
+  uint32_t max_peer_window_ = 0;
+  bool persist_timer_armed_ = false;
+
+  std::unique_ptr<CongestionControl> congestion_;
+  RttEstimator rtt_;
+  // Fast recovery ends once recover_, snd_nxt when it began, is acked
+  uint32_t duplicate_acks_ = 0;
+  bool in_recovery_ = false;
+  uint32_t recover_ = 0;
+  // Recovery resent up to here
+  uint32_t resent_ = 0;
+  uint32_t inflation_ = 0;
+  uint32_t last_peer_window_ = 0;
+  uint64_t fast_retransmits_ = 0;
+  // The segment ending at rtt_seq_ is timed, if rtt_timing_
+  bool rtt_timing_ = false;
+  uint32_t rtt_seq_ = 0;
+  CongestionControl::Clock::time_point rtt_start_;
+
+  // In order segments received since the last ACK went out
+  uint32_t segments_unacked_ = 0;
+  std::chrono::steady_clock::time_point ack_deadline_;
+  bool ack_timer_armed_ = false;
+  bool corked_ = false;
+
+  // The packet being handled by state_, valid during RecvPacket only
+  PacketPtr *current_packet_ = nullptr;
 
   TcpSendingBuffer send_buffer_;
   std::deque<char> recv_buffer_;
+  ReassemblyBuffer reassembly_;
   TcpStateManager state_;
 
   SocketManager * const manager_;
@@ -413,6 +944,8 @@ private:
   // for blocked recv
   std::atomic<size_t> bytes_demand_{0};
   std::condition_variable wait_until_readable_;
+  // for Send blocked on a full send buffer
+  std::condition_variable wait_until_writable_;
 };
 
 } // namespace tcp_stack
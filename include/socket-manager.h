@@ -1,6 +1,7 @@
 #ifndef _TCP_STACK_SOCKET_MANAGER_H_
 #define _TCP_STACK_SOCKET_MANAGER_H_
 
+#include <atomic>
 #include <chrono>
 #include <list>
 #include <mutex>
@@ -19,6 +20,12 @@ namespace tcp_stack {
 
 class NetworkService;
 
+// Segments of known connections, by whether header prediction took them
+struct HeaderPredictionStatistics {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
 class SocketManager {
 public:
   SocketManager(uint32_t ip, NetworkService *network_service)
@@ -34,25 +41,27 @@ public:
     Log(__func__);
   }
 
+  // Sends packet, and again every pred.Timeout() for as long as pred
+  // holds. The timeout is asked again after each resend, so that it backs
+  // off.
   template <class Predicate>
-  void InternalSendPacketWithResend(std::shared_ptr<TcpPacket> packet,
+  void InternalSendPacketWithResend(PacketPtr packet,
                                     Predicate pred) {
     Log(__func__);
-    constexpr auto resent_timeout = std::chrono::seconds(5);
-    SendPacket(packet);
-    timeout_queue_.PushEvent(
-        [packet = std::move(packet), pred = std::move(pred), this]() mutable {
-          const bool is_valid = pred(packet);
-          Log("Time out", is_valid);
-          if (is_valid)
-            SendPacket(packet);
-          return is_valid;
-        }, resent_timeout);
+    SendPacket(packet.Share());
+    PushResendTimer(std::move(packet), std::move(pred));
   }
 
-  void InternalSendPacket(std::shared_ptr<TcpPacket> packet) {
+  // Runs fn after period, and again every period for as long as it
+  // returns true
+  template <class Fn, class Rep, class Period>
+  void InternalPushTimer(Fn fn, std::chrono::duration<Rep, Period> period) {
+    timeout_queue_.PushEvent(std::move(fn), period);
+  }
+
+  void InternalSendPacket(PacketPtr packet) {
     Log(__func__);
-    SendPacket(packet);
+    SendPacket(std::move(packet));
   }
 
   void InternalListen(std::shared_ptr<SocketInternal> internal,
@@ -67,10 +76,12 @@ public:
     identifier_to_socket_.emplace(id, std::move(internal));
   }
 
+  // The listener is locked, and passes its options
   void InternalNewConnection(SocketInternal *internal,
-                             std::shared_ptr<TcpPacket> packet) {
+                             PacketPtr packet, const SocketOptions &options) {
     SocketIdentifier id(packet->GetHeader());
-    auto new_socket = std::make_shared<SocketInternal>(std::move(packet), this);
+    auto new_socket = std::make_shared<SocketInternal>(
+        std::move(packet), this, options);
 
     std::lock_guard guard(*this);
 
@@ -178,10 +189,9 @@ public:
     throw std::runtime_error("Failed in allocating port number");
   }
 
-  void ReceivePacket(std::shared_ptr<TcpPacket> packet) {
+  void ReceivePacket(PacketPtr packet) {
     const bool check_sum_validate = CalculateChecksum(*packet) == 0;
 
-    TcpHeaderN2H(packet->GetHeader());
     Log(packet->GetHeader());
 
     const auto host_ip = ip_;
@@ -197,13 +207,15 @@ public:
 
     if (found) {
       Log("Internal found");
-      internal->RecvPacket(std::move(packet), check_sum_validate);
+      const bool predicted =
+          internal->RecvPacket(std::move(packet), check_sum_validate);
+      (predicted ? prediction_hits_ : prediction_misses_).fetch_add(
+          1, std::memory_order_relaxed);
     } else if (check_sum_validate) {
       Log("Sending Rst");
       auto rst_packet = MakeTcpPacket(0);
       RstHeader(packet->GetHeader(), &rst_packet->GetHeader());
-      TcpHeaderH2N(rst_packet->GetHeader());
-      SendPacket(rst_packet);
+      SendPacket(std::move(rst_packet));
     }
   }
   
@@ -217,6 +229,13 @@ public:
     return *ite_socket;
   }
 
+  HeaderPredictionStatistics GetHeaderPredictionStatistics() const {
+    HeaderPredictionStatistics statistics;
+    statistics.hits = prediction_hits_.load(std::memory_order_relaxed);
+    statistics.misses = prediction_misses_.load(std::memory_order_relaxed);
+    return statistics;
+  }
+
   void lock() {
     mtx_.lock();
   }
@@ -230,7 +249,26 @@ public:
   }
 
 private:
-  void SendPacket(std::shared_ptr<TcpPacket> packet);
+  // Fills in the checksum
+  void SendPacket(PacketPtr packet);
+  // The checksum is kept up to date by the resend predicate
+  void ResendPacket(PacketPtr packet);
+
+  // Each expiry pushes the next one, the timeout may have changed
+  template <class Predicate>
+  void PushResendTimer(PacketPtr packet, Predicate pred) {
+    const auto timeout = pred.Timeout();
+    timeout_queue_.PushEvent(
+        [packet = std::move(packet), pred = std::move(pred), this]() mutable {
+          const bool is_valid = pred(packet);
+          Log("Time out", is_valid);
+          if (is_valid) {
+            ResendPacket(packet.Share());
+            PushResendTimer(std::move(packet), std::move(pred));
+          }
+          return false;
+        }, timeout);
+  }
 
   std::pair<std::shared_ptr<SocketInternal>, bool> FindInternal(
       uint32_t host_ip, uint16_t host_port, uint32_t peer_ip,
@@ -244,27 +282,13 @@ private:
     return {socket->second, true};
   }
 
-  void SendPacketsForSending() {
-    decltype(sockets_wait_for_sending_) sockets;
-    {
-      std::lock_guard guard(*this);
-      sockets.swap(sockets_wait_for_sending_);
-    }
-
-    for (auto &internal : sockets) {
-      std::lock_guard guard(*internal);
-      while (internal->IsAnyPacketForSending(guard)) {
-        auto [packet, pred] = internal->GetPacketForSending(guard);
-
-        packet->GetHeader().Checksum() = 0;
-        packet->GetHeader().Checksum() = CalculateChecksum(*packet);
-        InternalSendPacketWithResend(std::move(packet), pred);
-      }
-    }
-  }
+  void SendPacketsForSending();
 
   uint32_t ip_ = 0;
 
+  std::atomic<uint64_t> prediction_hits_{0};
+  std::atomic<uint64_t> prediction_misses_{0};
+
   std::unordered_set<SocketIdentifier> used_port_;
 
   std::unordered_set<std::shared_ptr<SocketInternal>> unused_sockets_;
@@ -12,8 +12,7 @@ class CallableBase {
 public:
   virtual ~CallableBase() = default;
   virtual Ret operator()(Args... args) = 0;
-  
-  virtual CallableBase *CopyConstruct(const CallableBase *from, void *to) = 0;
+
   virtual CallableBase *MoveConstruct(CallableBase *from, void *to) = 0;
 };
 
@@ -29,10 +28,6 @@ public:
     return fn_(std::forward<Args>(args)...);
   }
 
-  Base *CopyConstruct(const Base *from, void *to) override {
-    return new(to) Callable(static_cast<const Callable *>(from)->fn_);
-  }
-
   Base *MoveConstruct(Base *from, void *to) override {
     return new(to) Callable(std::move(static_cast<Callable *>(from)->fn_));
   }
@@ -75,26 +70,36 @@ private:
   std::vector<unsigned char> buff_;
 };
 
+// Callables larger than size go to the heap, unless heap is false, then
+// they do not compile.
 template <class Fn, size_t size = 64,
-          size_t align = alignof(std::aligned_storage_t<size>)>
+          size_t align = alignof(std::aligned_storage_t<size>),
+          bool heap = true>
 class StackFunction;
 
-template <class Ret, class... Args, size_t size, size_t align>
-class StackFunction<Ret(Args...), size, align> {
+template <class Ret, class... Args, size_t size, size_t align, bool heap>
+class StackFunction<Ret(Args...), size, align, heap> {
 public:
   using CallableBaseType = CallableBase<Ret, Args...>;
   template <class Fn>
   using CallableType = Callable<
       std::remove_const_t<std::remove_reference_t<Fn>>, Ret, Args...>;
   using StaticBufferType = std::aligned_storage_t<size, align>;
-
   template <class Fn>
+  using EnableIfCallable = std::enable_if_t<
+      !std::is_same_v<std::remove_cv_t<std::remove_reference_t<Fn>>,
+                      StackFunction>>;
+
+  template <class Fn, class = EnableIfCallable<Fn>>
   StackFunction(Fn &&fn)
       noexcept (std::is_nothrow_constructible_v<
                     std::remove_const_t<std::remove_reference_t<Fn>>, Fn> &&
                 sizeof(CallableType<Fn>) <= sizeof(StaticBufferType))
       : dynamic_buffer_(sizeof(CallableType<Fn>) <= sizeof(StaticBufferType) ?
                         0 : sizeof(CallableType<Fn>)) {
+    static_assert(heap ||
+                  sizeof(CallableType<Fn>) <= sizeof(StaticBufferType),
+                  "the callable does not fit in the static buffer");
     if constexpr (sizeof(CallableType<Fn>) <= sizeof(StaticBufferType)) {
       callable_ = new(&static_buffer_) CallableType<Fn>(std::forward<Fn>(fn));
     } else {
@@ -110,7 +115,7 @@ public:
       : dynamic_buffer_(std::move(x.dynamic_buffer_)) {
     if (dynamic_buffer_) {
       std::swap(callable_, x.callable_);
-    } else {
+    } else if (x.callable_) {
       callable_ = x.callable_->MoveConstruct(x.callable_, &static_buffer_);
     }
   }
@@ -121,18 +126,39 @@ public:
   }
 
   StackFunction &operator=(const StackFunction &) = delete;
-  StackFunction &operator=(StackFunction &&) = delete;
 
-  template <class Fn>
+  StackFunction &operator=(StackFunction &&x) noexcept {
+    if (this == &x)
+      return *this;
+    if (callable_)
+      callable_->~CallableBaseType();
+    callable_ = nullptr;
+
+    // Our old buffer, if any, goes to x
+    dynamic_buffer_ = std::move(x.dynamic_buffer_);
+    if (dynamic_buffer_) {
+      std::swap(callable_, x.callable_);
+    } else if (x.callable_) {
+      callable_ = x.callable_->MoveConstruct(x.callable_, &static_buffer_);
+    }
+    return *this;
+  }
+
+  template <class Fn, class = EnableIfCallable<Fn>>
   StackFunction &operator=(Fn &&fn)
       noexcept (std::is_nothrow_constructible_v<
                     std::remove_const_t<std::remove_reference_t<Fn>>, Fn> &&
                 sizeof(CallableType<Fn>) <= sizeof(StaticBufferType)) {
+    static_assert(heap ||
+                  sizeof(CallableType<Fn>) <= sizeof(StaticBufferType),
+                  "the callable does not fit in the static buffer");
     if (callable_)
-      callable_->CallableBaseType();
+      callable_->~CallableBaseType();
     callable_ = nullptr;
 
     if constexpr (sizeof(CallableType<Fn>) <= sizeof(StaticBufferType)) {
+      // A dynamic buffer left means the callable lives there
+      dynamic_buffer_.NewStorage(0);
       callable_ = new(&static_buffer_) CallableType<Fn>(std::forward<Fn>(fn));
     } else {
       dynamic_buffer_.NewStorage(sizeof(CallableType<Fn>));
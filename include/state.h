@@ -4,14 +4,16 @@
 #include <cassert>
 #include <cstddef>
 
-#include <functional>
+#include <algorithm>
 #include <iterator>
 #include <utility>
-#include <variant>
 
 #include <iostream>
 
+#include "reassembly-queue.h"
 #include "safe-log.h"
+#include "sequence-number.h"
+#include "stack-function.h"
 #include "tcp-header.h"
 
 namespace tcp_stack {
@@ -60,6 +62,8 @@ public:
   virtual void SendSyn(uint32_t seq, uint16_t window) = 0;
   virtual void SendSynAck(uint32_t seq, uint32_t ack, uint16_t window) = 0;
   virtual void SendAck(uint32_t seq, uint32_t ack, uint16_t window) = 0;
+  // Acks in order data, possibly later and together with more
+  virtual void DelayAck(uint32_t seq, uint32_t ack, uint16_t window) = 0;
   virtual void SendFin(uint32_t seq, uint32_t ack, uint16_t window) = 0;
 
   virtual void RecvSyn(uint32_t seq_recv, uint16_t window_recv) = 0;
@@ -73,6 +77,11 @@ public:
 
   virtual void Accept() = 0;
   virtual void Discard() = 0;
+  // Keeps the payload of the segment from seq on, past a gap or past what
+  // was delivered already
+  virtual void Hold(uint32_t seq) = 0;
+  // Delivers the held bytes of [seq, end), after the accepted segment
+  virtual void Reassemble(uint32_t seq, uint32_t end) = 0;
   virtual void SeqOutofRange(uint16_t window) = 0;
   virtual void SendRst(uint32_t seq) = 0;
 
@@ -85,171 +94,140 @@ public:
 
 struct TcpControlBlock;
 
-class TcpState {
-public:
-  using ReactType = std::function<void(SocketInternalInterface *)>;
-  using TriggerType = std::pair<ReactType, TcpState *>;
-
-  virtual ~TcpState() = default;
-
-  virtual TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) = 0;
-  virtual TriggerType operator()(const TcpHeader &, TcpControlBlock &) = 0;
-
-  virtual State GetState() const = 0;
-};
-
-class Closed final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kClosed;
-  }
-};
-
-class Listen final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kListen;
-  }
-};
-
-class SynRcvd final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kSynRcvd;
-  }
-};
-
-class SynSent final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kSynSent;
-  }
-};
-
-class Estab final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kEstab;
-  }
+// What header prediction made of a segment
+enum class Prediction {
+  kMiss = 0,
+  kAck,
+  kData
 };
 
-class FinWait1 final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kFinWait1;
-  }
+// Segments are told apart by their flags, the handlers check the numbers
+enum class PacketClass {
+  kSyn = 0,
+  kSynAck,
+  kAck,
+  kFin,
+  kOther
 };
 
-class CloseWait final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
+constexpr size_t kStates = static_cast<size_t>(State::kTimeWait) + 1;
+constexpr size_t kEvents = static_cast<size_t>(Event::kClose) + 1;
+constexpr size_t kPacketClasses = static_cast<size_t>(PacketClass::kOther) + 1;
+
+inline PacketClass Classify(const TcpHeader &header) {
+  if (header.Fin())
+    return header.Ack() && !header.Syn() ?
+        PacketClass::kFin : PacketClass::kOther;
+  if (header.Syn())
+    return header.Ack() ? PacketClass::kSynAck : PacketClass::kSyn;
+  return header.Ack() ? PacketClass::kAck : PacketClass::kOther;
+}
 
-  State GetState() const override {
-    return State::kCloseWait;
-  }
+struct TcpState {
+  // Reacts capture a few sequence numbers at most, they are kept inline so
+  // that no transition allocates
+  using ReactType = StackFunction<void(SocketInternalInterface *), 32,
+                                  alignof(std::max_align_t), false>;
+  // The react, and the state to move to
+  using TriggerType = std::pair<ReactType, State>;
 };
 
-class FinWait2 final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
+// Data segments are cut to at most this many bytes
+constexpr uint32_t kMaxSegmentSize = 1024;
+// RFC 7323 2.3
+constexpr uint8_t kMaxWindowScale = 14;
 
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
-
-  State GetState() const override {
-    return State::kFinWait2;
-  }
-};
+struct TcpControlBlock {
+  uint32_t snd_seq = 0; // initial sequence number
 
-class Closing final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
+  uint32_t snd_una = 0; // oldest unacknowledge number
+  uint32_t snd_nxt = 0; // next sequence number to send
+  uint32_t snd_wnd = 1024; // window we advertise, in bytes
+  uint8_t snd_wscale = 0; // shift of the windows we advertise
 
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
+  uint32_t rcv_nxt = 0; // next sequence number to recv
+  uint32_t rcv_wnd = 0; // window the peer advertised, in bytes
+  uint8_t rcv_wscale = 0; // shift of the windows the peer advertises
+  SequenceRanges out_of_order; // held by the socket, past rcv_nxt
 
-  State GetState() const override {
-    return State::kClosing;
-  }
+  State state = State::kClosed;
 };
 
-class LastAck final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
-
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
+// The window field of the segments we send. That of a SYN is never
+// scaled (RFC 7323 2.2).
+constexpr uint16_t WindowField(const TcpControlBlock &b) {
+  return static_cast<uint16_t>(std::min<uint32_t>(b.snd_wnd >> b.snd_wscale,
+                                                  0xffff));
+}
 
-  State GetState() const override {
-    return State::kLastAck;
-  }
-};
+constexpr uint16_t SynWindowField(const TcpControlBlock &b) {
+  return static_cast<uint16_t>(std::min<uint32_t>(b.snd_wnd, 0xffff));
+}
 
-class TimeWait final : public TcpState {
-public:
-  TriggerType operator()(Event, TcpHeader *, TcpControlBlock &) override;
+// The window the peer advertised in header, in bytes
+inline uint32_t PeerWindow(const TcpHeader &header, const TcpControlBlock &b) {
+  return static_cast<uint32_t>(header.Window()) <<
+      (header.Syn() ? 0 : b.rcv_wscale);
+}
 
-  TriggerType operator()(const TcpHeader &, TcpControlBlock &) override;
+// The smallest shift which fits window in the 16 bit field
+constexpr uint8_t WindowScaleFor(uint32_t window) {
+  uint8_t shift = 0;
+  while (shift < kMaxWindowScale && (window >> shift) > 0xffff)
+    ++shift;
+  return shift;
+}
 
-  State GetState() const override {
-    return State::kTimeWait;
+// The handler of a transition comes from constexpr tables, indexed by the
+// state and the event or the class of the packet, with no virtual call.
+// The block moves to the next state and the react is returned.
+TcpState::ReactType Transition(Event event, TcpHeader *header,
+                               TcpControlBlock &b);
+TcpState::ReactType Transition(const TcpHeader &header, TcpControlBlock &b);
+
+// Van Jacobson's header prediction. In ESTABLISHED, the next expected
+// segment with no flag but ACK, PSH aside, is either a pure ACK of new
+// data or in order data. For those the block is updated as Estab would,
+// and the caller does the rest in straight line code. Anything else is a
+// miss and goes through the state machine.
+inline Prediction Predict(const TcpHeader &header, TcpControlBlock &b) {
+  if (b.state != State::kEstab ||
+      (header.Flags() & ~header_layout::Psh::kMask) !=
+          header_layout::Ack::kMask ||
+      header.SequenceNumber() != b.rcv_nxt)
+    return Prediction::kMiss;
+
+  const auto ack = header.AcknowledgementNumber();
+  const auto length = header.TcpLength();
+  if (length == 0) {
+    // Duplicate ACKs are left to the state machine
+    if (SeqLe(ack, b.snd_una) || SeqGt(ack, b.snd_nxt))
+      return Prediction::kMiss;
+    b.snd_una = ack;
+    b.rcv_wnd = PeerWindow(header, b);
+    return Prediction::kAck;
   }
-};
-
-struct TcpControlBlock {
-  uint32_t snd_seq = 0; // initial sequence number
-
-  uint32_t snd_una = 0; // oldest unacknowledge number
-  uint32_t snd_nxt = 0; // next sequence number to send
-  uint16_t snd_wnd = 0; // window
-
-  uint32_t rcv_nxt = 0; // next sequence number to recv
-  uint32_t rcv_wnd = 0; // windows
 
-  std::variant<Closed, Listen, SynRcvd, SynSent, Estab, FinWait1, CloseWait,
-               FinWait2, Closing, LastAck, TimeWait> state;
-};
+  // The segment may fill a gap, the state machine reassembles, or be past
+  // the window
+  if (SeqLt(ack, b.snd_una) || SeqGt(ack, b.snd_nxt) ||
+      !b.out_of_order.Empty() || length > b.snd_wnd)
+    return Prediction::kMiss;
+  b.snd_una = ack;
+  b.rcv_nxt += length;
+  b.snd_wnd -= length;
+  b.rcv_wnd = PeerWindow(header, b);
+  return Prediction::kData;
+}
 
 class TcpStateManager {
 public:
   TcpStateManager() = default;
 
-  TcpStateManager(const TcpStateManager &x)
-      : block_(x.block_),
-        state_(std::visit([](auto &arg) {
-            return static_cast<TcpState *>(&arg);
-          }, block_.state)) {}
-  
-  TcpStateManager &operator=(const TcpStateManager &) = delete;
-
   TcpState::ReactType operator()(Event event, TcpHeader *header) {
     Log(block_.snd_nxt, " Action In: ", ToString(GetState()));
 
-    auto [react, new_state] = state_->operator()(event, header, block_);
-    state_ = new_state;
+    auto react = Transition(event, header, block_);
 
     Log("Action out: ", ToString(GetState()), "\n");
     return react;
@@ -258,16 +236,19 @@ public:
   TcpState::ReactType operator()(const TcpHeader &header) {
     Log(block_.snd_nxt, " Packet In: ", ToString(GetState()));
 
-    auto [react, new_state] = state_->operator()(header, block_);
-    state_ = new_state;
+    auto react = Transition(header, block_);
 
     Log("Packet Out: ", ToString(GetState()), "\n");
     return react;
   }
 
+  Prediction Predict(const TcpHeader &header) {
+    return tcp_stack::Predict(header, block_);
+  }
+
   TcpState::ReactType InvalideCheckSum() {
     const auto &b = block_;
-    return [seq = b.snd_nxt, ack = b.rcv_nxt, wnd = b.snd_wnd](
+    return [seq = b.snd_nxt, ack = b.rcv_nxt, wnd = WindowField(b)](
             SocketInternalInterface *tcp) {
           tcp->Discard();
           tcp->SendAck(seq, ack, wnd);
@@ -275,7 +256,7 @@ public:
   }
 
   State GetState() const {
-    return state_->GetState();
+    return block_.state;
   }
 
   const auto &GetControlBlock() const {
@@ -289,6 +270,18 @@ public:
     return block_.snd_wnd;
   }
 
+  // Before the handshake, the window offered and its shift
+  void SetWindow(uint32_t window, uint8_t shift) {
+    block_.snd_wnd = window;
+    block_.snd_wscale = shift;
+  }
+
+  // Once the SYN of the peer arrived, the shifts in use in both directions
+  void SetWindowScale(uint8_t snd_wscale, uint8_t rcv_wscale) {
+    block_.snd_wscale = snd_wscale;
+    block_.rcv_wscale = rcv_wscale;
+  }
+
   auto PeerWindow() const {
     return block_.rcv_wnd;
   }
@@ -299,12 +292,10 @@ public:
 
   void Reset() {
     block_ = TcpControlBlock();
-    state_ = &std::get<Closed>(block_.state);
   }
 
 private:
   TcpControlBlock block_;
-  TcpState *state_ = &std::get<Closed>(block_.state);
 };
 
 } // namespace tcp_stack
@@ -4,42 +4,92 @@
 #include <cassert>
 #include <cstddef>
 
+#include <algorithm>
 #include <deque>
 #include <memory>
 
 #include "safe-log.h"
+#include "send-chunk.h"
+#include "sequence-number.h"
 #include "tcp-header.h"
 
 namespace tcp_stack {
+// Bytes in a deque of chunks, every chunk but the last one is full, so the
+// chunk holding a byte is found by division.
 class Buffer {
 public:
   void PushBack(const char *source, size_t size) {
-    buff_.insert(buff_.end(), source, source+size);
+    size_ += size;
+    while (size) {
+      if (chunks_.empty() || chunks_.back()->Room() == 0)
+        chunks_.push_back(SendChunk::New());
+      const auto n = chunks_.back()->Append(source, size);
+      source += n;
+      size -= n;
+    }
   }
 
   void PopFront(size_t size) {
-    assert(size <= buff_.size());
-    buff_.erase(buff_.begin(), buff_.begin() + size);
+    assert(size <= size_);
+    size_ -= size;
+    front_offset_ += size;
+    while (!chunks_.empty() && front_offset_ >= SendChunk::Capacity()) {
+      chunks_.pop_front();
+      front_offset_ -= SendChunk::Capacity();
+    }
+    if (size_ == 0)
+      Clear();
   }
 
   size_t Size() const {
-    return buff_.size();
+    return size_;
   }
 
   bool Empty() const {
-    return buff_.size() == 0;
+    return size_ == 0;
   }
 
   void Get(char *sink, uint32_t first, uint32_t last) {
-    std::copy(buff_.begin() + first, buff_.begin() + last, sink);
+    ForEachSlice(first, last, [&sink](const SendChunkRef &,
+                                      const char *data, size_t size) {
+          sink = std::copy(data, data + size, sink);
+        });
+  }
+
+  size_t SliceCount(uint32_t first, uint32_t last) const {
+    if (first == last)
+      return 0;
+    return (front_offset_ + last - 1) / SendChunk::Capacity() -
+           (front_offset_ + first) / SendChunk::Capacity() + 1;
+  }
+
+  // Calls fn(const SendChunkRef &, const char *data, size_t size) for each
+  // chunk piece of [first, last)
+  template <class Fn>
+  void ForEachSlice(uint32_t first, uint32_t last, Fn fn) const {
+    size_t position = front_offset_ + first;
+    const size_t end = front_offset_ + last;
+    while (position < end) {
+      const auto &chunk = chunks_[position / SendChunk::Capacity()];
+      const auto offset = position % SendChunk::Capacity();
+      const auto n = std::min(end - position,
+                              SendChunk::Capacity() - offset);
+      fn(chunk, chunk->Data() + offset, n);
+      position += n;
+    }
   }
 
   void Clear() {
-    buff_.clear();
+    chunks_.clear();
+    front_offset_ = 0;
+    size_ = 0;
   }
 
 private:
-  std::deque<char> buff_;
+  std::deque<SendChunkRef> chunks_;
+  // Where the first byte is in chunks_.front()
+  size_t front_offset_ = 0;
+  size_t size_ = 0;
 };
 
 class TcpSendingBuffer {
@@ -49,8 +99,10 @@ public:
   }
 
   void Ack(uint32_t ack) {
-    // TODO: add support to circle ack number.
-    assert(ack >= last_ack_);
+    // A reordered ACK is older than the last one, the distances below are
+    // taken modulo 2^32
+    if (SeqLe(ack, last_ack_))
+      return;
 
     Log("Buffer_ACK", ack, " ", last_ack_, " ", last_get_);
 
@@ -88,15 +140,36 @@ public:
     if (abs_last >= Size())
       abs_last = Size();
 
+    // The payload references the chunks, which stay alive for as long as
+    // the packet does, resends included
     Log("A packet is retreived ");
-    auto tcp_packet = MakeTcpPacket(abs_last - abs_first);
-    Get(tcp_packet->begin(), abs_first, abs_last);
-    tcp_packet->GetHeader().TcpLength() = abs_last - abs_first;
+    auto tcp_packet = MakeSegmentPacket(buff_.SliceCount(abs_first, abs_last));
+    buff_.ForEachSlice(abs_first, abs_last,
+                       [&tcp_packet](const SendChunkRef &chunk,
+                                     const char *data, size_t size) {
+          tcp_packet->AddSlice(chunk, data, size);
+        });
+    tcp_packet->GetHeader().SetTcpLength(abs_last - abs_first);
 
     last_get_ = abs_last;
     return tcp_packet;
   }
 
+  // [first, last) counted from the first unacknowledged byte, for a
+  // resend, what is sent next stays as it was
+  auto GetAsResendPacket(uint32_t first, uint32_t last) {
+    assert(first <= last && last <= Size());
+
+    auto tcp_packet = MakeSegmentPacket(buff_.SliceCount(first, last));
+    buff_.ForEachSlice(first, last,
+                       [&tcp_packet](const SendChunkRef &chunk,
+                                     const char *data, size_t size) {
+          tcp_packet->AddSlice(chunk, data, size);
+        });
+    tcp_packet->GetHeader().SetTcpLength(last - first);
+    return tcp_packet;
+  }
+
   bool Empty() const {
     Log("Emtpy", " ", Size(), " ", last_get_);
     return static_cast<ptrdiff_t>(Size()) == last_get_;
@@ -106,6 +179,16 @@ public:
     return buff_.Size();
   }
 
+  // Where the peer's ACKs are up to
+  uint32_t LastAck() const {
+    return last_ack_;
+  }
+
+  // Bytes not sent yet
+  size_t Unsent() const {
+    return Size() - last_get_;
+  }
+
   void Clear() {
     buff_.Clear();
   }
@@ -3,13 +3,58 @@
 
 #include <arpa/inet.h>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <ostream>
 #include <utility>
-#include <ostream>
+
+#include "checksum.h"
+#include "datagram-buffer.h"
+#include "packet-pool.h"
+#include "send-chunk.h"
 
 namespace tcp_stack {
+template <class T>
+constexpr T ByteSwap(T value) {
+  static_assert(sizeof(T) <= 4);
+  if constexpr (sizeof(T) == 1)
+    return value;
+  else if constexpr (sizeof(T) == 2)
+    return __builtin_bswap16(value);
+  else
+    return __builtin_bswap32(value);
+}
+
+// Converts between host and network order, both ways
+template <class T>
+constexpr T NetworkOrder(T value) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return value;
+#else
+  return ByteSwap(value);
+#endif
+}
+
+// Where a field lives, in bytes from the start of the header
+template <class T, size_t offset>
+struct FieldLayout {
+  using Type = T;
+  static constexpr size_t kOffset = offset;
+};
+
+// A flag bit, mask is as it is on the wire
+template <size_t offset, uint8_t mask>
+struct FlagLayout {
+  static constexpr size_t kOffset = offset;
+  static constexpr uint8_t kMask = mask;
+};
+
+// Bytes kept as they are on the wire, fields are converted to host order
+// only when read and back when written.
 template <size_t size>
 class Field {
 public:
@@ -17,301 +62,572 @@ public:
   
   Field() : field_{0} {}
   
-  uint8_t GetAtBit(size_t pos) const {
-    assert(pos < size*32);
-    return field_[pos/32] & (1u<<pos%32)?1:0;
+  template <class Layout>
+  bool GetFlag() const {
+    CheckLayout<Layout, uint8_t>();
+    return Bytes()[Layout::kOffset] & Layout::kMask;
+  }
+  
+  template <class Layout>
+  void SetFlag(bool value) {
+    CheckLayout<Layout, uint8_t>();
+    auto &byte = Bytes()[Layout::kOffset];
+    byte = value ? byte | Layout::kMask : byte & ~Layout::kMask;
+  }
+  
+  // In host order
+  template <class Layout>
+  typename Layout::Type Get() const {
+    return NetworkOrder(GetRaw<Layout>());
   }
   
-  void SetAtBit(size_t pos, bool value) {
-    assert(pos < size*32);
-    if (value)
-      field_[pos/32] |= (1u<<pos%32);
-    else
-      field_[pos/32] &= ~(1u<<pos%32); 
+  template <class Layout>
+  void Set(typename Layout::Type value) {
+    SetRaw<Layout>(NetworkOrder(value));
   }
   
-  template <class T>
-  T &At(size_t pos) {
-    return const_cast<T &>(
-        static_cast<const Field *>(this)->At<T>(pos));
-  }
-  template <class T>
-  const T &At(size_t pos) const {
-    assert(pos < size*32);
-    assert(pos%8 == 0);
-    assert(pos/8%alignof(T) == 0);
-    
-    return reinterpret_cast<const T &>(
-        reinterpret_cast<const uint8_t *>(field_)[pos/8]);
+  // As it is on the wire
+  template <class Layout>
+  typename Layout::Type GetRaw() const {
+    using T = typename Layout::Type;
+    CheckLayout<Layout, T>();
+    T value;
+    std::memcpy(&value, Bytes() + Layout::kOffset, sizeof(T));
+    return value;
+  }
+  
+  template <class Layout>
+  void SetRaw(typename Layout::Type value) {
+    using T = typename Layout::Type;
+    CheckLayout<Layout, T>();
+    std::memcpy(Bytes() + Layout::kOffset, &value, sizeof(T));
   }
   
 private:
+  template <class Layout, class T>
+  static constexpr void CheckLayout() {
+    static_assert(Layout::kOffset + sizeof(T) <= sizeof(field_));
+    static_assert(Layout::kOffset % alignof(T) == 0);
+  }
+  
+  uint8_t *Bytes() {
+    return reinterpret_cast<uint8_t *>(field_);
+  }
+  
+  const uint8_t *Bytes() const {
+    return reinterpret_cast<const uint8_t *>(field_);
+  }
+  
   uint32_t field_[size];
 };
 
+// The pseudo header comes first, then the TCP header, as they are checksummed
+namespace header_layout {
+using SourceAddress = FieldLayout<uint32_t, 0>;
+using DestinationAddress = FieldLayout<uint32_t, 4>;
+// zero
+using PTCL = FieldLayout<uint8_t, 9>;
+using TcpLength = FieldLayout<uint16_t, 10>;
+
+using SourcePort = FieldLayout<uint16_t, 12>;
+using DestinationPort = FieldLayout<uint16_t, 14>;
+using SequenceNumber = FieldLayout<uint32_t, 16>;
+using AcknowledgementNumber = FieldLayout<uint32_t, 20>;
+// Data Offset in the high nibble, and Reserved
+using DataOffset = FieldLayout<uint8_t, 24>;
+using Urg = FlagLayout<25, 0x20>;
+using Ack = FlagLayout<25, 0x10>;
+using Psh = FlagLayout<25, 0x08>;
+using Rst = FlagLayout<25, 0x04>;
+using Syn = FlagLayout<25, 0x02>;
+using Fin = FlagLayout<25, 0x01>;
+using Flags = FieldLayout<uint8_t, 25>;
+using Window = FieldLayout<uint16_t, 26>;
+using Checksum = FieldLayout<uint16_t, 28>;
+using UrgentPointer = FieldLayout<uint16_t, 30>;
+} // namespace header_layout
+
+// Stored in network order, getters and setters take host order values. The
+// checksum is the exception, it is summed over the wire bytes and so is
+// kept as is.
 class TcpHeader {
 public:
-  uint32_t &SourceAddress() {
-    return const_cast<uint32_t &>(
-        static_cast<const TcpHeader *>(this)->SourceAddress());
+  uint32_t SourceAddress() const {
+    return field_.Get<header_layout::SourceAddress>();
   }
-  const uint32_t &SourceAddress() const {
-    return prefixed_field_.At<uint32_t>(0);
+  void SetSourceAddress(uint32_t value) {
+    field_.Set<header_layout::SourceAddress>(value);
   }
   
-  uint32_t &DestinationAddress() {
-    return const_cast<uint32_t &>(
-        static_cast<const TcpHeader *>(this)->DestinationAddress());
+  uint32_t DestinationAddress() const {
+    return field_.Get<header_layout::DestinationAddress>();
   }
-  const uint32_t &DestinationAddress() const {
-    return prefixed_field_.At<uint32_t>(32);
+  void SetDestinationAddress(uint32_t value) {
+    field_.Set<header_layout::DestinationAddress>(value);
   }
   
-  // zero
-  
-  uint8_t &PTCL() {
-    return const_cast<uint8_t &>(
-        static_cast<const TcpHeader *>(this)->PTCL());
+  uint8_t PTCL() const {
+    return field_.Get<header_layout::PTCL>();
   }
-  const uint8_t &PTCL() const {
-    return prefixed_field_.At<uint8_t>(72);
+  void SetPTCL(uint8_t value) {
+    field_.Set<header_layout::PTCL>(value);
   }
   
-  uint16_t &TcpLength() {
-    return const_cast<uint16_t &>(
-        static_cast<const TcpHeader *>(this)->TcpLength());
+  uint16_t TcpLength() const {
+    return field_.Get<header_layout::TcpLength>();
   }
-  const uint16_t &TcpLength() const {
-    return prefixed_field_.At<uint16_t>(80);
+  void SetTcpLength(uint16_t value) {
+    field_.Set<header_layout::TcpLength>(value);
   }
   
-  uint16_t &SourcePort() {
-    return const_cast<uint16_t &>(
-        static_cast<const TcpHeader *>(this)->SourcePort());
+  uint16_t SourcePort() const {
+    return field_.Get<header_layout::SourcePort>();
   }
-  const uint16_t &SourcePort() const {
-    return field_.At<uint16_t>(0);
+  void SetSourcePort(uint16_t value) {
+    field_.Set<header_layout::SourcePort>(value);
   }
   
-  uint16_t &DestinationPort() {
-    return const_cast<uint16_t &>(
-        static_cast<const TcpHeader *>(this)->DestinationPort());
+  uint16_t DestinationPort() const {
+    return field_.Get<header_layout::DestinationPort>();
   }
-  const uint16_t &DestinationPort() const {
-    return field_.At<uint16_t>(16);
+  void SetDestinationPort(uint16_t value) {
+    field_.Set<header_layout::DestinationPort>(value);
   }
   
-  uint32_t &SequenceNumber() {
-    return const_cast<uint32_t &>(
-        static_cast<const TcpHeader *>(this)->SequenceNumber());
+  uint32_t SequenceNumber() const {
+    return field_.Get<header_layout::SequenceNumber>();
   }
-  const uint32_t &SequenceNumber() const {
-    return field_.At<uint32_t>(32);
+  void SetSequenceNumber(uint32_t value) {
+    field_.Set<header_layout::SequenceNumber>(value);
   }
   
-  uint32_t &AcknowledgementNumber() {
-    return const_cast<uint32_t &>(
-        static_cast<const TcpHeader *>(this)->AcknowledgementNumber());
+  uint32_t AcknowledgementNumber() const {
+    return field_.Get<header_layout::AcknowledgementNumber>();
   }
-  const uint32_t &AcknowledgementNumber() const {
-    return field_.At<uint32_t>(64);
+  void SetAcknowledgementNumber(uint32_t value) {
+    field_.Set<header_layout::AcknowledgementNumber>(value);
   }
   
-  // Data Offset and Reserved
+  // The TCP header length in 32 bit words, options included. Zero, as in a
+  // header nobody set it for, means no options as 5 does.
+  uint8_t DataOffset() const {
+    return field_.Get<header_layout::DataOffset>() >> 4;
+  }
+  void SetDataOffset(uint8_t words) {
+    field_.Set<header_layout::DataOffset>(static_cast<uint8_t>(words << 4));
+  }
+
+  // Bytes of options between the header and the payload
+  size_t OptionsSize() const {
+    const size_t words = DataOffset();
+    return words > 5 ? (words - 5) * 4 : 0;
+  }
   
   bool Urg() const {
-    return field_.GetAtBit(106);
+    return field_.GetFlag<header_layout::Urg>();
   }
   void SetUrg(bool value) {
-    return field_.SetAtBit(106, value);
+    field_.SetFlag<header_layout::Urg>(value);
   }
   
   bool Ack() const {
-    return field_.GetAtBit(107);
+    return field_.GetFlag<header_layout::Ack>();
   }
   void SetAck(bool value) {
-    return field_.SetAtBit(107, value);
+    field_.SetFlag<header_layout::Ack>(value);
   }
   
   bool Psh() const {
-    return field_.GetAtBit(108);
+    return field_.GetFlag<header_layout::Psh>();
   }
   void SetPsh(bool value) {
-    return field_.SetAtBit(108, value);
+    field_.SetFlag<header_layout::Psh>(value);
   }
   
   bool Rst() const {
-    return field_.GetAtBit(109);
+    return field_.GetFlag<header_layout::Rst>();
   }
   void SetRst(bool value) {
-    return field_.SetAtBit(109, value);
+    field_.SetFlag<header_layout::Rst>(value);
   }
   
   bool Syn() const {
-    return field_.GetAtBit(110);
+    return field_.GetFlag<header_layout::Syn>();
   }
   void SetSyn(bool value) {
-    return field_.SetAtBit(110, value);
+    field_.SetFlag<header_layout::Syn>(value);
   }
   
   bool Fin() const {
-    return field_.GetAtBit(111);
+    return field_.GetFlag<header_layout::Fin>();
   }
   void SetFin(bool value) {
-    return field_.SetAtBit(111, value);
+    field_.SetFlag<header_layout::Fin>(value);
   }
   
-  uint16_t &Window() {
-    return const_cast<uint16_t &>(
-        static_cast<const TcpHeader *>(this)->Window());
-  }
-  const uint16_t &Window() const {
-    return field_.At<uint16_t>(112);
+  // All the flag bits at once, as they are on the wire
+  uint8_t Flags() const {
+    return field_.GetRaw<header_layout::Flags>();
   }
   
-  uint16_t &Checksum() {
-    return const_cast<uint16_t &>(
-        static_cast<const TcpHeader *>(this)->Checksum());
+  uint16_t Window() const {
+    return field_.Get<header_layout::Window>();
   }
-  const uint16_t &Checksum() const {
-    return field_.At<uint16_t>(128);
+  void SetWindow(uint16_t value) {
+    field_.Set<header_layout::Window>(value);
   }
   
-  uint16_t &UrgentPointer() {
-    return const_cast<uint16_t &>(
-        static_cast<const TcpHeader *>(this)->UrgentPointer());
+  uint16_t UrgentPointer() const {
+    return field_.Get<header_layout::UrgentPointer>();
   }
-  const uint16_t &UrgentPointer() const {
-    return field_.At<uint16_t>(144);
+  void SetUrgentPointer(uint16_t value) {
+    field_.Set<header_layout::UrgentPointer>(value);
   }
 
-private:
-  Field<3> prefixed_field_;
-  Field<5> field_;
-};
-
-inline void TcpHeaderH2N(TcpHeader &header) {
-  header.SourceAddress() = htonl(header.SourceAddress());
-  header.DestinationAddress() = htonl(header.DestinationAddress());
-  
-  header.TcpLength() = htons(header.TcpLength());
-  header.SourcePort() = htons(header.SourcePort());
-  header.DestinationPort() = htons(header.DestinationPort());
-
-  header.SequenceNumber() = htonl(header.SequenceNumber());
-  header.AcknowledgementNumber() = htonl(header.AcknowledgementNumber());
+  uint16_t Checksum() const {
+    return field_.GetRaw<header_layout::Checksum>();
+  }
+  void SetChecksum(uint16_t checksum) {
+    field_.SetRaw<header_layout::Checksum>(checksum);
+  }
 
-  header.Window() = htons(header.Window());
-  header.UrgentPointer() = htons(header.UrgentPointer());
-}
+  // Sets the ack of a checksummed header and patches the checksum for it
+  // (RFC 1624), instead of summing the packet again
+  void PatchAcknowledgementNumber(uint32_t ack) {
+    using Layout = header_layout::AcknowledgementNumber;
+    const auto raw = NetworkOrder(ack);
+    SetChecksum(UpdateChecksum(Checksum(), field_.GetRaw<Layout>(), raw));
+    field_.SetRaw<Layout>(raw);
+  }
 
-inline void TcpHeaderN2H(TcpHeader &header) {
-  header.SourceAddress() = ntohl(header.SourceAddress());
-  header.DestinationAddress() = ntohl(header.DestinationAddress());
-  
-  header.TcpLength() = ntohs(header.TcpLength());
-  header.SourcePort() = ntohs(header.SourcePort());
-  header.DestinationPort() = ntohs(header.DestinationPort());
+private:
+  Field<8> field_;
+};
 
-  header.SequenceNumber() = ntohl(header.SequenceNumber());
-  header.AcknowledgementNumber() = ntohl(header.AcknowledgementNumber());
+static_assert(sizeof(TcpHeader) == 32);
 
-  header.Window() = ntohs(header.Window());
-  header.UrgentPointer() = ntohs(header.UrgentPointer());
-}
+class PacketPtr;
 
+// A packet either carries its header and payload inline, in the same pool
+// block, or is a slice of a received datagram. An outgoing segment carries
+// only the header inline, followed on the wire by slices of the send buffer.
+// It is reference counted by PacketPtr.
 class TcpPacket {
 public:
-  TcpPacket(TcpPacket &&) = default;
-  TcpPacket &operator=(TcpPacket &&) = default;
+  friend class PacketPtr;
+  friend PacketPtr MakeTcpPacket(size_t size);
+  friend PacketPtr MakeTcpPacket(const char *buff, size_t size);
+  friend PacketPtr MakeSegmentPacket(size_t slices);
+  friend PacketPtr MakeNetPacket(const char *buff, size_t size);
+  friend PacketPtr MakeNetPacket(const DatagramBufferRef &datagram,
+                                 size_t offset, size_t size);
+  friend PacketPtr MakeNetPacket(const TcpPacket &packet);
+
+  TcpPacket(const TcpPacket &) = delete;
+  TcpPacket &operator=(const TcpPacket &) = delete;
 
   auto &GetHeader() {
-    return reinterpret_cast<TcpHeader &>(*buff_.get());
+    copy_summed_ = false;
+    return reinterpret_cast<TcpHeader &>(*data_);
   }
 
   auto &GetHeader() const {
-    return reinterpret_cast<const TcpHeader &>(*buff_.get());
+    return reinterpret_cast<const TcpHeader &>(*data_);
+  }
+
+  // Options sit between the header and the payload
+  char *Options() {
+    copy_summed_ = false;
+    return data_ + sizeof(TcpHeader);
+  }
+
+  const char *Options() const {
+    return data_ + sizeof(TcpHeader);
+  }
+
+  // A data offset past the end of a malformed packet is cut short
+  size_t OptionsSize() const {
+    return std::min(GetHeader().OptionsSize(), size_ - sizeof(TcpHeader));
   }
 
+  // The inline payload, slices are not included
   char *begin() {
-    return buff_.get() + sizeof(TcpHeader);
+    copy_summed_ = false;
+    return data_ + sizeof(TcpHeader) + OptionsSize();
   }
 
   const char *begin() const {
-    return buff_.get() + sizeof(TcpHeader);
+    return data_ + sizeof(TcpHeader) + OptionsSize();
   }
 
   char *end() {
-    return buff_.get() + size_;
+    copy_summed_ = false;
+    return data_ + size_;
   }
 
   const char *end() const {
-    return buff_.get() + size_;
+    return data_ + size_;
   }
 
-  friend uint16_t CalculateChecksum(const TcpPacket &packet) {
-    uint32_t checksum = 0;
-    uint16_t * const buffer = reinterpret_cast<uint16_t *>(packet.buff_.get());
-    const auto size = packet.size_;
-    size_t i = 0;
-    for (; i<size/2; ++i)
-      checksum += buffer[i];
-    if (size%2)
-      checksum += buffer[size-1];
+  // The number of bytes on the wire
+  size_t Size() const {
+    return size_ + sliced_size_;
+  }
 
-    return static_cast<uint16_t>(~checksum);
+  bool Sliced() const {
+    return slice_count_;
   }
 
-  auto GetBuffer() {
-    return std::make_pair(buff_.get(), size_);
+  size_t SpanCount() const {
+    return 1 + slice_count_;
   }
 
-protected:
-  TcpPacket(size_t size)
-      : size_(sizeof(TcpHeader) + size), buff_(new char[size_]) {
-    new(buff_.get()) TcpHeader;
+  // Calls fn(const char *data, size_t size) for the inline part, and then
+  // for each slice, in wire order
+  template <class Fn>
+  void ForEachSpan(Fn fn) const {
+    fn(static_cast<const char *>(data_), size_);
+    for (size_t i=0; i<slice_count_; ++i)
+      fn(slices_[i].data, slices_[i].size);
   }
-  
-  TcpPacket(const char *buff, size_t size)
-      : size_(sizeof(TcpHeader) + size), buff_(new char[size_]) {
-    new(buff_.get()) TcpHeader;
-    std::copy(buff, buff+size, begin());
+
+  // Calls fn(const char *data, size_t size) for the inline payload, and then
+  // for each slice, the payload of a segment handed over without a copy
+  template <class Fn>
+  void ForEachPayloadSpan(Fn fn) const {
+    fn(begin(), static_cast<size_t>(end() - begin()));
+    for (size_t i=0; i<slice_count_; ++i)
+      fn(slices_[i].data, slices_[i].size);
   }
 
-  TcpPacket(const char *first, const char *last)
-      : size_(last-first), buff_(new char[size_]) {
-    std::copy(first, last, buff_.get());
+  // Appends a slice of the send buffer to the payload, at most as many as
+  // MakeSegmentPacket made room for
+  void AddSlice(SendChunkRef chunk, const char *data, size_t size) {
+    assert(slice_count_ < slice_capacity_);
+    new(&slices_[slice_count_++]) PayloadSlice{std::move(chunk), data, size};
+    sliced_size_ += size;
+  }
+
+  friend uint16_t CalculateChecksum(const TcpPacket &packet) {
+    if (packet.copy_summed_)
+      return static_cast<uint16_t>(~packet.copy_sum_);
+
+    // Spans are summed on their own, those starting at an odd offset of the
+    // packet have their sum byte swapped
+    uint16_t sum = 0;
+    size_t position = 0;
+    packet.ForEachSpan([&sum, &position](const char *data, size_t size) {
+          const auto partial = PartialChecksum(data, size);
+          sum = ChecksumAdd(
+              sum, position % 2 ? ChecksumSwap(partial) : partial);
+          position += size;
+        });
+    return static_cast<uint16_t>(~sum);
   }
 
 private:
-  TcpPacket(const TcpPacket &) = delete;
-  TcpPacket &operator=(const TcpPacket &) = delete;
+  // Where the inline data starts in the block
+  static constexpr size_t InlineOffset() {
+    constexpr size_t align = alignof(std::max_align_t);
+    return (sizeof(TcpPacket) + align - 1) / align * align;
+  }
+
+  // A packet with size bytes of inline data, and room for slices
+  static TcpPacket *New(size_t size, size_t slices = 0) {
+    const size_t slices_size = slices * sizeof(PayloadSlice);
+    const size_t block_size = InlineOffset() + slices_size + size;
+    char * const block =
+        static_cast<char *>(PacketPool::Instance().Allocate(block_size));
+    auto packet = new(block) TcpPacket(
+        block_size, block + InlineOffset() + slices_size, size);
+    packet->slices_ =
+        reinterpret_cast<PayloadSlice *>(block + InlineOffset());
+    packet->slice_capacity_ = slices;
+    return packet;
+  }
+
+  // Takes [first, first + size) of a received datagram without copying
+  static TcpPacket *New(DatagramBufferRef datagram, char *first,
+                        size_t size) {
+    void * const block = PacketPool::Instance().Allocate(sizeof(TcpPacket));
+    auto packet = new(block) TcpPacket(sizeof(TcpPacket), first, size);
+    packet->datagram_ = std::move(datagram);
+    return packet;
+  }
+
+  static void Delete(TcpPacket *packet) {
+    const size_t block_size = packet->block_size_;
+    packet->~TcpPacket();
+    PacketPool::Instance().Deallocate(packet, block_size);
+  }
+
+  TcpPacket(size_t block_size, char *data, size_t size)
+      : block_size_(block_size), size_(size), data_(data) {}
 
+  ~TcpPacket() {
+    for (size_t i=0; i<slice_count_; ++i)
+      slices_[i].~PayloadSlice();
+  }
+
+  std::atomic<uint32_t> references_{1};
+  uint32_t block_size_;
   size_t size_;
-  std::unique_ptr<char []> buff_;
+  DatagramBufferRef datagram_;
+  char *data_;
+
+  PayloadSlice *slices_ = nullptr;
+  uint16_t slice_count_ = 0;
+  uint16_t slice_capacity_ = 0;
+  size_t sliced_size_ = 0;
+
+  // The sum of the bytes, taken while they were copied in, until anything
+  // may have changed them
+  uint16_t copy_sum_ = 0;
+  bool copy_summed_ = false;
+};
+
+// Owns one reference to a packet and is only moved along the pipeline, more
+// owners are made explicitly with Share(). The count is touched atomically
+// only while the packet is actually shared, the last owner finds it at 1 with
+// a plain load and frees the packet without a read-modify-write.
+class PacketPtr {
+public:
+  PacketPtr() = default;
+
+  PacketPtr(std::nullptr_t) {}
+
+  PacketPtr(const PacketPtr &) = delete;
+
+  PacketPtr(PacketPtr &&x) noexcept
+      : packet_(std::exchange(x.packet_, nullptr)) {}
+
+  ~PacketPtr() {
+    Reset();
+  }
+
+  PacketPtr &operator=(const PacketPtr &) = delete;
+
+  PacketPtr &operator=(PacketPtr &&x) noexcept {
+    if (this != &x) {
+      Reset();
+      packet_ = std::exchange(x.packet_, nullptr);
+    }
+    return *this;
+  }
+
+  PacketPtr Share() const {
+    packet_->references_.fetch_add(1, std::memory_order_relaxed);
+    return PacketPtr(packet_);
+  }
+
+  // Whether this is the only owner
+  bool Unique() const {
+    return packet_->references_.load(std::memory_order_acquire) == 1;
+  }
+
+  void Reset() {
+    // Nobody else can take a reference from an owner which is alone
+    if (packet_ &&
+        (Unique() || packet_->references_.fetch_sub(
+                         1, std::memory_order_acq_rel) == 1))
+      TcpPacket::Delete(packet_);
+    packet_ = nullptr;
+  }
+
+  TcpPacket *get() const {
+    return packet_;
+  }
+
+  TcpPacket *operator->() const {
+    return packet_;
+  }
+
+  TcpPacket &operator*() const {
+    return *packet_;
+  }
+
+  explicit operator bool() const {
+    return packet_;
+  }
+
+private:
+  friend PacketPtr MakeTcpPacket(size_t size);
+  friend PacketPtr MakeTcpPacket(const char *buff, size_t size);
+  friend PacketPtr MakeSegmentPacket(size_t slices);
+  friend PacketPtr MakeNetPacket(const char *buff, size_t size);
+  friend PacketPtr MakeNetPacket(const DatagramBufferRef &datagram,
+                                 size_t offset, size_t size);
+  friend PacketPtr MakeNetPacket(const TcpPacket &packet);
+
+  // Adopts a reference
+  explicit PacketPtr(TcpPacket *packet) : packet_(packet) {}
+
+  TcpPacket *packet_ = nullptr;
 };
 
 std::ostream &operator<<(std::ostream &o, const TcpHeader &header);
 
-inline std::shared_ptr<TcpPacket> MakeTcpPacket(size_t size) {
-  struct EnableMake : TcpPacket {
-    EnableMake(size_t size) : TcpPacket(size) {}
-  };
-  return std::make_shared<EnableMake>(size);
+inline PacketPtr MakeTcpPacket(size_t size) {
+  PacketPtr packet(TcpPacket::New(sizeof(TcpHeader) + size));
+  new(packet->data_) TcpHeader;
+  return packet;
+}
+
+inline PacketPtr MakeTcpPacket(const char *buff, size_t size) {
+  auto packet = MakeTcpPacket(size);
+  std::copy(buff, buff+size, packet->begin());
+  return packet;
+}
+
+// A packet with no payload, carrying size bytes of options, a multiple of 4
+inline PacketPtr MakeOptionPacket(const char *options, size_t size) {
+  assert(size % 4 == 0 && size <= 40);
+  auto packet = MakeTcpPacket(size);
+  packet->GetHeader().SetDataOffset(static_cast<uint8_t>(5 + size / 4));
+  std::copy(options, options + size, packet->Options());
+  return packet;
+}
+
+// A header only packet, the payload is added with AddSlice
+inline PacketPtr MakeSegmentPacket(size_t slices) {
+  PacketPtr packet(TcpPacket::New(sizeof(TcpHeader), slices));
+  new(packet->data_) TcpHeader;
+  return packet;
+}
+
+// Checksummed while copied, verifying it costs nothing then
+inline PacketPtr MakeNetPacket(const char *buff, size_t size) {
+  PacketPtr packet(TcpPacket::New(size));
+  packet->copy_sum_ = CopyWithChecksum(packet->data_, buff, size);
+  packet->copy_summed_ = true;
+  return packet;
 }
 
-inline std::shared_ptr<TcpPacket> MakeTcpPacket(const char *buff, size_t size) {
-  struct EnableMake : TcpPacket {
-    EnableMake(const char *buff, size_t size) : TcpPacket(buff, size) {}
-  };
-  return std::make_shared<EnableMake>(buff, size);
+// The packet shares the datagram, falls back to a copy when the slice is not
+// aligned for TcpHeader.
+inline PacketPtr MakeNetPacket(
+    const DatagramBufferRef &datagram, size_t offset, size_t size) {
+  char * const first = datagram->Data() + offset;
+  if (offset % alignof(TcpHeader))
+    return MakeNetPacket(first, size);
+  return PacketPtr(TcpPacket::New(datagram, first, size));
 }
 
-inline std::shared_ptr<TcpPacket> MakeNetPacket(const char *buff, size_t size) {
-  struct EnableMake : TcpPacket {
-    EnableMake(const char *first, const char *last) : TcpPacket(first, last) {}
-  };
-  return std::make_shared<EnableMake>(buff, buff + size);
+// A contiguous copy of the packet as it would be on the wire
+inline PacketPtr MakeNetPacket(const TcpPacket &packet) {
+  PacketPtr copy(TcpPacket::New(packet.Size()));
+  uint16_t sum = 0;
+  size_t position = 0;
+  packet.ForEachSpan([&copy, &sum, &position](const char *data, size_t size) {
+        const auto partial = CopyWithChecksum(copy->data_ + position, data,
+                                              size);
+        sum = ChecksumAdd(
+            sum, position % 2 ? ChecksumSwap(partial) : partial);
+        position += size;
+      });
+  copy->copy_sum_ = sum;
+  copy->copy_summed_ = true;
+  return copy;
 }
 
 } // namespace tcp_stack
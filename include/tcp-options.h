@@ -0,0 +1,145 @@
+#ifndef _TCP_STACK_TCP_OPTIONS_H_
+#define _TCP_STACK_TCP_OPTIONS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+
+#include "reassembly-queue.h"
+#include "tcp-header.h"
+
+namespace tcp_stack {
+namespace tcp_option {
+constexpr uint8_t kEnd = 0;
+constexpr uint8_t kNop = 1;
+constexpr uint8_t kWindowScale = 3; // RFC 7323
+constexpr uint8_t kSackPermitted = 4; // RFC 2018
+constexpr uint8_t kSack = 5;
+} // namespace tcp_option
+
+// Options of one header, each padded to 32 bits with leading NOPs
+class TcpOptions {
+public:
+  static constexpr size_t kCapacity = 40;
+  // As many SACK blocks as fit next to the padding
+  static constexpr size_t kMaxSackBlocks = 4;
+
+  void AddSackPermitted() {
+    Byte(tcp_option::kNop);
+    Byte(tcp_option::kNop);
+    Byte(tcp_option::kSackPermitted);
+    Byte(2);
+  }
+
+  void AddWindowScale(uint8_t shift) {
+    Byte(tcp_option::kNop);
+    Byte(tcp_option::kWindowScale);
+    Byte(3);
+    Byte(shift);
+  }
+
+  // The first kMaxSackBlocks ranges, lowest first
+  void AddSack(const SequenceRanges &ranges) {
+    const size_t n = std::min(ranges.Size(), kMaxSackBlocks);
+    if (n == 0)
+      return;
+    Byte(tcp_option::kNop);
+    Byte(tcp_option::kNop);
+    Byte(tcp_option::kSack);
+    Byte(2 + 8 * n);
+    for (size_t i=0; i<n; ++i) {
+      Word(ranges.begin()[i].begin);
+      Word(ranges.begin()[i].end);
+    }
+  }
+
+  const char *Data() const {
+    return data_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  bool Empty() const {
+    return size_ == 0;
+  }
+
+private:
+  void Byte(uint8_t value) {
+    data_[size_++] = static_cast<char>(value);
+  }
+
+  void Word(uint32_t value) {
+    value = NetworkOrder(value);
+    std::memcpy(data_ + size_, &value, sizeof(value));
+    size_ += sizeof(value);
+  }
+
+  char data_[kCapacity];
+  size_t size_ = 0;
+};
+
+// Calls fn(uint8_t kind, const char *value, size_t length) for each option.
+// Stops at the end of the list, or at an option running past size.
+template <class Fn>
+void ForEachOption(const char *data, size_t size, Fn fn) {
+  size_t i = 0;
+  while (i < size) {
+    const auto kind = static_cast<uint8_t>(data[i]);
+    if (kind == tcp_option::kEnd)
+      return;
+    if (kind == tcp_option::kNop) {
+      ++i;
+      continue;
+    }
+    if (i + 2 > size)
+      return;
+    const auto length = static_cast<uint8_t>(data[i + 1]);
+    if (length < 2 || i + length > size)
+      return;
+    fn(kind, data + i + 2, static_cast<size_t>(length - 2));
+    i += length;
+  }
+}
+
+inline bool HasSackPermitted(const TcpPacket &packet) {
+  bool permitted = false;
+  ForEachOption(packet.Options(), packet.OptionsSize(),
+                [&permitted](uint8_t kind, const char *, size_t) {
+        permitted |= kind == tcp_option::kSackPermitted;
+      });
+  return permitted;
+}
+
+// The shift the peer offered, at most 14, or -1 without the option
+inline int WindowScaleOf(const TcpPacket &packet) {
+  int shift = -1;
+  ForEachOption(packet.Options(), packet.OptionsSize(),
+                [&shift](uint8_t kind, const char *value, size_t length) {
+        if (kind == tcp_option::kWindowScale && length == 1)
+          shift = std::min<int>(static_cast<uint8_t>(*value), 14);
+      });
+  return shift;
+}
+
+// Calls fn(uint32_t begin, uint32_t end) for each SACK block
+template <class Fn>
+void ForEachSackBlock(const TcpPacket &packet, Fn fn) {
+  ForEachOption(packet.Options(), packet.OptionsSize(),
+                [&fn](uint8_t kind, const char *value, size_t length) {
+        if (kind != tcp_option::kSack)
+          return;
+        for (; length >= 8; value += 8, length -= 8) {
+          uint32_t edges[2];
+          std::memcpy(edges, value, sizeof(edges));
+          fn(NetworkOrder(edges[0]), NetworkOrder(edges[1]));
+        }
+      });
+}
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_TCP_OPTIONS_H_
@@ -30,6 +30,19 @@ public:
     }
   } catch(...) {}
 
+  SocketOptions GetOptions() const {
+    if (!internal_)
+      throw std::runtime_error("Invalid Socket");
+    return internal_->GetOptions();
+  }
+
+  // Before Listen or Connect, no_delay and delayed_ack apply at once
+  void SetOptions(const SocketOptions &options) {
+    if (!internal_)
+      throw std::runtime_error("Invalid Socket");
+    internal_->SetOptions(options);
+  }
+
   void Listen(uint16_t port) {
     if (!internal_)
       throw std::runtime_error("Invalid Socket");
@@ -55,12 +68,41 @@ public:
     internal_->SocketSend(first, size);
   }
   
+  // Holds back segments shorter than a full one, so that several Sends
+  // go out together
+  void Cork() {
+    if (!internal_)
+      throw std::runtime_error("Invalid Socket");
+    internal_->SocketCork(true);
+  }
+
+  // Sends what Cork held back
+  void Uncork() {
+    if (!internal_)
+      throw std::runtime_error("Invalid Socket");
+    internal_->SocketCork(false);
+  }
+
   size_t Recv(char *first, size_t size) {
     if (!internal_)
       throw std::runtime_error("Invalid Socket");
     return internal_->SocketRecv(first, size);
   }
 
+  // Bytes Recv would return without blocking
+  size_t Available() const {
+    if (!internal_)
+      throw std::runtime_error("Invalid Socket");
+    return internal_->SocketAvailable();
+  }
+
+  // The round trip estimates and retransmission timeout of the connection
+  RttStatistics GetRttStatistics() const {
+    if (!internal_)
+      throw std::runtime_error("Invalid Socket");
+    return internal_->SocketRttStatistics();
+  }
+
   void Close() {
     if (!internal_)
       throw std::runtime_error("Invalid Socket");
@@ -0,0 +1,247 @@
+#ifndef _TCP_STACK_TRANSPORT_H_
+#define _TCP_STACK_TRANSPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "tcp-header.h"
+
+namespace tcp_stack {
+constexpr size_t kMaxBatchSize = 64;
+
+// Snapshot of the batch size counters, histogram[n] is the number of
+// batches which carried n items: datagrams per recvmmsg/sendmmsg, or
+// segments per GSO/GRO datagram. The last bucket also counts the larger
+// batches reaped from io_uring.
+struct BatchStatistics {
+  uint64_t batches = 0;
+  uint64_t datagrams = 0;
+  std::array<uint64_t, kMaxBatchSize + 1> histogram{};
+};
+
+class BatchCounter {
+public:
+  void Record(size_t n) {
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    datagrams_.fetch_add(n, std::memory_order_relaxed);
+    histogram_[std::min(n, kMaxBatchSize)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  BatchStatistics Get() const {
+    BatchStatistics statistics;
+    statistics.batches = batches_.load(std::memory_order_relaxed);
+    statistics.datagrams = datagrams_.load(std::memory_order_relaxed);
+    for (size_t i=0; i<histogram_.size(); ++i)
+      statistics.histogram[i] = histogram_[i].load(std::memory_order_relaxed);
+    return statistics;
+  }
+
+private:
+  std::atomic<uint64_t> batches_{0};
+  std::atomic<uint64_t> datagrams_{0};
+  std::array<std::atomic<uint64_t>, kMaxBatchSize + 1> histogram_{};
+};
+
+// How the receive loops split their waits between spinning and sleeping.
+// spins counts the receives served while spinning, sleeps the ones which
+// fell back to blocking, spin_nanoseconds the time burnt spinning.
+struct BusyPollStatistics {
+  uint64_t spins = 0;
+  uint64_t sleeps = 0;
+  uint64_t spin_nanoseconds = 0;
+};
+
+class BusyPollCounter {
+public:
+  void Record(bool spun, std::chrono::nanoseconds spin_time) {
+    (spun ? spins_ : sleeps_).fetch_add(1, std::memory_order_relaxed);
+    spin_nanoseconds_.fetch_add(spin_time.count(), std::memory_order_relaxed);
+  }
+
+  BusyPollStatistics Get() const {
+    BusyPollStatistics statistics;
+    statistics.spins = spins_.load(std::memory_order_relaxed);
+    statistics.sleeps = sleeps_.load(std::memory_order_relaxed);
+    statistics.spin_nanoseconds =
+        spin_nanoseconds_.load(std::memory_order_relaxed);
+    return statistics;
+  }
+
+private:
+  std::atomic<uint64_t> spins_{0};
+  std::atomic<uint64_t> sleeps_{0};
+  std::atomic<uint64_t> spin_nanoseconds_{0};
+};
+
+// Spin budget of one receive loop. It follows the recent arrival rate: twice
+// the moving average of the gap between batches, so a loop spins while the
+// next batch is likely to show up soon, and stops spinning once traffic is
+// sparser than max_budget. Every spin that ends in a sleep halves the budget
+// further, down to 1/64, so a loop which keeps losing the race, e.g. against
+// a sender on the same CPU, burns next to nothing. A spin that pays off
+// restores it, and so does traffic, each arrival sooner than max_budget after
+// the last one doubles it back. Not thread safe.
+class AdaptiveSpin {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit AdaptiveSpin(std::chrono::nanoseconds max_budget)
+      : max_budget_(max_budget), average_gap_(max_budget / 2) {}
+
+  bool Enabled() const {
+    return max_budget_.count() > 0;
+  }
+
+  std::chrono::nanoseconds Budget() const {
+    return std::min(max_budget_, 2 * average_gap_) / (1 << miss_shift_);
+  }
+
+  void Arrived(Clock::time_point now) {
+    if (last_arrival_ != Clock::time_point()) {
+      const auto gap = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now - last_arrival_);
+      average_gap_ += (gap - average_gap_) / 8;
+      if (gap < max_budget_ && miss_shift_ > 0)
+        --miss_shift_;
+    }
+    last_arrival_ = now;
+  }
+
+  // Calls receive until it returns true or the budget runs out, returns
+  // whether it did. A receive which succeeds at once is not counted, there
+  // was nothing to wait for. Yields between the attempts, so that a sender on
+  // the same CPU gets to send what the loop waits for.
+  template <class Fn>
+  bool Spin(Fn receive, BusyPollCounter &counter) {
+    if (receive())
+      return true;
+
+    const auto budget = Budget();
+    const auto start = Clock::now();
+    const auto deadline = start + budget;
+    auto now = start;
+    bool received = false;
+    while (!received && now < deadline) {
+      std::this_thread::yield();
+      received = receive();
+      now = Clock::now();
+    }
+    counter.Record(received, now - start);
+
+    if (received)
+      miss_shift_ = 0;
+    else if (miss_shift_ < kMaxMissShift)
+      ++miss_shift_;
+    return received;
+  }
+
+private:
+  static constexpr int kMaxMissShift = 6;
+
+  const std::chrono::nanoseconds max_budget_;
+  std::chrono::nanoseconds average_gap_;
+  Clock::time_point last_arrival_;
+  int miss_shift_ = 0;
+};
+
+enum class IoBackend {
+  kPoll = 0,
+  kIoUring // falls back to kPoll when io_uring is not available
+};
+
+class LoopbackNetwork;
+
+struct NetworkServiceOptions {
+  IoBackend backend = IoBackend::kPoll;
+
+  // Max number of datagrams per recvmmsg/sendmmsg
+  size_t batch_size = 32;
+
+  // Coalesce runs of equal-sized datagrams into one UDP_SEGMENT send
+  bool gso = true;
+  // Receive coalesced datagrams (UDP_GRO) and split them, poll backend only
+  bool gro = true;
+
+  // Number of SO_REUSEPORT sockets, each one is drained by its own thread.
+  // The kernel spreads peers across them by hashing the address tuple, so a
+  // single connection always lands on the same thread.
+  size_t receive_threads = 1;
+
+  // Spin on non-blocking receives for up to this long before blocking, the
+  // actual budget adapts to the arrival rate. 0 always blocks. Applies to the
+  // poll backend and the loopback transport.
+  std::chrono::microseconds busy_poll{0};
+
+  // Back the packet pool with huge pages, for the whole process
+  bool huge_pages = false;
+
+  // Exchanges packets with the services attached to the same network inside
+  // this process instead of over UDP, only batch_size and busy_poll apply
+  // then.
+  std::shared_ptr<LoopbackNetwork> loopback;
+};
+
+using PacketBatch = std::vector<PacketPtr>;
+
+// Moves packets between a NetworkService and its peer. Receive is called in
+// a loop by each of the ReceiveThreads() threads, Send by whichever thread
+// flushes the egress queue, one at a time.
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  virtual size_t ReceiveThreads() const {
+    return 1;
+  }
+
+  // Called on receive thread index before its first Receive
+  virtual void Open(size_t index) = 0;
+  virtual void Close(size_t index) = 0;
+
+  // Waits up to timeout for packets and appends them to packets.
+  virtual void Receive(size_t index, std::chrono::milliseconds timeout,
+                       PacketBatch &packets) = 0;
+
+  // Sends every packet to the peer, the packets may be moved from.
+  virtual void Send(PacketBatch &packets) = 0;
+
+  BatchStatistics GetReceiveStatistics() const {
+    return receive_counter_.Get();
+  }
+
+  BatchStatistics GetSendStatistics() const {
+    return send_counter_.Get();
+  }
+
+  BatchStatistics GetGsoStatistics() const {
+    return gso_counter_.Get();
+  }
+
+  BatchStatistics GetGroStatistics() const {
+    return gro_counter_.Get();
+  }
+
+  BusyPollStatistics GetBusyPollStatistics() const {
+    return busy_poll_counter_.Get();
+  }
+
+protected:
+  BatchCounter receive_counter_;
+  BatchCounter send_counter_;
+  BatchCounter gso_counter_;
+  BatchCounter gro_counter_;
+  BusyPollCounter busy_poll_counter_;
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_TRANSPORT_H_
@@ -0,0 +1,144 @@
+#ifndef _TCP_STACK_UDP_TRANSPORT_H_
+#define _TCP_STACK_UDP_TRANSPORT_H_
+
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "datagram-buffer.h"
+#include "io-uring.h"
+#include "transport.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace tcp_stack {
+constexpr size_t kMaxDatagramSize = DatagramBuffer::kSize;
+
+// Limits of one UDP_SEGMENT datagram
+constexpr size_t kMaxGsoSegments = 64;
+constexpr size_t kMaxGsoBytes = 65507;
+
+// UIO_MAXIOV, the iovecs one sendmsg takes
+constexpr size_t kMaxMessageIovecs = 1024;
+
+// Datagrams over the kernel, received with recvmmsg or a multishot io_uring
+// recv on one or more SO_REUSEPORT sockets, sent with sendmmsg or io_uring.
+class UdpTransport : public Transport {
+public:
+  UdpTransport(const sockaddr_in &host_addr, const sockaddr_in &peer_addr,
+               const NetworkServiceOptions &options);
+
+  UdpTransport(const UdpTransport &) = delete;
+
+  ~UdpTransport() override;
+
+  UdpTransport &operator=(const UdpTransport &) = delete;
+
+  // The backend in use, which differs from Options::backend after a fallback
+  IoBackend GetBackend() const {
+    return options_.backend;
+  }
+
+  // The socket of receive thread index once it is open, the first one also
+  // sends
+  int GetSocket(size_t index) const {
+    return receivers_[index]->socket;
+  }
+
+  size_t ReceiveThreads() const override {
+    return receivers_.size();
+  }
+
+  void Open(size_t index) override;
+  void Close(size_t index) override;
+
+  void Receive(size_t index, std::chrono::milliseconds timeout,
+               PacketBatch &packets) override;
+
+  void Send(PacketBatch &packets) override;
+
+private:
+  // State of one receive thread and its socket
+  struct Receiver {
+    explicit Receiver(std::chrono::microseconds busy_poll)
+        : spin(busy_poll) {}
+
+    int socket = -1;
+    bool gro = false;
+    AdaptiveSpin spin;
+
+    // Datagrams are received straight into pooled buffers which the packets
+    // then share, a slot only takes a new buffer when a packet kept the old
+    // one
+    std::vector<DatagramBufferRef> buffers;
+    std::vector<iovec> iovecs;
+    std::vector<std::array<char, CMSG_SPACE(sizeof(int))>> controls;
+    std::vector<mmsghdr> messages;
+
+#ifdef TCP_STACK_HAS_IO_URING
+    std::unique_ptr<IoUring> ring;
+    bool recv_armed = false;
+#endif
+  };
+
+  void ReceivePoll(Receiver &receiver, std::chrono::milliseconds timeout,
+                   PacketBatch &packets);
+
+  // Non-blocking recvmmsg into the receiver's buffers
+  int ReceiveMessages(Receiver &receiver);
+
+  // Messages for one sendmmsg, or one batch of io_uring sendmsg. ends[i] is
+  // the index past the last packet message i carries.
+  struct EgressMessages {
+    std::array<mmsghdr, kMaxBatchSize> headers;
+    std::array<size_t, kMaxBatchSize> ends;
+    std::array<std::array<char, CMSG_SPACE(sizeof(uint16_t))>,
+               kMaxBatchSize> controls;
+    std::array<iovec, kMaxBatchSize * kMaxGsoSegments> iovecs;
+    size_t size = 0;
+  };
+
+  // Fills egress_messages_ from packets[first, last), a run of equal sized
+  // datagrams, optionally ended by a shorter one, becomes one GSO message.
+  // Each packet takes one iovec per span. Returns the index past the last
+  // packet taken.
+  size_t PrepareEgressMessages(const PacketBatch &packets, size_t first,
+                               size_t last);
+
+#ifdef TCP_STACK_HAS_IO_URING
+  void ReceiveIoUring(Receiver &receiver, std::chrono::milliseconds timeout,
+                      PacketBatch &packets);
+  void SendIoUring(const PacketBatch &packets, size_t first, size_t last);
+#endif
+
+  sockaddr_in host_addr_;
+  sockaddr_in peer_addr_;
+
+  NetworkServiceOptions options_;
+
+  // receivers_[0]->socket is also used for sending
+  std::vector<std::unique_ptr<Receiver>> receivers_;
+
+  // Only touched by Send
+  std::unique_ptr<EgressMessages> egress_messages_{new EgressMessages};
+  bool gso_enabled_ = false;
+
+#ifdef TCP_STACK_HAS_IO_URING
+  std::unique_ptr<IoUring> send_ring_;
+#endif
+};
+
+} // namespace tcp_stack
+
+#endif // _TCP_STACK_UDP_TRANSPORT_H_
@@ -0,0 +1,201 @@
+#include "checksum.h"
+
+#include <cstring>
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TCP_STACK_CHECKSUM_X86
+#endif
+
+namespace tcp_stack {
+namespace {
+// The kernels add the data as 32 bit words into 64 bit accumulators, which
+// cannot overflow for any packet, and fold once at the end. 2^16 is 1 modulo
+// 0xffff, so this is the same as adding 16 bit words with end around carry.
+uint16_t Fold(uint64_t sum) {
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(sum);
+}
+
+template <bool copy>
+uint64_t SumTail(const unsigned char *source, unsigned char *dest,
+                 size_t size, uint64_t sum) {
+  if (copy)
+    std::memcpy(dest, source, size);
+  for (; size >= 4; source += 4, size -= 4) {
+    uint32_t word;
+    std::memcpy(&word, source, sizeof(word));
+    sum += word;
+  }
+  if (size >= 2) {
+    uint16_t word;
+    std::memcpy(&word, source, sizeof(word));
+    sum += word;
+    source += 2;
+    size -= 2;
+  }
+  if (size) {
+    // Padded with a zero byte, whichever end of the word it lands at
+    uint16_t word = 0;
+    std::memcpy(&word, source, 1);
+    sum += word;
+  }
+  return sum;
+}
+
+template <bool copy>
+uint64_t SumScalar(const unsigned char *source, unsigned char *dest,
+                   size_t size, uint64_t sum) {
+  for (; size >= 8; source += 8, dest += copy ? 8 : 0, size -= 8) {
+    uint32_t words[2];
+    std::memcpy(words, source, sizeof(words));
+    if (copy)
+      std::memcpy(dest, words, sizeof(words));
+    sum += words[0];
+    sum += words[1];
+  }
+  return SumTail<copy>(source, dest, size, sum);
+}
+
+#ifdef TCP_STACK_CHECKSUM_X86
+__attribute__((target("sse2")))
+inline __m128i Widen(__m128i acc, __m128i v) {
+  const __m128i zero = _mm_setzero_si128();
+  acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+  return _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+}
+
+template <bool copy>
+__attribute__((target("sse2")))
+uint64_t SumSse2(const unsigned char *source, unsigned char *dest,
+                 size_t size, uint64_t sum) {
+  __m128i acc0 = _mm_setzero_si128();
+  __m128i acc1 = _mm_setzero_si128();
+  for (; size >= 32; source += 32, dest += copy ? 32 : 0, size -= 32) {
+    const auto v0 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(source));
+    const auto v1 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(source + 16));
+    if (copy) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dest), v0);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 16), v1);
+    }
+    acc0 = Widen(acc0, v0);
+    acc1 = Widen(acc1, v1);
+  }
+
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes),
+                   _mm_add_epi64(acc0, acc1));
+  return SumScalar<copy>(source, dest, size, sum + lanes[0] + lanes[1]);
+}
+
+__attribute__((target("avx2")))
+inline __m256i Widen(__m256i acc, __m256i v) {
+  // Lanes are mixed up within each half, which does not matter for a sum
+  const __m256i zero = _mm256_setzero_si256();
+  acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+  return _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+}
+
+template <bool copy>
+__attribute__((target("avx2")))
+uint64_t SumAvx2(const unsigned char *source, unsigned char *dest,
+                 size_t size, uint64_t sum) {
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  for (; size >= 64; source += 64, dest += copy ? 64 : 0, size -= 64) {
+    const auto v0 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(source));
+    const auto v1 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(source + 32));
+    if (copy) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest), v0);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + 32), v1);
+    }
+    acc0 = Widen(acc0, v0);
+    acc1 = Widen(acc1, v1);
+  }
+
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes),
+                      _mm256_add_epi64(acc0, acc1));
+  // Leaves the wide registers before the tail runs with SSE
+  _mm256_zeroupper();
+  return SumSse2<copy>(source, dest, size,
+                       sum + lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+#endif // TCP_STACK_CHECKSUM_X86
+
+struct Kernel {
+  ChecksumKernel kernel;
+  uint64_t (*sum)(const unsigned char *, unsigned char *, size_t, uint64_t);
+  uint64_t (*copy)(const unsigned char *, unsigned char *, size_t, uint64_t);
+};
+
+constexpr Kernel kKernels[] = {
+  {ChecksumKernel::kScalar, SumScalar<false>, SumScalar<true>},
+#ifdef TCP_STACK_CHECKSUM_X86
+  {ChecksumKernel::kSse2, SumSse2<false>, SumSse2<true>},
+  {ChecksumKernel::kAvx2, SumAvx2<false>, SumAvx2<true>},
+#endif
+};
+
+bool Supported(ChecksumKernel kernel) {
+  switch (kernel) {
+    case ChecksumKernel::kScalar:
+      return true;
+#ifdef TCP_STACK_CHECKSUM_X86
+    case ChecksumKernel::kSse2:
+      return __builtin_cpu_supports("sse2");
+    case ChecksumKernel::kAvx2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+// Constant initialized, so checksums taken by other static initializers get
+// the scalar kernel until the best one is picked
+std::atomic<const Kernel *> current_kernel{&kKernels[0]};
+
+const bool kernel_picked = []() {
+  for (auto &kernel : kKernels)
+    if (Supported(kernel.kernel))
+      current_kernel.store(&kernel, std::memory_order_relaxed);
+  return true;
+}();
+
+} // anonymous namespace
+
+ChecksumKernel GetChecksumKernel() {
+  return current_kernel.load(std::memory_order_relaxed)->kernel;
+}
+
+bool SetChecksumKernel(ChecksumKernel kernel) {
+  if (!Supported(kernel))
+    return false;
+  for (auto &entry : kKernels)
+    if (entry.kernel == kernel)
+      current_kernel.store(&entry, std::memory_order_relaxed);
+  return true;
+}
+
+uint16_t PartialChecksum(const void *data, size_t size, uint16_t sum) {
+  auto kernel = current_kernel.load(std::memory_order_relaxed);
+  return Fold(kernel->sum(static_cast<const unsigned char *>(data), nullptr,
+                          size, sum));
+}
+
+uint16_t CopyWithChecksum(void *dest, const void *source, size_t size,
+                          uint16_t sum) {
+  auto kernel = current_kernel.load(std::memory_order_relaxed);
+  return Fold(kernel->copy(static_cast<const unsigned char *>(source),
+                           static_cast<unsigned char *>(dest), size, sum));
+}
+
+} // namespace tcp_stack
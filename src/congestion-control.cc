@@ -0,0 +1,281 @@
+#include "congestion-control.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace tcp_stack {
+namespace {
+// RFC 9438 4.1 and 4.6
+constexpr double kCubicC = 0.4;
+constexpr double kCubicBeta = 0.7;
+
+// 2 / ln 2, doubles the delivery rate every round
+constexpr double kHighGain = 2.885;
+constexpr double kCwndGain = 2;
+constexpr std::array<double, 8> kProbeGains = {
+    1.25, 0.75, 1, 1, 1, 1, 1, 1};
+constexpr uint32_t kBbrMinWindow = 4;
+constexpr auto kMinRttExpiry = std::chrono::seconds(10);
+constexpr auto kProbeRttTime = std::chrono::milliseconds(200);
+
+// Only a window which was used grows (RFC 7661)
+bool WindowLimited(uint32_t in_flight, uint32_t window) {
+  return 2 * static_cast<uint64_t>(in_flight) >= window;
+}
+
+double Seconds(CongestionControl::Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+} // anonymous namespace
+
+NewReno::NewReno(uint32_t segment_size)
+    : segment_size_(segment_size),
+      cwnd_(kInitialCongestionWindow * segment_size) {}
+
+void NewReno::OnAck(uint32_t acked, uint32_t in_flight, Clock::duration,
+                    Clock::time_point) {
+  if (!WindowLimited(in_flight, cwnd_))
+    return;
+
+  // RFC 3465, at most two segments per ACK
+  if (cwnd_ < ssthresh_) {
+    cwnd_ = std::min(cwnd_ + std::min(acked, 2 * segment_size_),
+                     kMaxCongestionWindow);
+    return;
+  }
+
+  bytes_acked_ += acked;
+  if (bytes_acked_ >= cwnd_) {
+    bytes_acked_ -= cwnd_;
+    cwnd_ = std::min(cwnd_ + segment_size_, kMaxCongestionWindow);
+  }
+}
+
+// RFC 5681 (4)
+void NewReno::OnLoss(uint32_t in_flight, Clock::time_point) {
+  ssthresh_ = std::max(in_flight / 2, 2 * segment_size_);
+  cwnd_ = ssthresh_;
+  bytes_acked_ = 0;
+}
+
+void NewReno::OnTimeout(uint32_t in_flight) {
+  ssthresh_ = std::max(in_flight / 2, 2 * segment_size_);
+  cwnd_ = segment_size_;
+  bytes_acked_ = 0;
+}
+
+Cubic::Cubic(uint32_t segment_size)
+    : segment_size_(segment_size),
+      window_(kInitialCongestionWindow),
+      ssthresh_(static_cast<double>(kMaxCongestionWindow) / segment_size) {}
+
+// The epoch does not count the time the connection sat idle
+void Cubic::OnSend(uint32_t bytes, uint32_t in_flight,
+                   Clock::time_point now) {
+  if (in_flight != bytes || epoch_start_ == Clock::time_point())
+    return;
+  epoch_start_ = std::min(epoch_start_ + (now - last_ack_), now);
+}
+
+void Cubic::OnAck(uint32_t acked, uint32_t in_flight, Clock::duration rtt,
+                  Clock::time_point now) {
+  last_ack_ = now;
+  if (rtt.count() > 0)
+    min_rtt_ = std::min(min_rtt_, rtt);
+  if (!WindowLimited(in_flight, Window()))
+    return;
+
+  const double segments = static_cast<double>(acked) / segment_size_;
+  const double max_window =
+      static_cast<double>(kMaxCongestionWindow) / segment_size_;
+  if (window_ < ssthresh_) {
+    window_ = std::min(window_ + std::min(segments, 2.0), max_window);
+    return;
+  }
+
+  if (epoch_start_ == Clock::time_point()) {
+    epoch_start_ = now;
+    if (window_ < w_max_) {
+      k_ = std::cbrt((w_max_ - window_) / kCubicC);
+    } else {
+      k_ = 0;
+      w_max_ = window_;
+    }
+    w_est_ = window_;
+  }
+
+  // Where the cubic is a round trip from now
+  const double t = Seconds(now - epoch_start_) +
+      (min_rtt_ == Clock::duration::max() ? 0 : Seconds(min_rtt_));
+  const double cubic = kCubicC * std::pow(t - k_, 3) + w_max_;
+  const double target = std::clamp(cubic, window_, 1.5 * window_);
+
+  w_est_ += 3 * (1 - kCubicBeta) / (1 + kCubicBeta) * segments / window_;
+  if (w_est_ > cubic)
+    window_ = std::max(window_, w_est_);
+  else
+    window_ += (target - window_) / window_ * segments;
+  window_ = std::min(window_, max_window);
+}
+
+void Cubic::OnLoss(uint32_t, Clock::time_point) {
+  Reduce();
+  window_ = ssthresh_;
+}
+
+void Cubic::OnTimeout(uint32_t) {
+  Reduce();
+  window_ = 1;
+}
+
+void Cubic::Reduce() {
+  epoch_start_ = Clock::time_point();
+  // Fast convergence, a flow losing below its last maximum leaves room
+  w_max_ = window_ < w_max_ ? window_ * (1 + kCubicBeta) / 2 : window_;
+  ssthresh_ = std::max(window_ * kCubicBeta, 2.0);
+}
+
+Bbr::Bbr(uint32_t segment_size)
+    : segment_size_(segment_size),
+      cwnd_(kInitialCongestionWindow * segment_size) {}
+
+uint32_t Bbr::Window() const {
+  const uint32_t window = std::max(cwnd_, kBbrMinWindow * segment_size_);
+  if (mode_ == Mode::kProbeRtt)
+    return std::min(window, kBbrMinWindow * segment_size_);
+  return window;
+}
+
+// Rates are not taken over the time the connection sat idle
+void Bbr::OnSend(uint32_t bytes, uint32_t in_flight, Clock::time_point now) {
+  if (in_flight != bytes)
+    return;
+  round_start_ = now;
+  round_start_delivered_ = delivered_;
+}
+
+void Bbr::OnAck(uint32_t acked, uint32_t in_flight, Clock::duration rtt,
+                Clock::time_point now) {
+  delivered_ += acked;
+  const uint32_t remaining = in_flight - std::min(acked, in_flight);
+
+  const bool expired = now - min_rtt_stamp_ > kMinRttExpiry;
+  if (rtt.count() > 0 && (rtt <= min_rtt_ || expired)) {
+    min_rtt_ = rtt;
+    min_rtt_stamp_ = now;
+  }
+  if (expired && mode_ != Mode::kProbeRtt &&
+      min_rtt_ != Clock::duration::max()) {
+    mode_ = Mode::kProbeRtt;
+    probe_rtt_done_ = now + kProbeRttTime;
+  }
+
+  if (delivered_ >= round_end_delivered_) {
+    EndRound(now);
+    round_end_delivered_ = delivered_ + remaining;
+  }
+
+  switch (mode_) {
+  case Mode::kStartup:
+    break;
+  case Mode::kDrain:
+    if (remaining <= Target(1)) {
+      mode_ = Mode::kProbeBandwidth;
+      cycle_index_ = 0;
+    }
+    break;
+  case Mode::kProbeBandwidth:
+    break;
+  case Mode::kProbeRtt:
+    if (now >= probe_rtt_done_) {
+      min_rtt_stamp_ = now;
+      mode_ = full_pipe_ ? Mode::kProbeBandwidth : Mode::kStartup;
+    }
+    break;
+  }
+
+  const auto target = Target(Gain());
+  if (full_pipe_)
+    cwnd_ = std::min<uint64_t>(static_cast<uint64_t>(cwnd_) + acked, target);
+  else if (cwnd_ < target || target == 0)
+    cwnd_ = std::min(cwnd_ + acked, kMaxCongestionWindow);
+  cwnd_ = std::max(cwnd_, kBbrMinWindow * segment_size_);
+}
+
+// The model holds, losses only stop the window growing past what was in
+// flight
+void Bbr::OnLoss(uint32_t in_flight, Clock::time_point) {
+  cwnd_ = std::max(std::min(cwnd_, in_flight), kBbrMinWindow * segment_size_);
+}
+
+void Bbr::OnTimeout(uint32_t) {
+  cwnd_ = kBbrMinWindow * segment_size_;
+}
+
+double Bbr::Bandwidth() const {
+  return *std::max_element(bandwidth_.begin(), bandwidth_.end());
+}
+
+// Takes the round's delivery rate, which replaces the one kBandwidthRounds
+// rounds ago, and moves the mode on
+void Bbr::EndRound(Clock::time_point now) {
+  double rate = 0;
+  if (round_start_ != Clock::time_point() && now > round_start_)
+    rate = (delivered_ - round_start_delivered_) / Seconds(now - round_start_);
+  bandwidth_[round_ % kBandwidthRounds] = rate;
+  ++round_;
+  round_start_ = now;
+  round_start_delivered_ = delivered_;
+
+  if (mode_ == Mode::kStartup) {
+    const double bandwidth = Bandwidth();
+    if (bandwidth >= full_bandwidth_ * 1.25) {
+      full_bandwidth_ = bandwidth;
+      full_bandwidth_rounds_ = 0;
+    } else if (++full_bandwidth_rounds_ >= 3) {
+      full_pipe_ = true;
+      mode_ = Mode::kDrain;
+    }
+  } else if (mode_ == Mode::kProbeBandwidth) {
+    cycle_index_ = (cycle_index_ + 1) % kProbeGains.size();
+  }
+}
+
+uint32_t Bbr::Target(double gain) const {
+  const double bandwidth = Bandwidth();
+  if (bandwidth == 0 || min_rtt_ == Clock::duration::max())
+    return 0;
+  const double bdp = bandwidth * Seconds(min_rtt_);
+  return static_cast<uint32_t>(std::clamp(
+      gain * bdp, static_cast<double>(kBbrMinWindow * segment_size_),
+      static_cast<double>(kMaxCongestionWindow)));
+}
+
+double Bbr::Gain() const {
+  switch (mode_) {
+  case Mode::kStartup:
+    return kHighGain;
+  case Mode::kProbeBandwidth:
+    return kCwndGain * kProbeGains[cycle_index_];
+  default:
+    return 1;
+  }
+}
+
+std::unique_ptr<CongestionControl> MakeCongestionControl(
+    CongestionAlgorithm algorithm, uint32_t segment_size) {
+  switch (algorithm) {
+  case CongestionAlgorithm::kNewReno:
+    return std::make_unique<NewReno>(segment_size);
+  case CongestionAlgorithm::kCubic:
+    return std::make_unique<Cubic>(segment_size);
+  case CongestionAlgorithm::kBbr:
+    return std::make_unique<Bbr>(segment_size);
+  }
+  throw std::runtime_error("Unknown congestion algorithm");
+}
+
+} // namespace tcp_stack
@@ -0,0 +1,37 @@
+#include "datagram-buffer.h"
+
+namespace tcp_stack {
+DatagramBufferPool &DatagramBufferPool::Instance() {
+  static auto pool = new DatagramBufferPool(256);
+  return *pool;
+}
+
+DatagramBufferPool::~DatagramBufferPool() {
+  for (auto buffer : free_buffers_)
+    delete buffer;
+}
+
+DatagramBufferRef DatagramBufferPool::Acquire() {
+  {
+    std::lock_guard guard(mtx_);
+    if (!free_buffers_.empty()) {
+      auto buffer = free_buffers_.back();
+      free_buffers_.pop_back();
+      return DatagramBufferRef(buffer);
+    }
+  }
+  return DatagramBufferRef(new DatagramBuffer(this));
+}
+
+void DatagramBufferPool::Release(DatagramBuffer *buffer) {
+  {
+    std::lock_guard guard(mtx_);
+    if (free_buffers_.size() < max_free_buffers_) {
+      free_buffers_.push_back(buffer);
+      return;
+    }
+  }
+  delete buffer;
+}
+
+} // namespace tcp_stack
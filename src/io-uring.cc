@@ -0,0 +1,208 @@
+#include "io-uring.h"
+
+#ifdef TCP_STACK_HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace tcp_stack {
+namespace {
+int IoUringSetup(unsigned entries, io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags, const void *arg, size_t arg_size) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 arg, arg_size);
+}
+
+int IoUringRegister(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template <class T>
+T *Offset(void *base, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+} // anonymous namespace
+
+IoUring::IoUring(unsigned entries) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd_ = IoUringSetup(entries, &params);
+  if (ring_fd_ < 0)
+    throw std::runtime_error("io_uring_setup failed");
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_EXT_ARG)) {
+    close(ring_fd_);
+    throw std::runtime_error("io_uring is too old");
+  }
+
+  // With IORING_FEAT_SINGLE_MMAP both rings share one mapping
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    close(ring_fd_);
+    throw std::runtime_error("io_uring ring mmap failed");
+  }
+  cq_ring_ = sq_ring_;
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe *>(
+      mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+    close(ring_fd_);
+    throw std::runtime_error("io_uring sqes mmap failed");
+  }
+
+  sq_head_ = Offset<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = Offset<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_ring_mask_ = Offset<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_ring_entries_ = Offset<unsigned>(sq_ring_, params.sq_off.ring_entries);
+  sq_array_ = Offset<unsigned>(sq_ring_, params.sq_off.array);
+  sqe_tail_ = sqe_submitted_ = *sq_tail_;
+
+  cq_head_ = Offset<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = Offset<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_ring_mask_ = Offset<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = Offset<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+  if (buffer_ring_)
+    munmap(buffer_ring_, buffer_ring_size_);
+  munmap(sqes_, sqes_size_);
+  munmap(sq_ring_, sq_ring_size_);
+  close(ring_fd_);
+}
+
+io_uring_sqe *IoUring::GetSqe() {
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= *sq_ring_entries_)
+    return nullptr;
+
+  const unsigned index = sqe_tail_++ & *sq_ring_mask_;
+  sq_array_[index] = index;
+  auto sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(io_uring_sqe));
+  return sqe;
+}
+
+void IoUring::PrepareMultishotRecv(int fd, uint16_t buffer_group,
+                                   uint64_t user_data) {
+  auto sqe = GetSqe();
+  if (!sqe)
+    throw std::runtime_error("io_uring submission queue is full");
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buffer_group;
+  sqe->user_data = user_data;
+}
+
+void IoUring::PrepareSendMsg(int fd, const msghdr *message,
+                             uint64_t user_data) {
+  auto sqe = GetSqe();
+  if (!sqe)
+    throw std::runtime_error("io_uring submission queue is full");
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(message);
+  sqe->len = 1;
+  sqe->user_data = user_data;
+}
+
+int IoUring::Submit(unsigned wait_nr, const timespec *timeout) {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  const unsigned to_submit = sqe_tail_ - sqe_submitted_;
+
+  unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  __kernel_timespec ts;
+  if (timeout) {
+    ts.tv_sec = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_nsec;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  const int ret = IoUringEnter(ring_fd_, to_submit, wait_nr, flags,
+                               timeout ? &arg : nullptr,
+                               timeout ? sizeof(arg) : 0);
+  if (ret < 0)
+    return -errno;
+  sqe_submitted_ += ret;
+  return ret;
+}
+
+// The kernel only reads the tail on io_uring_enter, it can be moved back
+void IoUring::DropUnsubmitted() {
+  sqe_tail_ = sqe_submitted_;
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+}
+
+void IoUring::RegisterBufferRing(uint16_t group, uint16_t count,
+                                 size_t size) {
+  // ring entries must be a power of 2
+  if (count == 0 || (count & (count - 1)))
+    throw std::runtime_error("buffer ring size must be a power of 2");
+
+  buffer_ring_size_ = count * sizeof(io_uring_buf);
+  void *ring = mmap(nullptr, buffer_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED)
+    throw std::runtime_error("buffer ring mmap failed");
+  std::memset(ring, 0, buffer_ring_size_);
+  buffer_ring_ = static_cast<io_uring_buf_ring *>(ring);
+  buffer_ring_mask_ = count - 1;
+  buffer_size_ = size;
+  buffers_.reset(new char[count * size]);
+
+  io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (IoUringRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+    munmap(buffer_ring_, buffer_ring_size_);
+    buffer_ring_ = nullptr;
+    throw std::runtime_error("IORING_REGISTER_PBUF_RING failed");
+  }
+
+  for (uint16_t id=0; id<count; ++id)
+    RecycleBuffer(id);
+}
+
+void IoUring::RecycleBuffer(uint16_t id) {
+  // Not buffer_ring_->bufs, the flex array is declared after an empty struct
+  // which takes up space in C++ but not in C.
+  const uint16_t tail = buffer_ring_->tail;
+  auto &buf = reinterpret_cast<io_uring_buf *>(
+      buffer_ring_)[tail & buffer_ring_mask_];
+  buf.addr = reinterpret_cast<uint64_t>(GetBuffer(id));
+  buf.len = buffer_size_;
+  buf.bid = id;
+  __atomic_store_n(&buffer_ring_->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+} // namespace tcp_stack
+
+#endif // TCP_STACK_HAS_IO_URING
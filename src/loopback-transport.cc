@@ -0,0 +1,171 @@
+#include "loopback-transport.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdint>
+
+#include <stdexcept>
+
+#include "safe-log.h"
+
+namespace tcp_stack {
+namespace {
+size_t RoundUpToPowerOf2(size_t n) {
+  size_t power = 1;
+  while (power < n)
+    power <<= 1;
+  return power;
+}
+
+} // anonymous namespace
+
+LoopbackChannel::LoopbackChannel(size_t capacity)
+    : mask_(RoundUpToPowerOf2(std::max<size_t>(capacity, 2)) - 1),
+      cells_(new Cell[mask_ + 1]) {
+  for (size_t i=0; i<=mask_; ++i)
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0)
+    throw std::runtime_error("eventfd failed");
+}
+
+LoopbackChannel::~LoopbackChannel() {
+  close(event_fd_);
+}
+
+// A cell is free for position p when its sequence is p, and holds the packet
+// pushed at p when its sequence is p + 1.
+bool LoopbackChannel::Push(PacketPtr &packet) {
+  auto position = enqueue_position_.load(std::memory_order_relaxed);
+  Cell *cell;
+  for (;;) {
+    cell = &cells_[position & mask_];
+    const auto sequence = cell->sequence.load(std::memory_order_acquire);
+    const auto diff = static_cast<intptr_t>(sequence) -
+                      static_cast<intptr_t>(position);
+    if (diff == 0) {
+      if (enqueue_position_.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      position = enqueue_position_.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->packet = std::move(packet);
+  cell->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+size_t LoopbackChannel::Pop(PacketBatch &packets, size_t max) {
+  size_t n = 0;
+  for (; n < max; ++n) {
+    auto &cell = cells_[dequeue_position_ & mask_];
+    if (cell.sequence.load(std::memory_order_acquire) !=
+        dequeue_position_ + 1)
+      break;
+    packets.push_back(std::move(cell.packet));
+    cell.sequence.store(dequeue_position_ + mask_ + 1,
+                        std::memory_order_release);
+    ++dequeue_position_;
+  }
+  return n;
+}
+
+bool LoopbackChannel::Empty() const {
+  return cells_[dequeue_position_ & mask_].sequence.load(
+      std::memory_order_acquire) != dequeue_position_ + 1;
+}
+
+void LoopbackChannel::Notify() {
+  // Pairs with the fence in Wait, either the consumer sees the packet or we
+  // see it waiting
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed)) {
+    const uint64_t one = 1;
+    if (write(event_fd_, &one, sizeof(one)) < 0)
+      Log("eventfd write error");
+  }
+}
+
+void LoopbackChannel::Wait(std::chrono::milliseconds timeout) {
+  waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (Empty()) {
+    pollfd fdarray[1] = {{event_fd_, POLLIN, 0}};
+    poll(fdarray, 1, timeout.count());
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+
+  uint64_t count;
+  while (read(event_fd_, &count, sizeof(count)) > 0)
+    ;
+}
+
+std::shared_ptr<LoopbackChannel> LoopbackNetwork::GetChannel(
+    const sockaddr_in &address) {
+  const uint64_t key = static_cast<uint64_t>(address.sin_addr.s_addr) << 16 |
+                       address.sin_port;
+  std::lock_guard guard(mtx_);
+  auto &channel = channels_[key];
+  if (!channel)
+    channel = std::make_shared<LoopbackChannel>(channel_capacity_);
+  return channel;
+}
+
+LoopbackTransport::LoopbackTransport(LoopbackNetwork &network,
+                                     const sockaddr_in &host_addr,
+                                     const sockaddr_in &peer_addr,
+                                     size_t batch_size,
+                                     std::chrono::microseconds busy_poll)
+    : network_(network), batch_size_(batch_size), spin_(busy_poll),
+      host_channel_(network.GetChannel(host_addr)),
+      peer_channel_(network.GetChannel(peer_addr)) {
+  if (host_channel_->bound.exchange(true))
+    throw std::runtime_error("loopback address in use");
+}
+
+LoopbackTransport::~LoopbackTransport() {
+  host_channel_->bound.store(false);
+}
+
+void LoopbackTransport::Receive(size_t, std::chrono::milliseconds timeout,
+                                PacketBatch &packets) {
+  auto n = host_channel_->Pop(packets, batch_size_);
+  if (n == 0 && spin_.Enabled())
+    spin_.Spin([&]() {
+          return (n = host_channel_->Pop(packets, batch_size_)) > 0;
+        }, busy_poll_counter_);
+  if (n == 0) {
+    host_channel_->Wait(timeout);
+    n = host_channel_->Pop(packets, batch_size_);
+  }
+  if (n == 0)
+    return;
+
+  receive_counter_.Record(n);
+  if (spin_.Enabled())
+    spin_.Arrived(AdaptiveSpin::Clock::now());
+}
+
+void LoopbackTransport::Send(PacketBatch &packets) {
+  size_t dropped = 0;
+  for (auto &packet : packets) {
+    // Like a full socket buffer, the resend covers the loss
+    if (network_.Lose() || !peer_channel_->Push(packet))
+      ++dropped;
+  }
+  peer_channel_->Notify();
+
+  send_counter_.Record(packets.size());
+  if (dropped) {
+    Log("Loopback channel full, dropped ", dropped);
+    network_.AddDropped(dropped);
+  }
+}
+
+} // namespace tcp_stack
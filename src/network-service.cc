@@ -27,38 +27,39 @@ void LittleUdpSender(uint16_t port) {
          (sockaddr *)&peer_addr, sizeof(sockaddr_in));
 }
 
-void NetworkService::Run(std::promise<void> running) {
-  Log(__func__);
-  host_socket_ = socket(AF_INET, SOCK_DGRAM, 0);
-  if (host_socket_ < 0)
-    throw std::runtime_error("socket errer");
-  if (bind(host_socket_, (sockaddr *)&host_addr_, sizeof(sockaddr_in)))
-    throw std::runtime_error("bind error");
+void NetworkService::SetupTransport() {
+  if (options_.loopback) {
+    transport_ = std::make_unique<LoopbackTransport>(
+        *options_.loopback, host_addr_, peer_addr_, options_.batch_size,
+        options_.busy_poll);
+    return;
+  }
+
+  auto transport = std::make_unique<UdpTransport>(host_addr_, peer_addr_,
+                                                  options_);
+  options_.backend = transport->GetBackend();
+  transport_ = std::move(transport);
+}
+
+void NetworkService::Run(std::promise<void> running, size_t index) {
+  Log(__func__, index);
+  transport_->Open(index);
   running.set_value();
-  
-  std::unique_ptr<char[]> buff(new char[102400]);
 
-  for(;;) {
-    pollfd fdarray[1] = {{host_socket_, POLLIN, 0}};
-    auto ret = poll(fdarray, 1, 1000);
+  PacketBatch packets;
+  while (!terminate_flag_.load()) {
+    transport_->Receive(index, std::chrono::seconds(1), packets);
+    if (packets.empty())
+      continue;
 
-    if (ret < 0) {
-      ;
-    } else if (ret == 1) {
-      Log("Packet receiving");
-      auto n = recvfrom(host_socket_, buff.get(), 102400, 0,
-                        nullptr, nullptr);
-      if (n <= 0) {
-        Log("Recvfrom error");
-      } else {
-        Log("Packet received");
-        auto packet = MakeNetPacket(buff.get(), n);
-        socket_manager_.ReceivePacket(packet);
-      }
-    } else {
-      ;
-    }
+    // Replies triggered by the whole batch leave together
+    EgressBatch egress_batch(this);
+    for (auto &packet : packets)
+      socket_manager_.ReceivePacket(std::move(packet));
+    packets.clear();
   }
+
+  transport_->Close(index);
 }
 
 } // namespace tcp_simulator
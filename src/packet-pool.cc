@@ -0,0 +1,196 @@
+#include "packet-pool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+namespace tcp_stack {
+namespace {
+void Bump(std::atomic<uint64_t> &counter) {
+  // Only the owning thread writes, no need for a locked add
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+}
+
+// Set once the cache of this thread is destroyed, packets freed later on by
+// other thread_local or static objects bypass it
+thread_local bool thread_cache_destroyed = false;
+
+} // anonymous namespace
+
+struct PacketPool::ThreadCache {
+  ThreadCache() {
+    for (size_t i=0; i<kClasses; ++i)
+      blocks[i].reserve(CacheCapacity(i) + 1);
+
+    auto &pool = PacketPool::Instance();
+    std::lock_guard guard(pool.caches_mtx_);
+    pool.caches_.push_back(this);
+  }
+
+  ~ThreadCache() {
+    auto &pool = PacketPool::Instance();
+    for (size_t i=0; i<kClasses; ++i)
+      pool.Drain(i, blocks[i].size(), blocks[i]);
+
+    std::lock_guard guard(pool.caches_mtx_);
+    pool.caches_.erase(
+        std::find(pool.caches_.begin(), pool.caches_.end(), this));
+    pool.retired_hits_ += hits.load(std::memory_order_relaxed);
+    pool.retired_misses_ += misses.load(std::memory_order_relaxed);
+    thread_cache_destroyed = true;
+  }
+
+  std::array<std::vector<void *>, kClasses> blocks;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+};
+
+PacketPool &PacketPool::Instance() {
+  static auto pool = new PacketPool;
+  return *pool;
+}
+
+size_t PacketPool::CacheCapacity(size_t index) {
+  constexpr size_t kCacheBytes = 256 << 10;
+  return std::clamp<size_t>(kCacheBytes / BlockSize(index), 8, 128);
+}
+
+PacketPool::ThreadCache *PacketPool::GetThreadCache() {
+  if (thread_cache_destroyed)
+    return nullptr;
+  thread_local ThreadCache cache;
+  return &cache;
+}
+
+void *PacketPool::Allocate(size_t size) {
+  if (size > kMaxBlockSize) {
+    uncached_misses_.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size);
+  }
+
+  const auto index = ClassIndex(size);
+  auto cache = GetThreadCache();
+  if (!cache) {
+    std::vector<void *> blocks;
+    const bool fresh = Refill(index, 1, blocks);
+    (fresh ? uncached_misses_ : uncached_hits_).fetch_add(
+        1, std::memory_order_relaxed);
+    return blocks.back();
+  }
+
+  auto &blocks = cache->blocks[index];
+  if (blocks.empty() && Refill(index, CacheCapacity(index) / 2, blocks))
+    Bump(cache->misses);
+  else
+    Bump(cache->hits);
+
+  auto block = blocks.back();
+  blocks.pop_back();
+  return block;
+}
+
+void PacketPool::Deallocate(void *block, size_t size) {
+  if (size > kMaxBlockSize)
+    return ::operator delete(block);
+
+  const auto index = ClassIndex(size);
+  auto cache = GetThreadCache();
+  if (!cache) {
+    std::vector<void *> blocks{block};
+    return Drain(index, 1, blocks);
+  }
+
+  auto &blocks = cache->blocks[index];
+  blocks.push_back(block);
+  if (blocks.size() > CacheCapacity(index))
+    Drain(index, blocks.size() / 2, blocks);
+}
+
+bool PacketPool::Refill(size_t index, size_t n, std::vector<void *> &blocks) {
+  auto &size_class = classes_[index];
+  std::lock_guard guard(size_class.mtx);
+
+  auto &free_blocks = size_class.free_blocks;
+  if (!free_blocks.empty()) {
+    const auto taken = std::min(n, free_blocks.size());
+    blocks.insert(blocks.end(), free_blocks.end() - taken, free_blocks.end());
+    free_blocks.resize(free_blocks.size() - taken);
+    return false;
+  }
+
+  const auto block_size = BlockSize(index);
+  for (size_t i=0; i<n; ++i) {
+    if (size_class.slab_left < block_size) {
+      size_class.slab = NewSlab();
+      size_class.slab_left = kSlabSize;
+    }
+    blocks.push_back(size_class.slab);
+    size_class.slab += block_size;
+    size_class.slab_left -= block_size;
+  }
+  return true;
+}
+
+void PacketPool::Drain(size_t index, size_t n, std::vector<void *> &blocks) {
+  auto &size_class = classes_[index];
+  std::lock_guard guard(size_class.mtx);
+  size_class.free_blocks.insert(size_class.free_blocks.end(),
+                                blocks.end() - n, blocks.end());
+  blocks.resize(blocks.size() - n);
+}
+
+char *PacketPool::NewSlab() {
+  constexpr int kProtection = PROT_READ | PROT_WRITE;
+  constexpr int kFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  if (huge_pages_.load(std::memory_order_relaxed)) {
+    void *slab = mmap(nullptr, kSlabSize, kProtection, kFlags | MAP_HUGETLB,
+                      -1, 0);
+    if (slab != MAP_FAILED) {
+      slabs_.fetch_add(1, std::memory_order_relaxed);
+      huge_page_slabs_.fetch_add(1, std::memory_order_relaxed);
+      return static_cast<char *>(slab);
+    }
+
+    // No reserved huge pages, ask for transparent ones on an aligned slab
+    void *area = mmap(nullptr, 2 * kSlabSize, kProtection, kFlags, -1, 0);
+    if (area == MAP_FAILED)
+      throw std::bad_alloc();
+    const auto address = reinterpret_cast<uintptr_t>(area);
+    const auto aligned = (address + kSlabSize - 1) & ~(kSlabSize - 1);
+    if (aligned != address)
+      munmap(area, aligned - address);
+    munmap(reinterpret_cast<void *>(aligned + kSlabSize),
+           address + kSlabSize - aligned);
+    madvise(reinterpret_cast<void *>(aligned), kSlabSize, MADV_HUGEPAGE);
+    slabs_.fetch_add(1, std::memory_order_relaxed);
+    return reinterpret_cast<char *>(aligned);
+  }
+
+  void *slab = mmap(nullptr, kSlabSize, kProtection, kFlags, -1, 0);
+  if (slab == MAP_FAILED)
+    throw std::bad_alloc();
+  slabs_.fetch_add(1, std::memory_order_relaxed);
+  return static_cast<char *>(slab);
+}
+
+PacketPoolStatistics PacketPool::GetStatistics() {
+  PacketPoolStatistics statistics;
+  statistics.hits = uncached_hits_.load(std::memory_order_relaxed);
+  statistics.misses = uncached_misses_.load(std::memory_order_relaxed);
+  statistics.slabs = slabs_.load(std::memory_order_relaxed);
+  statistics.huge_page_slabs =
+      huge_page_slabs_.load(std::memory_order_relaxed);
+
+  std::lock_guard guard(caches_mtx_);
+  statistics.hits += retired_hits_;
+  statistics.misses += retired_misses_;
+  for (auto cache : caches_) {
+    statistics.hits += cache->hits.load(std::memory_order_relaxed);
+    statistics.misses += cache->misses.load(std::memory_order_relaxed);
+  }
+  return statistics;
+}
+
+} // namespace tcp_stack
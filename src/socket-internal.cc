@@ -4,10 +4,16 @@
 
 namespace tcp_stack {
 void SocketInternal::SendSyn(uint32_t seq, uint16_t window) {
-  auto packet = MakeTcpPacket(0);
+  TcpOptions options;
+  if (options_.selective_ack)
+    options.AddSackPermitted();
+  if (options_.window_scale)
+    options.AddWindowScale(state_.GetControlBlock().snd_wscale);
+  auto packet = MakeOptionPacket(options.Data(), options.Size());
   SynHeader(seq, window, &packet->GetHeader());
 
   send_buffer_.InitializeAckNumber(seq + 1);
+  recover_ = seq;
 
   peer_ip_ = next_peer_ip_;
   peer_port_ = next_peer_port_;
@@ -32,23 +38,39 @@ std::shared_ptr<SocketInternal> SocketInternal::SocketAccept() {
   return manager_->InternalGetNewConnection(this, GetIdentifier());
 }
 
-void SocketInternal::SendPacket(std::shared_ptr<TcpPacket> packet) {
+void SocketInternal::SendPacket(PacketPtr packet) {
   SetSource(host_ip_, host_port_, &packet->GetHeader());
   SetDestination(peer_ip_, peer_port_, &packet->GetHeader());
 
-  TcpHeaderH2N(packet->GetHeader());
-
   manager_->InternalSendPacket(std::move(packet));
 }
 
-void SocketInternal::SendPacketWithResend(std::shared_ptr<TcpPacket> packet) {
+void SocketInternal::SendPacketWithResend(PacketPtr packet) {
   SetSource(host_ip_, host_port_, &packet->GetHeader());
   SetDestination(peer_ip_, peer_port_, &packet->GetHeader());
 
-  TcpHeaderH2N(packet->GetHeader());
-
   manager_->InternalSendPacketWithResend(
-      std::move(packet), ResendPredicate(weak_from_this()));
+      std::move(packet), ResendPredicate(weak_from_this(), rtt_.Rto()));
+}
+
+void SocketInternal::ArmDelayedAckTimer() {
+  manager_->InternalPushTimer([internal = weak_from_this()]() {
+        auto shared_self = internal.lock();
+        if (!shared_self)
+          return false;
+        std::lock_guard guard(*shared_self);
+        return shared_self->DelayedAckTimeout();
+      }, options_.delayed_ack);
+}
+
+void SocketInternal::ArmPersistTimer() {
+  manager_->InternalPushTimer([internal = weak_from_this()]() {
+        auto shared_self = internal.lock();
+        if (!shared_self)
+          return false;
+        std::lock_guard guard(*shared_self);
+        return shared_self->PersistTimeout(guard);
+      }, std::chrono::milliseconds(200));
 }
 
 void SocketInternal::Listen() {
@@ -58,7 +80,7 @@ void SocketInternal::Listen() {
 
 void SocketInternal::NewConnection() {
   Log("New Connection");
-  manager_->InternalNewConnection(this, current_packet_.lock());
+  manager_->InternalNewConnection(this, current_packet_->Share(), options_);
 }
 
 void SocketInternal::SocketDestroyed() {
@@ -73,8 +95,36 @@ void SocketInternal::TimeWait() {
   manager_->InternalTimeWait(shared_from_this(), GetIdentifier());
 }
 
+void SocketInternal::Flush(const std::lock_guard<SocketInternal> &guard,
+                           bool push) {
+  while (IsAnyPacketForSending(guard, push)) {
+    auto [packet, pred] = GetPacketForSending(guard);
+    manager_->InternalSendPacketWithResend(std::move(packet), pred);
+  }
+  if (!persist_timer_armed_ && WaitsForWindow()) {
+    persist_timer_armed_ = true;
+    ArmPersistTimer();
+  }
+}
+
 void SocketInternal::SocketSend(const char *first, size_t size) {
-  send_buffer_.Push(first,size);
+  while (true) {
+    {
+      // The chunks are shared with the packets in flight
+      std::lock_guard guard(*this);
+      const auto n = std::min(size, SendRoom());
+      send_buffer_.Push(first, n);
+      Flush(guard);
+      first += n;
+      size -= n;
+      if (size == 0)
+        break;
+    }
+
+    // Until ACKs make room
+    auto lck = SelfUniqueLock();
+    wait_until_writable_.wait(lck, [this]() { return SendRoom() > 0; });
+  }
 
   manager_->InternalHasPacketForSending(shared_from_this());
 }
@@ -3,12 +3,34 @@
 #include "network-service.h"
 
 namespace tcp_stack {
-void SocketManager::SendPacket(std::shared_ptr<TcpPacket> packet) {
+void SocketManager::SendPacket(PacketPtr packet) {
   Log("New Packet");
 
-  packet->GetHeader().Checksum() = 0;
-  packet->GetHeader().Checksum() = CalculateChecksum(*packet);
+  packet->GetHeader().SetChecksum(0);
+  packet->GetHeader().SetChecksum(CalculateChecksum(*packet));
   network_service_->SendPacket(std::move(packet));
 }
 
+void SocketManager::ResendPacket(PacketPtr packet) {
+  Log("Resend Packet");
+  network_service_->SendPacket(std::move(packet));
+}
+
+void SocketManager::SendPacketsForSending() {
+  decltype(sockets_wait_for_sending_) sockets;
+  {
+    std::lock_guard guard(*this);
+    sockets.swap(sockets_wait_for_sending_);
+  }
+
+  NetworkService::EgressBatch egress_batch(network_service_);
+  for (auto &internal : sockets) {
+    std::lock_guard guard(*internal);
+    while (internal->IsAnyPacketForSending(guard)) {
+      auto [packet, pred] = internal->GetPacketForSending(guard);
+      InternalSendPacketWithResend(std::move(packet), pred);
+    }
+  }
+}
+
 } // namespace tcp_stack
\ No newline at end of file
@@ -1,373 +1,455 @@
 #include "state.h"
 
+#include <array>
 #include <iostream>
 #include <random>
 
 namespace tcp_stack {
 namespace {
-inline bool IsAck(const TcpHeader &header) {
-  return header.Ack() && !header.Syn() && !header.Fin();
+using TriggerType = TcpState::TriggerType;
+using EventHandler = TriggerType (*)(TcpHeader *, TcpControlBlock &);
+using PacketHandler = TriggerType (*)(const TcpHeader &, TcpControlBlock &);
+
+inline uint32_t RandomSynNumber() {
+  thread_local static std::mt19937 e(std::random_device{}());
+  thread_local static std::uniform_int_distribution<uint32_t> d(10, 10000);
+
+  return d(e);
 }
 
-inline bool IsSyn(const TcpHeader &header) {
-  return header.Syn() && !header.Ack() && !header.Fin();
+// Any state
+
+TriggerType InvalidOperation(TcpHeader *, TcpControlBlock &b) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();},
+          b.state};
 }
 
-inline bool IsSynAck(const TcpHeader &header) {
-  return header.Syn() && header.Ack() && !header.Fin();
+TriggerType Discard(const TcpHeader &, TcpControlBlock &b) {
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, b.state};
 }
 
-inline bool IsFin(const TcpHeader &header) {
-  return header.Fin() && header.Ack() && !header.Syn();
+// RFC 793 3.9, a segment which is not acceptable, an old duplicate, one
+// past the window or a window probe, is acked with where the window is
+TriggerType Unacceptable(TcpControlBlock &b) {
+  return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = WindowField(b)](
+          SocketInternalInterface *tcp) {
+        tcp->Discard();
+        tcp->SendAck(seq, ack, wnd);
+      }, b.state};
 }
 
-inline uint32_t RandomSynNumber() {
-  thread_local static std::mt19937 e(std::random_device{}());
-  thread_local static std::uniform_int_distribution<uint32_t> d(10, 10000);
+// Closed
 
-  return d(e);
+TriggerType ClosedListen(TcpHeader *, TcpControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {
+        tcp->Listen();
+      }, State::kListen};
 }
 
-} // anonymous namespace
-
-Closed::TriggerType Closed::operator()(
-    Event event, TcpHeader *, TcpControlBlock &b) {
-  if (event == Event::kListen) {
-    return {[](SocketInternalInterface *tcp) {
-          tcp->Listen();
-        }, &b.state.emplace<Listen>()};
-  } else if (event == Event::kConnect) {
-    b.snd_seq = RandomSynNumber();
-    b.snd_una = b.snd_seq;
-    b.snd_nxt = b.snd_seq + 1;
-    b.snd_wnd = 1024;
-    return {[seq = b.snd_seq, wnd = b.snd_wnd](SocketInternalInterface *tcp) {
-          tcp->SendSyn(seq, wnd);
-        }, &b.state.emplace<SynSent>()};
-  } else if (event == Event::kClose) {
-    return {[](SocketInternalInterface *tcp) {tcp->Close();}, this};
-  }
+TriggerType ClosedConnect(TcpHeader *, TcpControlBlock &b) {
+  b.snd_seq = RandomSynNumber();
+  b.snd_una = b.snd_seq;
+  b.snd_nxt = b.snd_seq + 1;
+  return {[seq = b.snd_seq, wnd = SynWindowField(b)](
+          SocketInternalInterface *tcp) {
+        tcp->SendSyn(seq, wnd);
+      }, State::kSynSent};
+}
 
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+TriggerType ClosedClose(TcpHeader *, TcpControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->Close();}, State::kClosed};
 }
 
-Closed::TriggerType Closed::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsSyn(header)) {
-    b.snd_seq = RandomSynNumber();
-    b.snd_una = b.snd_seq;
-    b.snd_nxt = b.snd_seq + 1;
-    b.snd_wnd = 1024;
+TriggerType ClosedSyn(const TcpHeader &header, TcpControlBlock &b) {
+  b.snd_seq = RandomSynNumber();
+  b.snd_una = b.snd_seq;
+  b.snd_nxt = b.snd_seq + 1;
 
-    b.rcv_nxt = header.SequenceNumber() + 1;
-    b.rcv_wnd = header.Window();
+  b.rcv_nxt = header.SequenceNumber() + 1;
+  b.rcv_wnd = PeerWindow(header, b);
 
-    return {[seq = b.snd_seq, ack = b.rcv_nxt, wnd = b.snd_wnd](
-            SocketInternalInterface *tcp) {
-          tcp->Accept();
-          tcp->SendSynAck(seq, ack, wnd);
-        }, &b.state.emplace<SynRcvd>()};
-  }
+  return {[seq = b.snd_seq, ack = b.rcv_nxt, wnd = SynWindowField(b)](
+          SocketInternalInterface *tcp) {
+        tcp->Accept();
+        tcp->SendSynAck(seq, ack, wnd);
+      }, State::kSynRcvd};
+}
 
+TriggerType ClosedReset(const TcpHeader &header, TcpControlBlock &) {
   return {[seq = header.AcknowledgementNumber()](SocketInternalInterface *tcp) {
         tcp->Discard();
         tcp->SendRst(seq);
-      }, this};
+      }, State::kClosed};
 }
 
-Listen::TriggerType Listen::operator()(
-    Event event, TcpHeader *, TcpControlBlock &b) {
-  // Initiate connection from Listen is forbiden.
-  if (event == Event::kClose) {
-    return {[](SocketInternalInterface *tcp) {tcp->Close();},
-            &b.state.emplace<Closed>()};
-  } else {
-    return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
-  }
-}
+// Listen, initiate connection from Listen is forbiden.
 
-Listen::TriggerType Listen::operator()(
-    const TcpHeader &header, TcpControlBlock &) {
-  if (header.Syn() && !header.Ack()) {
-    return {[](SocketInternalInterface *tcp) {
-          tcp->Accept();
-          tcp->NewConnection();
-        }, this};
-  }
+TriggerType ListenClose(TcpHeader *, TcpControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->Close();}, State::kClosed};
+}
 
-  // Send Rst ?
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+TriggerType ListenSyn(const TcpHeader &, TcpControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {
+        tcp->Accept();
+        tcp->NewConnection();
+      }, State::kListen};
 }
 
-SynRcvd::TriggerType SynRcvd::operator()(
-    Event event, TcpHeader *, TcpControlBlock &b) {
-  if (event == Event::kClose) {
-    return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = b.snd_wnd](
-            SocketInternalInterface *tcp){
-          tcp->SendFin(seq, ack, wnd);
-        }, &b.state.emplace<FinWait1>()};
-  }
+// SynRcvd
 
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+TriggerType SendFin(TcpControlBlock &b, State next) {
+  return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = WindowField(b)](
+          SocketInternalInterface *tcp) {
+        tcp->SendFin(seq, ack, wnd);
+      }, next};
 }
 
-SynRcvd::TriggerType SynRcvd::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsAck(header)) {
-    if (header.AcknowledgementNumber() == b.snd_nxt) {
-      b.snd_una = header.AcknowledgementNumber();
-      b.rcv_wnd = header.Window();
-      return {[](SocketInternalInterface *tcp) {
-                tcp->Accept();
-                tcp->Connected();
-              }, &b.state.emplace<Estab>()};
-    } else {
-      // Send Syn ?
-    }
+TriggerType SynRcvdClose(TcpHeader *, TcpControlBlock &b) {
+  return SendFin(b, State::kFinWait1);
+}
+
+TriggerType SynRcvdAck(const TcpHeader &header, TcpControlBlock &b) {
+  if (header.AcknowledgementNumber() == b.snd_nxt) {
+    b.snd_una = header.AcknowledgementNumber();
+    b.rcv_wnd = PeerWindow(header, b);
+    return {[](SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->Connected();
+        }, State::kEstab};
   }
 
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+  // Send Syn ?
+  return Discard(header, b);
 }
 
-SynSent::TriggerType SynSent::operator()(
-    Event, TcpHeader *, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+// SynSent
+
+TriggerType SynSentSyn(const TcpHeader &header, TcpControlBlock &b) {
+  b.rcv_nxt = header.SequenceNumber() + 1;
+  b.rcv_wnd = PeerWindow(header, b);
+  return {[seq = b.snd_nxt - 1, ack = b.rcv_nxt, wnd = WindowField(b)](
+          SocketInternalInterface *tcp) {
+        tcp->Accept();
+        tcp->SendAck(seq, ack, wnd);
+      }, State::kSynRcvd};
 }
 
-SynSent::TriggerType SynSent::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsSyn(header)) {
+TriggerType SynSentSynAck(const TcpHeader &header, TcpControlBlock &b) {
+  if (header.AcknowledgementNumber() == b.snd_nxt) {
+    b.snd_una = header.AcknowledgementNumber();
+
     b.rcv_nxt = header.SequenceNumber() + 1;
-    b.rcv_wnd = header.Window();
-    return {[seq = b.snd_nxt - 1, ack = b.rcv_nxt, wnd = b.snd_wnd](
+    b.rcv_wnd = PeerWindow(header, b);
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = WindowField(b)](
             SocketInternalInterface *tcp) {
           tcp->Accept();
           tcp->SendAck(seq, ack, wnd);
-        }, &b.state.emplace<SynRcvd>()};
-  } else if (IsSynAck(header)) {
-    if (header.AcknowledgementNumber() == b.snd_nxt) {
-      b.snd_una = header.AcknowledgementNumber();
-
-      b.rcv_nxt = header.SequenceNumber() + 1;
-      b.rcv_wnd = header.Window();
-      return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = b.snd_wnd](
-              SocketInternalInterface *tcp) {
-            tcp->Accept();
-            tcp->SendAck(seq, ack, wnd);
-            tcp->Connected();
-          }, &b.state.emplace<Estab>()};
-    } else {
-      // Send Syn ?
-    }
+          tcp->Connected();
+        }, State::kEstab};
   }
 
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+  // Send Syn ?
+  return Discard(header, b);
 }
 
-Estab::TriggerType Estab::operator()(
-    Event event, TcpHeader *header, TcpControlBlock &b) {
-  if (event == Event::kSend) {
-    assert(header);
+// Estab, and CloseWait which sends and takes ACKs the same way
 
-    // need check
-    if (b.snd_nxt + header->TcpLength() >= b.snd_una + b.snd_wnd)
-      return {[wnd = b.snd_wnd](SocketInternalInterface *tcp) {
-            tcp->SeqOutofRange(wnd);
-          }, this};
+TriggerType EstabSend(TcpHeader *header, TcpControlBlock &b) {
+  assert(header);
 
-    header->SetAck(true);
-    header->SequenceNumber() = b.snd_nxt;
-    header->AcknowledgementNumber() = b.rcv_nxt;
+  // need check
+  if (SeqGt(b.snd_nxt + header->TcpLength(), b.snd_una + b.rcv_wnd))
+    return {[wnd = WindowField(b)](SocketInternalInterface *tcp) {
+          tcp->SeqOutofRange(wnd);
+        }, b.state};
 
-    b.snd_nxt += header->TcpLength();
+  header->SetAck(true);
+  header->SetSequenceNumber(b.snd_nxt);
+  header->SetAcknowledgementNumber(b.rcv_nxt);
+  header->SetWindow(WindowField(b));
 
-    return {[](auto) {}, this};
-  } else if (event == Event::kClose) {
-    return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = b.snd_wnd](
-            SocketInternalInterface *tcp) {
-          tcp->SendFin(seq, ack, wnd);
-        }, &b.state.emplace<FinWait1>()};
-  }
+  b.snd_nxt += header->TcpLength();
 
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+  return {[](auto) {}, b.state};
 }
 
-Estab::TriggerType Estab::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsAck(header) &&
-      header.AcknowledgementNumber() <= b.snd_nxt &&
-      header.SequenceNumber() == b.rcv_nxt) {
-    b.snd_una = std::max(header.AcknowledgementNumber(), b.snd_una);
-    b.rcv_nxt = header.SequenceNumber() + header.TcpLength();
-    b.rcv_wnd = header.Window();
-    return {[seq = b.snd_nxt, ack = b.rcv_nxt, send_ack = header.TcpLength(),
-             peer_ack = header.AcknowledgementNumber(), wnd = b.snd_wnd](
-            SocketInternalInterface *tcp) {
+TriggerType EstabClose(TcpHeader *, TcpControlBlock &b) {
+  return SendFin(b, State::kFinWait1);
+}
+
+TriggerType EstabAck(const TcpHeader &header, TcpControlBlock &b) {
+  const auto seq = header.SequenceNumber();
+  const auto length = header.TcpLength();
+  if (SeqGt(header.AcknowledgementNumber(), b.snd_nxt))
+    return Discard(header, b);
+
+  // The window shrinks by what rcv_nxt moves over, until the reader makes
+  // room again
+  const uint32_t end = seq + length;
+  if (SeqGt(end, b.rcv_nxt + b.snd_wnd))
+    return Unacceptable(b);
+
+  if (seq == b.rcv_nxt) {
+    b.snd_una = SeqMax(header.AcknowledgementNumber(), b.snd_una);
+    const auto rcv_nxt = b.out_of_order.Advance(end);
+    b.snd_wnd -= rcv_nxt - b.rcv_nxt;
+    b.rcv_nxt = rcv_nxt;
+    b.rcv_wnd = PeerWindow(header, b);
+    // Filling a gap, or a push, is acked at once
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, send_ack = length, end,
+             peer_ack = header.AcknowledgementNumber(), wnd = WindowField(b),
+             push = header.Psh()](SocketInternalInterface *tcp) {
           tcp->Accept();
+          if (end != ack)
+            tcp->Reassemble(end, ack);
           tcp->RecvAck(seq, peer_ack, wnd);
-          if (send_ack)
+          if (!send_ack)
+            return;
+          if (end != ack || push)
             tcp->SendAck(seq, ack, wnd);
-        }, this};
-  } else if (IsFin(header) &&
-             header.AcknowledgementNumber() <= b.snd_nxt &&
-             header.SequenceNumber() == b.rcv_nxt) { // need check
-    b.rcv_wnd = header.Window();
-    return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = b.snd_wnd](
+          else
+            tcp->DelayAck(seq, ack, wnd);
+        }, b.state};
+  }
+
+  // A resend overlapping what was delivered, only the new bytes are
+  if (SeqLt(seq, b.rcv_nxt) && SeqGt(end, b.rcv_nxt)) {
+    b.snd_una = SeqMax(header.AcknowledgementNumber(), b.snd_una);
+    const auto first = b.rcv_nxt;
+    b.rcv_nxt = b.out_of_order.Advance(end);
+    b.snd_wnd -= b.rcv_nxt - first;
+    b.rcv_wnd = PeerWindow(header, b);
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, first,
+             peer_ack = header.AcknowledgementNumber(), wnd = WindowField(b)](
+            SocketInternalInterface *tcp) {
+          tcp->Hold(first);
+          tcp->Reassemble(first, ack);
+          tcp->RecvAck(seq, peer_ack, wnd);
+          tcp->SendAck(seq, ack, wnd);
+        }, b.state};
+  }
+
+  // Data past a gap is held, up to the right edge of the window, which the
+  // socket's reassembly buffer spans, and acked with rcv_nxt again so the
+  // peer learns of the gap
+  if (length && SeqGt(seq, b.rcv_nxt) && SeqLe(end, b.rcv_nxt + b.snd_wnd) &&
+      b.out_of_order.Add(seq, end)) {
+    b.snd_una = SeqMax(header.AcknowledgementNumber(), b.snd_una);
+    b.rcv_wnd = PeerWindow(header, b);
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, first = seq,
+             peer_ack = header.AcknowledgementNumber(), wnd = WindowField(b)](
+            SocketInternalInterface *tcp) {
+          tcp->Hold(first);
+          tcp->RecvAck(seq, peer_ack, wnd);
+          tcp->SendAck(seq, ack, wnd);
+        }, b.state};
+  }
+
+  return Unacceptable(b);
+}
+
+TriggerType EstabFin(const TcpHeader &header, TcpControlBlock &b) {
+  if (SeqLe(header.AcknowledgementNumber(), b.snd_nxt) &&
+      header.SequenceNumber() == b.rcv_nxt) { // need check
+    b.rcv_wnd = PeerWindow(header, b);
+    return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = WindowField(b)](
             SocketInternalInterface *tcp) {
           tcp->Accept();
           tcp->SendAck(seq, ack, wnd);
-        }, &b.state.emplace<CloseWait>()};
+        }, State::kCloseWait};
   }
 
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+  return Discard(header, b);
 }
 
-FinWait1::TriggerType FinWait1::operator()(
-    Event, TcpHeader *, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+// FinWait1
+
+TriggerType FinWait1Ack(const TcpHeader &header, TcpControlBlock &b) {
+  if (SeqLe(header.AcknowledgementNumber(), b.snd_nxt) &&
+      header.SequenceNumber() == b.rcv_nxt) {
+    // ack fin
+    return {[](SocketInternalInterface *tcp) { tcp->Accept(); },
+            header.AcknowledgementNumber() == b.snd_nxt ?
+                State::kFinWait2 : State::kFinWait1};
+  }
+
+  return Discard(header, b);
 }
 
-FinWait1::TriggerType FinWait1::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsAck(header) &&
-      header.AcknowledgementNumber() <= b.snd_nxt &&
+TriggerType FinWait1Fin(const TcpHeader &header, TcpControlBlock &b) {
+  if (SeqLe(header.AcknowledgementNumber(), b.snd_nxt) &&
       header.SequenceNumber() == b.rcv_nxt) {
-    if (header.AcknowledgementNumber() == b.snd_nxt) // ack fin
-      return {[](SocketInternalInterface *tcp) { tcp->Accept(); },
-              &b.state.emplace<FinWait2>()};
-    else
-      return {[](SocketInternalInterface *tcp) { tcp->Accept(); }, this};
-  } else if (IsFin(header) && 
-             header.AcknowledgementNumber() <= b.snd_nxt &&
-             header.SequenceNumber() == b.rcv_nxt) {
-    b.rcv_wnd = header.Window();
+    b.rcv_wnd = PeerWindow(header, b);
     if (header.AcknowledgementNumber() == b.snd_nxt) {
       // ACK from the other side is combined with the FIN header
-      return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = b.snd_wnd](
+      return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = WindowField(b)](
               SocketInternalInterface *tcp) {
             tcp->Accept();
             tcp->SendAck(seq, ack, wnd);
             tcp->TimeWait();
-          }, &b.state.emplace<TimeWait>()};
+          }, State::kTimeWait};
     } else {
-      return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = b.snd_wnd](
+      return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = WindowField(b)](
               SocketInternalInterface *tcp) {
             tcp->Accept();
             tcp->SendAck(seq, ack, wnd);
-          }, &b.state.emplace<Closing>()};
+          }, State::kClosing};
     }
   }
 
-  return {[](SocketInternalInterface *tcp) { tcp->Discard(); }, this};
-}
-
-CloseWait::TriggerType CloseWait::operator()(
-    Event event, TcpHeader *, TcpControlBlock &b) {
-  if (event == Event::kClose) {
-    return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = b.snd_wnd](
-            SocketInternalInterface *tcp) {
-          tcp->SendFin(seq, ack, wnd);
-        }, &b.state.emplace<LastAck>()};
-  }
-  
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+  return Discard(header, b);
 }
 
-CloseWait::TriggerType CloseWait::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  // if (IsAck(header) && IsSeqAckInRange(header, b)) {
-  //   b.snd_una = header.AcknowledgementNumber();
-  //   b.rcv_nxt = header.SequenceNumber();
-  //   b.rcv_wnd = header.Window();
+// CloseWait
 
-  //   return {[](SocketInternalInterface *tcp) {tcp->Accept();}, this};
-  // }
-
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+TriggerType CloseWaitClose(TcpHeader *, TcpControlBlock &b) {
+  return SendFin(b, State::kLastAck);
 }
 
-FinWait2::TriggerType FinWait2::operator()(
-    Event, TcpHeader *, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+// The peer's FIN took its last sequence number, text past it is ignored
+// (RFC 793 3.9) and ACKs of what we still send are taken as in Estab
+TriggerType CloseWaitAck(const TcpHeader &header, TcpControlBlock &b) {
+  if (header.TcpLength())
+    return Discard(header, b);
+  return EstabAck(header, b);
 }
 
-FinWait2::TriggerType FinWait2::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsFin(header) && 
-      header.AcknowledgementNumber() == b.snd_nxt &&
+// FinWait2
+
+TriggerType FinWait2Fin(const TcpHeader &header, TcpControlBlock &b) {
+  if (header.AcknowledgementNumber() == b.snd_nxt &&
       header.SequenceNumber() == b.rcv_nxt) {
     b.rcv_nxt = header.SequenceNumber() + 1;
-    b.rcv_wnd = header.Window();
+    b.rcv_wnd = PeerWindow(header, b);
 
-    return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = b.snd_wnd](
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = WindowField(b)](
             SocketInternalInterface *tcp) {
           tcp->Accept();
           tcp->SendAck(seq, ack, wnd);
           tcp->TimeWait();
-        }, &b.state.emplace<TimeWait>()};
+        }, State::kTimeWait};
   }
 
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+  return Discard(header, b);
 }
 
-Closing::TriggerType Closing::operator()(
-    Event, TcpHeader *, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
-}
+// Closing
 
-Closing::TriggerType Closing::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsAck(header) &&
-      header.AcknowledgementNumber() >= b.snd_una &&
+TriggerType ClosingAck(const TcpHeader &header, TcpControlBlock &b) {
+  if (SeqGe(header.AcknowledgementNumber(), b.snd_una) &&
       header.SequenceNumber() == b.rcv_nxt) {
     b.snd_una = header.AcknowledgementNumber();
     if (b.snd_nxt == header.AcknowledgementNumber())
       return {[](SocketInternalInterface *tcp) {
                 tcp->Accept();
                 tcp->TimeWait();
-              }, &b.state.emplace<TimeWait>()};
+              }, State::kTimeWait};
     else
       return {[](SocketInternalInterface *tcp) {
                 tcp->Accept();
-              }, this};
+              }, State::kClosing};
   }
 
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+  return Discard(header, b);
 }
 
-LastAck::TriggerType LastAck::operator()(
-    Event, TcpHeader *, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
-}
+// LastAck
 
-LastAck::TriggerType LastAck::operator()(
-    const TcpHeader &header, TcpControlBlock &b) {
-  if (IsAck(header) &&
-      header.AcknowledgementNumber() >= b.snd_una &&
+TriggerType LastAckAck(const TcpHeader &header, TcpControlBlock &b) {
+  if (SeqGe(header.AcknowledgementNumber(), b.snd_una) &&
       header.SequenceNumber() == b.rcv_nxt) {
     b.snd_una = header.AcknowledgementNumber();
     if (b.snd_nxt == header.AcknowledgementNumber())
       return {[](SocketInternalInterface *tcp) {
                 tcp->Accept();
                 tcp->Close();
-              }, &b.state.emplace<Closed>()};
+              }, State::kClosed};
     else
       return {[](SocketInternalInterface *tcp) {
                 tcp->Accept();
-              }, this};
+              }, State::kLastAck};
   }
-  
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+
+  return Discard(header, b);
+}
+
+constexpr size_t Index(State state) {
+  return static_cast<size_t>(state);
+}
+
+constexpr size_t Index(Event event) {
+  return static_cast<size_t>(event);
 }
 
-TimeWait::TriggerType TimeWait::operator()(
-    Event, TcpHeader *, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+constexpr size_t Index(PacketClass packet) {
+  return static_cast<size_t>(packet);
+}
+
+// Entries left out invalidate the operation or discard the packet, which
+// leaves the state as it is
+constexpr auto kEventTable = []() {
+  std::array<std::array<EventHandler, kEvents>, kStates> table{};
+  for (auto &row : table)
+    for (auto &handler : row)
+      handler = InvalidOperation;
+
+  auto set = [&table](State state, Event event, EventHandler handler) {
+    table[Index(state)][Index(event)] = handler;
+  };
+  set(State::kClosed, Event::kListen, ClosedListen);
+  set(State::kClosed, Event::kConnect, ClosedConnect);
+  set(State::kClosed, Event::kClose, ClosedClose);
+  set(State::kListen, Event::kClose, ListenClose);
+  set(State::kSynRcvd, Event::kClose, SynRcvdClose);
+  set(State::kEstab, Event::kSend, EstabSend);
+  set(State::kEstab, Event::kClose, EstabClose);
+  set(State::kCloseWait, Event::kSend, EstabSend);
+  set(State::kCloseWait, Event::kClose, CloseWaitClose);
+  return table;
+}();
+
+constexpr auto kPacketTable = []() {
+  std::array<std::array<PacketHandler, kPacketClasses>, kStates> table{};
+  for (auto &row : table)
+    for (auto &handler : row)
+      handler = Discard;
+
+  auto set = [&table](State state, PacketClass packet, PacketHandler handler) {
+    table[Index(state)][Index(packet)] = handler;
+  };
+  // Closed resets whatever is not a connection request
+  for (auto &handler : table[Index(State::kClosed)])
+    handler = ClosedReset;
+  set(State::kClosed, PacketClass::kSyn, ClosedSyn);
+  set(State::kListen, PacketClass::kSyn, ListenSyn);
+  set(State::kSynRcvd, PacketClass::kAck, SynRcvdAck);
+  set(State::kSynSent, PacketClass::kSyn, SynSentSyn);
+  set(State::kSynSent, PacketClass::kSynAck, SynSentSynAck);
+  set(State::kEstab, PacketClass::kAck, EstabAck);
+  set(State::kEstab, PacketClass::kFin, EstabFin);
+  set(State::kCloseWait, PacketClass::kAck, CloseWaitAck);
+  set(State::kFinWait1, PacketClass::kAck, FinWait1Ack);
+  set(State::kFinWait1, PacketClass::kFin, FinWait1Fin);
+  set(State::kFinWait2, PacketClass::kFin, FinWait2Fin);
+  set(State::kClosing, PacketClass::kAck, ClosingAck);
+  set(State::kLastAck, PacketClass::kAck, LastAckAck);
+  return table;
+}();
+
+} // anonymous namespace
+
+TcpState::ReactType Transition(Event event, TcpHeader *header,
+                               TcpControlBlock &b) {
+  auto [react, next] = kEventTable[Index(b.state)][Index(event)](header, b);
+  b.state = next;
+  return std::move(react);
 }
 
-TimeWait::TriggerType TimeWait::operator()(
-    const TcpHeader &, TcpControlBlock &) {
-  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+TcpState::ReactType Transition(const TcpHeader &header, TcpControlBlock &b) {
+  auto [react, next] =
+      kPacketTable[Index(b.state)][Index(Classify(header))](header, b);
+  b.state = next;
+  return std::move(react);
 }
 
 } // namespace tcp_stack
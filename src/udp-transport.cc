@@ -0,0 +1,424 @@
+#include "udp-transport.h"
+
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "safe-log.h"
+
+namespace tcp_stack {
+namespace {
+// The size of the segments a GRO datagram is made of
+size_t GroSegmentSize(msghdr &header, size_t size) {
+  for (auto cmsg = CMSG_FIRSTHDR(&header); cmsg;
+       cmsg = CMSG_NXTHDR(&header, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int segment_size;
+      std::memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+      return segment_size;
+    }
+  }
+  return size;
+}
+
+#ifdef TCP_STACK_HAS_IO_URING
+constexpr uint16_t kBufferGroup = 0;
+
+std::unique_ptr<IoUring> MakeReceiveRing(unsigned entries, uint16_t buffers) {
+  auto ring = std::make_unique<IoUring>(entries);
+  ring->RegisterBufferRing(kBufferGroup, buffers, kMaxDatagramSize);
+  return ring;
+}
+
+// Kernels without multishot recv reject it at submission, throws then
+void ProbeMultishotRecv() {
+  auto ring = MakeReceiveRing(1, 1);
+  const int probe_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (probe_socket < 0)
+    throw std::runtime_error("socket errer");
+  ring->PrepareMultishotRecv(probe_socket, kBufferGroup, 0);
+  int result = ring->Submit(0);
+  ring->ForEachCqe([&result](const io_uring_cqe &cqe) {
+        if (cqe.res < 0)
+          result = cqe.res;
+      });
+  // Cancels the recv before its socket goes away
+  ring.reset();
+  close(probe_socket);
+  if (result < 0)
+    throw std::runtime_error("multishot recv is not supported");
+}
+#endif
+
+} // anonymous namespace
+
+UdpTransport::UdpTransport(const sockaddr_in &host_addr,
+                           const sockaddr_in &peer_addr,
+                           const NetworkServiceOptions &options)
+    : host_addr_(host_addr), peer_addr_(peer_addr), options_(options) {
+  options_.batch_size = std::clamp<size_t>(options_.batch_size, 1,
+                                           kMaxBatchSize);
+  receivers_.resize(std::max<size_t>(options_.receive_threads, 1));
+  for (auto &receiver : receivers_)
+    receiver = std::make_unique<Receiver>(options_.busy_poll);
+
+  if (options_.backend != IoBackend::kIoUring)
+    return;
+
+#ifdef TCP_STACK_HAS_IO_URING
+  // Everything the receive threads need is set up here, so a kernel which
+  // lacks any of it falls back before they start
+  try {
+    constexpr unsigned kEntries = 64;
+    constexpr uint16_t kBuffers = 64;
+    ProbeMultishotRecv();
+    for (auto &receiver : receivers_)
+      receiver->ring = MakeReceiveRing(kEntries, kBuffers);
+    send_ring_ = std::make_unique<IoUring>(kMaxBatchSize);
+    return;
+  } catch (const std::exception &e) {
+    Log("io_uring unavailable, fall back to poll: ", e.what());
+  }
+  for (auto &receiver : receivers_)
+    receiver->ring.reset();
+#endif
+  options_.backend = IoBackend::kPoll;
+}
+
+UdpTransport::~UdpTransport() = default;
+
+void UdpTransport::Open(size_t index) {
+  auto &receiver = *receivers_[index];
+  const int host_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (host_socket < 0)
+    throw std::runtime_error("socket errer");
+  if (receivers_.size() > 1) {
+    const int enable = 1;
+    if (setsockopt(host_socket, SOL_SOCKET, SO_REUSEPORT,
+                   &enable, sizeof(enable)))
+      throw std::runtime_error("setsockopt SO_REUSEPORT error");
+  }
+  if (bind(host_socket, (sockaddr *)&host_addr_, sizeof(sockaddr_in)))
+    throw std::runtime_error("bind error");
+  if (index == 0 && options_.gso) {
+    // Probes whether the kernel knows UDP_SEGMENT, 0 leaves it off by default
+    const int segment_size = 0;
+    gso_enabled_ = !setsockopt(host_socket, SOL_UDP, UDP_SEGMENT,
+                               &segment_size, sizeof(segment_size));
+  }
+  receiver.socket = host_socket;
+
+#ifdef TCP_STACK_HAS_IO_URING
+  if (receiver.ring)
+    return;
+#endif
+
+  const int enable = 1;
+  receiver.gro = options_.gro && !setsockopt(
+      host_socket, SOL_UDP, UDP_GRO, &enable, sizeof(enable));
+
+  auto &pool = DatagramBufferPool::Instance();
+  const auto batch_size = options_.batch_size;
+  receiver.buffers.resize(batch_size);
+  receiver.iovecs.resize(batch_size);
+  receiver.controls.resize(batch_size);
+  receiver.messages.resize(batch_size);
+  for (size_t i=0; i<batch_size; ++i) {
+    receiver.buffers[i] = pool.Acquire();
+    receiver.iovecs[i] = {receiver.buffers[i]->Data(), DatagramBuffer::kSize};
+    receiver.messages[i] = {};
+    receiver.messages[i].msg_hdr.msg_iov = &receiver.iovecs[i];
+    receiver.messages[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+void UdpTransport::Close(size_t index) {
+  auto &receiver = *receivers_[index];
+#ifdef TCP_STACK_HAS_IO_URING
+  receiver.ring.reset();
+#endif
+  receiver.buffers.clear();
+  close(receiver.socket);
+}
+
+void UdpTransport::Receive(size_t index, std::chrono::milliseconds timeout,
+                           PacketBatch &packets) {
+  auto &receiver = *receivers_[index];
+#ifdef TCP_STACK_HAS_IO_URING
+  if (receiver.ring)
+    return ReceiveIoUring(receiver, timeout, packets);
+#endif
+  ReceivePoll(receiver, timeout, packets);
+}
+
+void UdpTransport::ReceivePoll(Receiver &receiver,
+                               std::chrono::milliseconds timeout,
+                               PacketBatch &packets) {
+  auto &pool = DatagramBufferPool::Instance();
+  auto &buffers = receiver.buffers;
+  auto &messages = receiver.messages;
+  const auto batch_size = messages.size();
+
+  // Packets of the previous batch are done with by now
+  for (size_t i=0; i<batch_size; ++i) {
+    if (!buffers[i].Unique()) {
+      buffers[i] = pool.Acquire();
+      receiver.iovecs[i].iov_base = buffers[i]->Data();
+    }
+  }
+
+  int n = 0;
+  if (receiver.spin.Enabled())
+    receiver.spin.Spin([&]() {
+          return (n = ReceiveMessages(receiver)) > 0;
+        }, busy_poll_counter_);
+
+  if (n <= 0) {
+    pollfd fdarray[1] = {{receiver.socket, POLLIN, 0}};
+    if (poll(fdarray, 1, timeout.count()) != 1)
+      return;
+
+    Log("Packet receiving");
+    n = ReceiveMessages(receiver);
+    if (n <= 0) {
+      Log("Recvmmsg error");
+      return;
+    }
+  }
+  Log("Packet received ", n);
+  receive_counter_.Record(n);
+  if (receiver.spin.Enabled())
+    receiver.spin.Arrived(AdaptiveSpin::Clock::now());
+
+  for (int i=0; i<n; ++i) {
+    const size_t size = messages[i].msg_len;
+    const size_t segment_size = receiver.gro ?
+        GroSegmentSize(messages[i].msg_hdr, size) : size;
+
+    size_t segments = 0;
+    for (size_t offset = 0; offset < size; offset += segment_size) {
+      packets.push_back(MakeNetPacket(
+          buffers[i], offset, std::min(segment_size, size - offset)));
+      ++segments;
+    }
+    if (receiver.gro)
+      gro_counter_.Record(segments);
+  }
+}
+
+int UdpTransport::ReceiveMessages(Receiver &receiver) {
+  auto &messages = receiver.messages;
+  for (size_t i=0; receiver.gro && i<messages.size(); ++i) {
+    messages[i].msg_hdr.msg_control = receiver.controls[i].data();
+    messages[i].msg_hdr.msg_controllen = receiver.controls[i].size();
+  }
+  return recvmmsg(receiver.socket, messages.data(), messages.size(),
+                  MSG_DONTWAIT, nullptr);
+}
+
+#ifdef TCP_STACK_HAS_IO_URING
+void UdpTransport::ReceiveIoUring(Receiver &receiver,
+                                  std::chrono::milliseconds timeout,
+                                  PacketBatch &packets) {
+  constexpr uint64_t kRecvTag = 1;
+
+  auto &ring = *receiver.ring;
+  // A multishot recv ends on errors or when the buffers run out
+  if (!receiver.recv_armed) {
+    ring.PrepareMultishotRecv(receiver.socket, kBufferGroup, kRecvTag);
+    receiver.recv_armed = true;
+  }
+  const auto seconds =
+      std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  const timespec ts{
+      seconds.count(),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          timeout - seconds).count()};
+  ring.Submit(1, &ts);
+
+  size_t n = 0;
+  ring.ForEachCqe([&](const io_uring_cqe &cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+          receiver.recv_armed = false;
+        if (cqe.res <= 0 || !(cqe.flags & IORING_CQE_F_BUFFER)) {
+          Log("Recv error ", cqe.res);
+          return;
+        }
+
+        const uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        packets.push_back(MakeNetPacket(ring.GetBuffer(id), cqe.res));
+        ring.RecycleBuffer(id);
+        ++n;
+      });
+  if (n)
+    receive_counter_.Record(n);
+}
+
+void UdpTransport::SendIoUring(const PacketBatch &packets, size_t first,
+                               size_t last) {
+  auto &messages = *egress_messages_;
+  for (size_t sent = first; sent < last; ) {
+    const auto next = PrepareEgressMessages(packets, sent, last);
+    const auto n = messages.size;
+    for (size_t i=0; i<n; ++i)
+      send_ring_->PrepareSendMsg(receivers_[0]->socket,
+                                 &messages.headers[i].msg_hdr, i);
+
+    // Sqes left behind would point into messages the next batch overwrites,
+    // they are dropped and their datagrams lost
+    const int ret = send_ring_->Submit(n);
+    const size_t submitted = std::max(ret, 0);
+    if (submitted < n) {
+      Log("io_uring submit error ", ret);
+      send_ring_->DropUnsubmitted();
+    }
+
+    // The messages are reused by the next flush, wait for all of them. A
+    // GSO message the path refused is kept as its range of packets.
+    std::vector<std::pair<size_t, size_t>> refused;
+    size_t completed = 0;
+    while (completed < submitted) {
+      completed += send_ring_->ForEachCqe([&](const io_uring_cqe &cqe) {
+            if (cqe.res >= 0)
+              return;
+            const auto i = static_cast<size_t>(cqe.user_data);
+            const auto from = i ? messages.ends[i - 1] : sent;
+            if (gso_enabled_ && messages.ends[i] - from > 1)
+              refused.emplace_back(from, messages.ends[i]);
+            else
+              Log("Sendmsg error ", cqe.res);
+          });
+      if (completed < submitted)
+        send_ring_->Submit(submitted - completed);
+    }
+    send_counter_.Record(submitted - refused.size());
+
+    if (!refused.empty()) {
+      // The path may not support segmentation offload, as in Send the
+      // refused trains go again without it
+      Log("Sendmsg error, disable gso");
+      gso_enabled_ = false;
+      std::sort(refused.begin(), refused.end());
+      for (const auto &[from, to] : refused)
+        SendIoUring(packets, from, to);
+    }
+    if (submitted < n)
+      break;
+    sent = next;
+  }
+}
+#endif // TCP_STACK_HAS_IO_URING
+
+void UdpTransport::Send(PacketBatch &packets) {
+#ifdef TCP_STACK_HAS_IO_URING
+  if (send_ring_)
+    return SendIoUring(packets, 0, packets.size());
+#endif
+
+  auto &messages = *egress_messages_;
+  const int host_socket = receivers_[0]->socket;
+  size_t sent = 0;
+  while (sent < packets.size()) {
+    const auto next = PrepareEgressMessages(packets, sent, packets.size());
+
+    size_t n = 0;
+    while (n < messages.size) {
+      const auto ret = sendmmsg(host_socket, messages.headers.data() + n,
+                                messages.size - n, 0);
+      if (ret <= 0)
+        break;
+      send_counter_.Record(ret);
+      n += ret;
+    }
+
+    if (n < messages.size) {
+      if (gso_enabled_) {
+        // The path may not support segmentation offload, retry what was not
+        // sent without it
+        Log("Sendmmsg error, disable gso");
+        gso_enabled_ = false;
+        if (n)
+          sent = messages.ends[n - 1];
+        continue;
+      }
+      // Datagrams are allowed to be lost, the resend will cover them.
+      Log("Sendmmsg error");
+      break;
+    }
+    sent = next;
+  }
+}
+
+size_t UdpTransport::PrepareEgressMessages(const PacketBatch &packets,
+                                           size_t first, size_t last) {
+  auto &messages = *egress_messages_;
+  messages.size = 0;
+
+  // A packet goes out as its header followed by the send buffer slices it
+  // references, nothing is copied
+  size_t iov = 0;
+  auto add_spans = [&messages, &iov](const TcpPacket &packet) {
+    packet.ForEachSpan([&messages, &iov](const char *data, size_t size) {
+          messages.iovecs[iov++] = {const_cast<char *>(data), size};
+        });
+  };
+
+  size_t i = first;
+  while (i < last && messages.size < options_.batch_size &&
+         iov + packets[i]->SpanCount() <= messages.iovecs.size()) {
+    auto &header = messages.headers[messages.size].msg_hdr;
+    header = {};
+    header.msg_name = &peer_addr_;
+    header.msg_namelen = sizeof(sockaddr_in);
+    header.msg_iov = &messages.iovecs[iov];
+    const auto message_iov = iov;
+
+    const auto segment_size = packets[i]->Size();
+    add_spans(*packets[i++]);
+    size_t segments = 1;
+    size_t bytes = segment_size;
+
+    while (gso_enabled_ && i < last &&
+           segments < kMaxGsoSegments) {
+      const auto &next = *packets[i];
+      const auto next_size = next.Size();
+      if (next_size > segment_size || bytes + next_size > kMaxGsoBytes ||
+          iov + next.SpanCount() > messages.iovecs.size() ||
+          iov - message_iov + next.SpanCount() > kMaxMessageIovecs)
+        break;
+
+      add_spans(next);
+      ++segments;
+      bytes += next_size;
+      ++i;
+
+      // Only the last segment may be shorter
+      if (next_size < segment_size)
+        break;
+    }
+    header.msg_iovlen = iov - message_iov;
+
+    if (segments > 1) {
+      auto &control = messages.controls[messages.size];
+      header.msg_control = control.data();
+      header.msg_controllen = control.size();
+      auto cmsg = CMSG_FIRSTHDR(&header);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      const uint16_t gso_size = segment_size;
+      std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+    if (gso_enabled_)
+      gso_counter_.Record(segments);
+
+    messages.ends[messages.size++] = i;
+  }
+
+  return i;
+}
+
+} // namespace tcp_stack
@@ -0,0 +1,48 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "checksum.h"
+
+using namespace tcp_stack;
+
+// Bytes per second summed, or copied and summed, by the current kernel
+template <class Fn>
+inline double ChecksumRate(size_t size, Fn fn) {
+  constexpr size_t kBytes = 1 << 28;
+  const size_t rounds = kBytes / size;
+  uint16_t sum = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i=0; i<rounds; ++i)
+    sum = ChecksumAdd(sum, fn());
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  // Keeps the sums from being optimized away
+  volatile uint16_t sink = sum;
+  (void)sink;
+  return rounds * size / elapsed.count();
+}
+
+void bench_checksum() {
+  const char *names[] = {"scalar", "sse2", "avx2"};
+  const auto original = GetChecksumKernel();
+  for (auto kernel : {ChecksumKernel::kScalar, ChecksumKernel::kSse2,
+                      ChecksumKernel::kAvx2}) {
+    if (!SetChecksumKernel(kernel))
+      continue;
+    for (size_t size : {64, 1500, 65536}) {
+      std::vector<char> source(size, 1), dest(size);
+      const auto sum_rate = ChecksumRate(size, [&]() {
+            return PartialChecksum(source.data(), size);
+          });
+      const auto copy_rate = ChecksumRate(size, [&]() {
+            return CopyWithChecksum(dest.data(), source.data(), size);
+          });
+      std::cout << __func__ << " " << names[static_cast<int>(kernel)]
+                << " size=" << size << ": sum " << sum_rate / 1e9
+                << " GB/s, copy and sum " << copy_rate / 1e9 << " GB/s"
+                << std::endl;
+    }
+  }
+  SetChecksumKernel(original);
+}
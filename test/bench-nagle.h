@@ -0,0 +1,123 @@
+#include <cstddef>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include "network-service.h"
+
+using namespace tcp_stack;
+
+// Calls fn(client socket, server connection, server service) on a
+// loopback connection, both ends set up as socket_options say
+template <class Fn>
+void OnLoopbackConnection(const SocketOptions &socket_options, uint16_t port,
+                          Fn fn) {
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    server_socket.SetOptions(socket_options);
+    auto client_socket = client->NewSocket();
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+    auto server_connection = server_socket.Accept();
+    fn(client_socket, server_connection, *server);
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+// Streams kWrites writes of kSize bytes and reports the bytes per second
+// and how many segments they took
+inline double SmallWriteRate(const SocketOptions &socket_options, bool cork,
+                             uint16_t port) {
+  constexpr size_t kWrites = 1024;
+  constexpr size_t kSize = 16;
+
+  double rate = 0;
+  OnLoopbackConnection(socket_options, port, [&](TcpSocket &client_socket,
+                                                 TcpSocket &server_connection,
+                                                 NetworkService &server) {
+        const char message[kSize] = {0};
+        std::string received(kWrites * kSize, '\0');
+
+        const auto segments = server.GetReceiveStatistics().datagrams;
+        const auto start = std::chrono::steady_clock::now();
+        if (cork)
+          client_socket.Cork();
+        for (size_t i=0; i<kWrites; ++i)
+          client_socket.Send(message, kSize);
+        if (cork)
+          client_socket.Uncork();
+        server_connection.Recv(received.data(), received.size());
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << "  segments "
+                  << server.GetReceiveStatistics().datagrams - segments
+                  << std::endl;
+        rate = received.size() / elapsed.count();
+      });
+  return rate;
+}
+
+// Sends kSize bytes back and forth and reports the mean round trip
+inline double PingPongLatency(const SocketOptions &socket_options,
+                              uint16_t port) {
+  constexpr size_t kRounds = 200;
+  constexpr size_t kSize = 32;
+
+  double latency = 0;
+  OnLoopbackConnection(socket_options, port, [&](TcpSocket &client_socket,
+                                                 TcpSocket &server_connection,
+                                                 NetworkService &) {
+        char message[kSize] = {0};
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i=0; i<kRounds; ++i) {
+          client_socket.Send(message, kSize);
+          server_connection.Recv(message, kSize);
+          server_connection.Send(message, kSize);
+          client_socket.Recv(message, kSize);
+        }
+        const std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+        latency = elapsed.count() / kRounds;
+      });
+  return latency;
+}
+
+void bench_nagle() {
+  SocketOptions nagle;
+  SocketOptions no_delay;
+  no_delay.no_delay = true;
+
+  uint16_t port = 16800;
+  for (auto [name, options, cork] : {
+           std::make_tuple("nagle", nagle, false),
+           std::make_tuple("no delay", no_delay, false),
+           std::make_tuple("cork", nagle, true)}) {
+    const auto rate = SmallWriteRate(options, cork, port);
+    std::cout << __func__ << " small writes " << name << ": "
+              << static_cast<uint64_t>(rate) << " bytes/sec" << std::endl;
+    port += 2;
+  }
+
+  for (auto [name, options] : {std::make_pair("nagle", nagle),
+                               std::make_pair("no delay", no_delay)}) {
+    const auto latency = PingPongLatency(options, port);
+    std::cout << __func__ << " ping-pong " << name << ": " << latency
+              << " us/round trip" << std::endl;
+    port += 2;
+  }
+}
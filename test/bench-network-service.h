@@ -0,0 +1,187 @@
+#include <cassert>
+#include <cstddef>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "network-service.h"
+
+using namespace tcp_stack;
+
+// Blasts datagrams from several source ports, so that SO_REUSEPORT is able
+// to spread them, and reports the rate the service drains them at.
+inline double ReceiveRate(size_t receive_threads, uint16_t port) {
+  constexpr size_t kSenders = 8;
+  constexpr auto kDuration = std::chrono::seconds(1);
+
+  NetworkService::Options options;
+  options.receive_threads = receive_threads;
+  auto service = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> senders;
+  for (size_t i=0; i<kSenders; ++i) {
+    senders.emplace_back([&stop, port]() {
+          const int sender = socket(AF_INET, SOCK_DGRAM, 0);
+          assert(sender >= 0);
+          sockaddr_in peer_addr{AF_INET, htons(port)};
+          inet_pton(AF_INET, "127.0.0.1", &peer_addr.sin_addr);
+
+          char datagram[64] = {0};
+          while (!stop.load())
+            sendto(sender, datagram, sizeof(datagram), 0,
+                   (sockaddr *)&peer_addr, sizeof(sockaddr_in));
+          close(sender);
+        });
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  const auto first = service->GetReceiveStatistics().datagrams;
+  const auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(kDuration);
+  const auto last = service->GetReceiveStatistics().datagrams;
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  stop.store(true);
+  for (auto &sender : senders)
+    sender.join();
+  service->Terminate();
+
+  return (last - first) / elapsed.count();
+}
+
+void bench_reuseport_receive() {
+  uint16_t port = 16500;
+  for (size_t k : {1, 2, 4, 8}) {
+    std::cout << __func__ << " K=" << k << ": "
+              << static_cast<uint64_t>(ReceiveRate(k, port))
+              << " packets/sec" << std::endl;
+    port += 2;
+  }
+}
+
+// Pushes header-only packets from one service to another for a second and
+// reports the rate the receiver drains them at. The packets fail the
+// checksum, so the rate is the transport's and not the state machine's.
+inline double TransportRate(const NetworkService::Options &options,
+                            uint16_t port) {
+  constexpr auto kDuration = std::chrono::seconds(1);
+
+  auto receiver = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto sender = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  std::atomic<bool> stop{false};
+  std::thread th([&]() {
+        while (!stop.load()) {
+          NetworkService::EgressBatch egress_batch(sender.get());
+          for (size_t i=0; i<options.batch_size; ++i)
+            sender->SendPacket(MakeTcpPacket(0));
+        }
+      });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  const auto first = receiver->GetReceiveStatistics().datagrams;
+  const auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(kDuration);
+  const auto last = receiver->GetReceiveStatistics().datagrams;
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  stop.store(true);
+  th.join();
+  sender->Terminate();
+  receiver->Terminate();
+
+  return (last - first) / elapsed.count();
+}
+
+void bench_transport() {
+  NetworkService::Options udp;
+  std::cout << __func__ << " udp: "
+            << static_cast<uint64_t>(TransportRate(udp, 16600))
+            << " packets/sec" << std::endl;
+
+  NetworkService::Options loopback;
+  loopback.loopback = std::make_shared<LoopbackNetwork>();
+  std::cout << __func__ << " loopback: "
+            << static_cast<uint64_t>(TransportRate(loopback, 16600))
+            << " packets/sec" << std::endl;
+
+  const auto pool = PacketPool::Instance().GetStatistics();
+  std::cout << "  packet pool hits " << pool.hits << ", misses "
+            << pool.misses << ", slabs " << pool.slabs << std::endl;
+}
+
+// Sends one packet at a time with a pause in between, and measures how long
+// the receiver takes to count it. Only the receiver busy polls. The sending
+// thread yields while it waits and pauses, so that on a machine with few
+// cores it does not keep a spinning receiver off the CPU, and the pause is
+// not stretched by timer slack. Returns the median.
+inline double DeliveryLatency(const NetworkService::Options &options,
+                              uint16_t port) {
+  constexpr size_t kPackets = 2000;
+  constexpr auto kPause = std::chrono::microseconds(20);
+  using Clock = std::chrono::steady_clock;
+
+  NetworkService::Options sender_options;
+  sender_options.loopback = options.loopback;
+  auto receiver = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto sender = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, sender_options);
+
+  std::vector<double> latencies;
+  for (size_t i=0; i<kPackets; ++i) {
+    const auto count = receiver->GetReceiveStatistics().datagrams;
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::milliseconds(10);
+    sender->SendPacket(MakeTcpPacket(0));
+    while (receiver->GetReceiveStatistics().datagrams == count &&
+           Clock::now() < deadline)
+      std::this_thread::yield();
+    if (receiver->GetReceiveStatistics().datagrams != count)
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+          Clock::now() - start).count());
+
+    const auto resume = Clock::now() + kPause;
+    while (Clock::now() < resume)
+      std::this_thread::yield();
+  }
+
+  const auto statistics = receiver->GetBusyPollStatistics();
+  std::cout << "  spins " << statistics.spins << ", sleeps "
+            << statistics.sleeps << ", spin time "
+            << statistics.spin_nanoseconds / 1000000 << " ms" << std::endl;
+
+  sender->Terminate();
+  receiver->Terminate();
+  if (latencies.empty())
+    return 0;
+  std::nth_element(latencies.begin(),
+                   latencies.begin() + latencies.size() / 2, latencies.end());
+  return latencies[latencies.size() / 2];
+}
+
+void bench_busy_poll() {
+  uint16_t port = 16700;
+  for (bool loopback : {false, true}) {
+    for (auto busy_poll : {0, 50, 200}) {
+      NetworkService::Options options;
+      options.busy_poll = std::chrono::microseconds(busy_poll);
+      if (loopback)
+        options.loopback = std::make_shared<LoopbackNetwork>();
+      const auto latency = DeliveryLatency(options, port);
+      std::cout << __func__ << (loopback ? " loopback" : " udp")
+                << " budget " << busy_poll << "us: " << latency
+                << " us/packet" << std::endl;
+      port += 2;
+    }
+  }
+}
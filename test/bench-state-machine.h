@@ -0,0 +1,611 @@
+#include <cassert>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <variant>
+
+#include "state.h"
+
+using namespace tcp_stack;
+
+// Keeps the last header a socket would have sent, to feed it to the peer
+class HeaderInternal final : public SocketInternalInterface {
+public:
+  void SendSyn(uint32_t seq, uint16_t window) override {
+    header = TcpHeader();
+    SynHeader(seq, window);
+  }
+  void SendSynAck(uint32_t seq, uint32_t ack, uint16_t window) override {
+    header = TcpHeader();
+    SynHeader(seq, window);
+    AckHeader(seq, ack, window);
+  }
+  void SendAck(uint32_t seq, uint32_t ack, uint16_t window) override {
+    header = TcpHeader();
+    AckHeader(seq, ack, window);
+  }
+  void DelayAck(uint32_t seq, uint32_t ack, uint16_t window) override {
+    SendAck(seq, ack, window);
+  }
+  void SendFin(uint32_t seq, uint32_t ack, uint16_t window) override {
+    header = TcpHeader();
+    header.SetFin(true);
+    AckHeader(seq, ack, window);
+  }
+
+  void RecvSyn(uint32_t, uint16_t) override {}
+  void RecvAck(uint32_t, uint32_t, uint16_t) override {}
+  void RecvFin(uint32_t, uint32_t, uint16_t) override {}
+  void Listen() override {}
+  void Connected() override {}
+  void Accept() override {}
+  void Discard() override {}
+  void Hold(uint32_t) override {}
+  void Reassemble(uint32_t, uint32_t) override {}
+  void SeqOutofRange(uint16_t) override {}
+  void SendRst(uint32_t) override {}
+  void InvalidOperation() override {}
+  void NewConnection() override {}
+  void Close() override {}
+  void TimeWait() override {}
+
+  TcpHeader header;
+
+private:
+  void SynHeader(uint32_t seq, uint16_t window) {
+    header.SetSyn(true);
+    header.SetSequenceNumber(seq);
+    header.SetWindow(window);
+  }
+
+  void AckHeader(uint32_t seq, uint32_t ack, uint16_t window) {
+    header.SetAck(true);
+    header.SetSequenceNumber(seq);
+    header.SetAcknowledgementNumber(ack);
+    header.SetWindow(window);
+  }
+};
+
+// The dispatch the tables replaced, kept as the baseline of the benchmark.
+// Each state is an object in a variant, a transition is a virtual call into
+// it and emplaces the next one. The handlers are those from before the
+// tables too, which do less than today's: no window scaling, no
+// reassembly, no delayed ACK.
+namespace legacy {
+struct ControlBlock;
+
+class StateBase {
+public:
+  using ReactType = TcpState::ReactType;
+  using TriggerType = std::pair<ReactType, StateBase *>;
+
+  virtual ~StateBase() = default;
+
+  virtual TriggerType operator()(Event, TcpHeader *, ControlBlock &) = 0;
+  virtual TriggerType operator()(const TcpHeader &, ControlBlock &) = 0;
+
+  virtual State GetState() const = 0;
+};
+
+class Closed final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kClosed; }
+};
+
+class Listen final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kListen; }
+};
+
+class SynRcvd final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kSynRcvd; }
+};
+
+class SynSent final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kSynSent; }
+};
+
+class Estab final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kEstab; }
+};
+
+class FinWait1 final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kFinWait1; }
+};
+
+class CloseWait final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kCloseWait; }
+};
+
+class FinWait2 final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kFinWait2; }
+};
+
+class Closing final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kClosing; }
+};
+
+class LastAck final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kLastAck; }
+};
+
+class TimeWait final : public StateBase {
+public:
+  TriggerType operator()(Event, TcpHeader *, ControlBlock &) override;
+  TriggerType operator()(const TcpHeader &, ControlBlock &) override;
+  State GetState() const override { return State::kTimeWait; }
+};
+
+struct ControlBlock {
+  uint32_t snd_seq = 0;
+  uint32_t snd_una = 0;
+  uint32_t snd_nxt = 0;
+  uint16_t snd_wnd = 0;
+  uint32_t rcv_nxt = 0;
+  uint32_t rcv_wnd = 0;
+
+  std::variant<Closed, Listen, SynRcvd, SynSent, Estab, FinWait1, CloseWait,
+               FinWait2, Closing, LastAck, TimeWait> state;
+};
+
+class StateManager {
+public:
+  StateBase::ReactType operator()(Event event, TcpHeader *header) {
+    Log(block_.snd_nxt, " Action In: ", ToString(GetState()));
+
+    auto [react, new_state] = state_->operator()(event, header, block_);
+    state_ = new_state;
+
+    Log("Action out: ", ToString(GetState()), "\n");
+    return std::move(react);
+  }
+
+  StateBase::ReactType operator()(const TcpHeader &header) {
+    Log(block_.snd_nxt, " Packet In: ", ToString(GetState()));
+
+    auto [react, new_state] = state_->operator()(header, block_);
+    state_ = new_state;
+
+    Log("Packet Out: ", ToString(GetState()), "\n");
+    return std::move(react);
+  }
+
+  State GetState() const {
+    return state_->GetState();
+  }
+
+private:
+  ControlBlock block_;
+  StateBase *state_ = &std::get<Closed>(block_.state);
+};
+
+inline bool IsAck(const TcpHeader &header) {
+  return header.Ack() && !header.Syn() && !header.Fin();
+}
+
+inline bool IsSyn(const TcpHeader &header) {
+  return header.Syn() && !header.Ack() && !header.Fin();
+}
+
+inline bool IsSynAck(const TcpHeader &header) {
+  return header.Syn() && header.Ack() && !header.Fin();
+}
+
+inline bool IsFin(const TcpHeader &header) {
+  return header.Fin() && header.Ack() && !header.Syn();
+}
+
+inline uint32_t RandomSynNumber() {
+  thread_local static std::mt19937 e(std::random_device{}());
+  thread_local static std::uniform_int_distribution<uint32_t> d(10, 10000);
+
+  return d(e);
+}
+
+inline Closed::TriggerType Closed::operator()(
+    Event event, TcpHeader *, ControlBlock &b) {
+  if (event == Event::kListen) {
+    return {[](SocketInternalInterface *tcp) {
+          tcp->Listen();
+        }, &b.state.emplace<Listen>()};
+  } else if (event == Event::kConnect) {
+    b.snd_seq = RandomSynNumber();
+    b.snd_una = b.snd_seq;
+    b.snd_nxt = b.snd_seq + 1;
+    b.snd_wnd = 1024;
+    return {[seq = b.snd_seq, wnd = b.snd_wnd](SocketInternalInterface *tcp) {
+          tcp->SendSyn(seq, wnd);
+        }, &b.state.emplace<SynSent>()};
+  } else if (event == Event::kClose) {
+    return {[](SocketInternalInterface *tcp) {tcp->Close();}, this};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline Closed::TriggerType Closed::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsSyn(header)) {
+    b.snd_seq = RandomSynNumber();
+    b.snd_una = b.snd_seq;
+    b.snd_nxt = b.snd_seq + 1;
+    b.snd_wnd = 1024;
+
+    b.rcv_nxt = header.SequenceNumber() + 1;
+    b.rcv_wnd = header.Window();
+
+    return {[seq = b.snd_seq, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->SendSynAck(seq, ack, wnd);
+        }, &b.state.emplace<SynRcvd>()};
+  }
+
+  return {[seq = header.AcknowledgementNumber()](SocketInternalInterface *tcp) {
+        tcp->Discard();
+        tcp->SendRst(seq);
+      }, this};
+}
+
+inline Listen::TriggerType Listen::operator()(
+    Event event, TcpHeader *, ControlBlock &b) {
+  if (event == Event::kClose)
+    return {[](SocketInternalInterface *tcp) {tcp->Close();},
+            &b.state.emplace<Closed>()};
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline Listen::TriggerType Listen::operator()(
+    const TcpHeader &header, ControlBlock &) {
+  if (header.Syn() && !header.Ack()) {
+    return {[](SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->NewConnection();
+        }, this};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline SynRcvd::TriggerType SynRcvd::operator()(
+    Event event, TcpHeader *, ControlBlock &b) {
+  if (event == Event::kClose) {
+    return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp){
+          tcp->SendFin(seq, ack, wnd);
+        }, &b.state.emplace<FinWait1>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline SynRcvd::TriggerType SynRcvd::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsAck(header) && header.AcknowledgementNumber() == b.snd_nxt) {
+    b.snd_una = header.AcknowledgementNumber();
+    b.rcv_wnd = header.Window();
+    return {[](SocketInternalInterface *tcp) {
+              tcp->Accept();
+              tcp->Connected();
+            }, &b.state.emplace<Estab>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline SynSent::TriggerType SynSent::operator()(
+    Event, TcpHeader *, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline SynSent::TriggerType SynSent::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsSyn(header)) {
+    b.rcv_nxt = header.SequenceNumber() + 1;
+    b.rcv_wnd = header.Window();
+    return {[seq = b.snd_nxt - 1, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->SendAck(seq, ack, wnd);
+        }, &b.state.emplace<SynRcvd>()};
+  } else if (IsSynAck(header) &&
+             header.AcknowledgementNumber() == b.snd_nxt) {
+    b.snd_una = header.AcknowledgementNumber();
+
+    b.rcv_nxt = header.SequenceNumber() + 1;
+    b.rcv_wnd = header.Window();
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->SendAck(seq, ack, wnd);
+          tcp->Connected();
+        }, &b.state.emplace<Estab>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline Estab::TriggerType Estab::operator()(
+    Event event, TcpHeader *header, ControlBlock &b) {
+  if (event == Event::kSend) {
+    assert(header);
+
+    if (b.snd_nxt + header->TcpLength() >= b.snd_una + b.snd_wnd)
+      return {[wnd = b.snd_wnd](SocketInternalInterface *tcp) {
+            tcp->SeqOutofRange(wnd);
+          }, this};
+
+    header->SetAck(true);
+    header->SetSequenceNumber(b.snd_nxt);
+    header->SetAcknowledgementNumber(b.rcv_nxt);
+
+    b.snd_nxt += header->TcpLength();
+
+    return {[](auto) {}, this};
+  } else if (event == Event::kClose) {
+    return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->SendFin(seq, ack, wnd);
+        }, &b.state.emplace<FinWait1>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline Estab::TriggerType Estab::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsAck(header) &&
+      header.AcknowledgementNumber() <= b.snd_nxt &&
+      header.SequenceNumber() == b.rcv_nxt) {
+    b.snd_una = std::max(header.AcknowledgementNumber(), b.snd_una);
+    b.rcv_nxt = header.SequenceNumber() + header.TcpLength();
+    b.rcv_wnd = header.Window();
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, send_ack = header.TcpLength(),
+             peer_ack = header.AcknowledgementNumber(), wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->RecvAck(seq, peer_ack, wnd);
+          if (send_ack)
+            tcp->SendAck(seq, ack, wnd);
+        }, this};
+  } else if (IsFin(header) &&
+             header.AcknowledgementNumber() <= b.snd_nxt &&
+             header.SequenceNumber() == b.rcv_nxt) {
+    b.rcv_wnd = header.Window();
+    return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->SendAck(seq, ack, wnd);
+        }, &b.state.emplace<CloseWait>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline FinWait1::TriggerType FinWait1::operator()(
+    Event, TcpHeader *, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline FinWait1::TriggerType FinWait1::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsAck(header) &&
+      header.AcknowledgementNumber() <= b.snd_nxt &&
+      header.SequenceNumber() == b.rcv_nxt) {
+    if (header.AcknowledgementNumber() == b.snd_nxt)
+      return {[](SocketInternalInterface *tcp) { tcp->Accept(); },
+              &b.state.emplace<FinWait2>()};
+    return {[](SocketInternalInterface *tcp) { tcp->Accept(); }, this};
+  } else if (IsFin(header) &&
+             header.AcknowledgementNumber() <= b.snd_nxt &&
+             header.SequenceNumber() == b.rcv_nxt) {
+    b.rcv_wnd = header.Window();
+    if (header.AcknowledgementNumber() == b.snd_nxt) {
+      return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = b.snd_wnd](
+              SocketInternalInterface *tcp) {
+            tcp->Accept();
+            tcp->SendAck(seq, ack, wnd);
+            tcp->TimeWait();
+          }, &b.state.emplace<TimeWait>()};
+    }
+    return {[seq = b.snd_nxt, ack = ++b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->SendAck(seq, ack, wnd);
+        }, &b.state.emplace<Closing>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) { tcp->Discard(); }, this};
+}
+
+inline CloseWait::TriggerType CloseWait::operator()(
+    Event event, TcpHeader *, ControlBlock &b) {
+  if (event == Event::kClose) {
+    return {[seq = b.snd_nxt++, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->SendFin(seq, ack, wnd);
+        }, &b.state.emplace<LastAck>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline CloseWait::TriggerType CloseWait::operator()(
+    const TcpHeader &, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline FinWait2::TriggerType FinWait2::operator()(
+    Event, TcpHeader *, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline FinWait2::TriggerType FinWait2::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsFin(header) &&
+      header.AcknowledgementNumber() == b.snd_nxt &&
+      header.SequenceNumber() == b.rcv_nxt) {
+    b.rcv_nxt = header.SequenceNumber() + 1;
+    b.rcv_wnd = header.Window();
+
+    return {[seq = b.snd_nxt, ack = b.rcv_nxt, wnd = b.snd_wnd](
+            SocketInternalInterface *tcp) {
+          tcp->Accept();
+          tcp->SendAck(seq, ack, wnd);
+          tcp->TimeWait();
+        }, &b.state.emplace<TimeWait>()};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline Closing::TriggerType Closing::operator()(
+    Event, TcpHeader *, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline Closing::TriggerType Closing::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsAck(header) &&
+      header.AcknowledgementNumber() >= b.snd_una &&
+      header.SequenceNumber() == b.rcv_nxt) {
+    b.snd_una = header.AcknowledgementNumber();
+    if (b.snd_nxt == header.AcknowledgementNumber())
+      return {[](SocketInternalInterface *tcp) {
+                tcp->Accept();
+                tcp->TimeWait();
+              }, &b.state.emplace<TimeWait>()};
+    return {[](SocketInternalInterface *tcp) {tcp->Accept();}, this};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline LastAck::TriggerType LastAck::operator()(
+    Event, TcpHeader *, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline LastAck::TriggerType LastAck::operator()(
+    const TcpHeader &header, ControlBlock &b) {
+  if (IsAck(header) &&
+      header.AcknowledgementNumber() >= b.snd_una &&
+      header.SequenceNumber() == b.rcv_nxt) {
+    b.snd_una = header.AcknowledgementNumber();
+    if (b.snd_nxt == header.AcknowledgementNumber())
+      return {[](SocketInternalInterface *tcp) {
+                tcp->Accept();
+                tcp->Close();
+              }, &b.state.emplace<Closed>()};
+    return {[](SocketInternalInterface *tcp) {tcp->Accept();}, this};
+  }
+
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+inline TimeWait::TriggerType TimeWait::operator()(
+    Event, TcpHeader *, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->InvalidOperation();}, this};
+}
+
+inline TimeWait::TriggerType TimeWait::operator()(
+    const TcpHeader &, ControlBlock &) {
+  return {[](SocketInternalInterface *tcp) {tcp->Discard();}, this};
+}
+
+} // namespace legacy
+
+// A whole connection between two state machines: handshake, data both
+// ways, and close. Returns the number of transitions.
+template <typename Manager>
+size_t RunConnection() {
+  constexpr size_t kSegments = 16;
+  Manager tcp1, tcp2;
+  HeaderInternal internal1, internal2;
+  size_t transitions = 0;
+  auto deliver = [&transitions](Manager &tcp, HeaderInternal &from,
+                                HeaderInternal &to) {
+        tcp(from.header)(&to);
+        ++transitions;
+      };
+
+  tcp1(Event::kConnect, nullptr)(&internal1);
+  deliver(tcp2, internal1, internal2);
+  deliver(tcp1, internal2, internal1);
+  deliver(tcp2, internal1, internal2);
+  transitions += 1;
+  assert(tcp1.GetState() == State::kEstab);
+  assert(tcp2.GetState() == State::kEstab);
+
+  for (size_t i=0; i<kSegments; ++i) {
+    TcpHeader data;
+    data.SetTcpLength(100);
+    tcp1(Event::kSend, &data)(&internal1);
+    internal1.header = data;
+    deliver(tcp2, internal1, internal2);
+    deliver(tcp1, internal2, internal1);
+    transitions += 1;
+  }
+
+  tcp1(Event::kClose, nullptr)(&internal1);
+  deliver(tcp2, internal1, internal2);
+  tcp2(Event::kClose, nullptr)(&internal2);
+  deliver(tcp1, internal2, internal1);
+  deliver(tcp2, internal1, internal2);
+  transitions += 2;
+  assert(tcp1.GetState() == State::kTimeWait);
+  assert(tcp2.GetState() == State::kClosed);
+  return transitions;
+}
+
+template <typename Manager>
+double TransitionsPerSecond() {
+  constexpr auto kDuration = std::chrono::seconds(1);
+  size_t transitions = 0;
+  const auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < kDuration)
+    transitions += RunConnection<Manager>();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return transitions / elapsed.count();
+}
+
+// The same connections through the tables and through the virtual dispatch
+// of legacy
+void bench_state_machine() {
+  std::cout << __func__ << ": tables "
+            << TransitionsPerSecond<TcpStateManager>()
+            << " transitions/sec, virtual "
+            << TransitionsPerSecond<legacy::StateManager>()
+            << " transitions/sec" << std::endl;
+}
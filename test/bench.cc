@@ -0,0 +1,15 @@
+#include "bench-checksum.h"
+#include "bench-nagle.h"
+#include "bench-network-service.h"
+#include "bench-state-machine.h"
+
+int main() {
+  bench_reuseport_receive();
+  bench_transport();
+  bench_busy_poll();
+  bench_checksum();
+  bench_state_machine();
+  bench_nagle();
+
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include <cassert>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "checksum.h"
+#include "tcp-header.h"
+
+using namespace tcp_stack;
+
+// RFC 1071 done the textbook way, words in network order, for reference
+inline uint16_t ReferenceChecksum(const unsigned char *data, size_t size) {
+  uint32_t sum = 0;
+  for (size_t i=0; i<size; i+=2)
+    sum += data[i] << 8 | (i + 1 < size ? data[i+1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return htons(static_cast<uint16_t>(sum));
+}
+
+void TestChecksumRfc1071Example() {
+  // The example of RFC 1071 section 3, the sum is ddf2 in network order
+  const unsigned char data[] = {0x00, 0x01, 0xf2, 0x03,
+                                0xf4, 0xf5, 0xf6, 0xf7};
+  assert(PartialChecksum(data, sizeof(data)) == htons(0xddf2));
+}
+
+void TestChecksumKernels() {
+  std::mt19937 e(1);
+  std::vector<unsigned char> data(4096 + 64);
+  for (auto &byte : data)
+    byte = e();
+  // All ones words make the accumulators carry the most
+  std::fill(data.begin() + 2048, data.end(), 0xff);
+
+  const auto original = GetChecksumKernel();
+  for (auto kernel : {ChecksumKernel::kScalar, ChecksumKernel::kSse2,
+                      ChecksumKernel::kAvx2}) {
+    if (!SetChecksumKernel(kernel))
+      continue;
+    for (size_t offset : {0, 1, 3, 16, 2047}) {
+      for (size_t size : {0, 1, 2, 7, 31, 32, 33, 63, 64, 65, 1500, 2049}) {
+        const auto first = data.data() + offset;
+        const auto expected = ReferenceChecksum(first, size);
+        assert(PartialChecksum(first, size) == expected);
+
+        std::vector<unsigned char> copy(size + 1, 0x5a);
+        assert(CopyWithChecksum(copy.data(), first, size) == expected);
+        assert(std::equal(first, first + size, copy.begin()));
+        assert(copy[size] == 0x5a);
+      }
+    }
+  }
+  SetChecksumKernel(original);
+}
+
+void TestChecksumIncrementalUpdate() {
+  auto packet = MakeTcpPacket(101);
+  std::mt19937 e(2);
+  for (auto &byte : *packet)
+    byte = e();
+  auto &header = packet->GetHeader();
+  header.SetSequenceNumber(1000);
+
+  for (uint32_t ack : {0u, 1u, 0xffffu, 0x10000u, 0xffffffffu, 123456789u}) {
+    header.SetChecksum(0);
+    header.SetChecksum(CalculateChecksum(*packet));
+
+    header.PatchAcknowledgementNumber(ack);
+    assert(header.AcknowledgementNumber() == ack);
+    assert(CalculateChecksum(*packet) == 0);
+
+    const auto patched = header.Checksum();
+    header.SetChecksum(0);
+    assert(CalculateChecksum(*packet) == patched);
+  }
+
+  // A 16 bit field on its own
+  const uint16_t window = htons(header.Window());
+  const uint16_t new_window = htons(4321);
+  header.SetChecksum(0);
+  header.SetChecksum(UpdateChecksum(CalculateChecksum(*packet), window,
+                                    new_window));
+  header.SetWindow(4321);
+  assert(CalculateChecksum(*packet) == 0);
+}
+
+void TestChecksumCopiedPacket() {
+  // A packet copied in keeps the sum of the copy, until it may change
+  std::vector<char> datagram(sizeof(TcpHeader) + 77);
+  std::mt19937 e(3);
+  for (auto &byte : datagram)
+    byte = e();
+  const auto expected = static_cast<uint16_t>(~ReferenceChecksum(
+      reinterpret_cast<const unsigned char *>(datagram.data()),
+      datagram.size()));
+
+  auto packet = MakeNetPacket(datagram.data(), datagram.size());
+  assert(CalculateChecksum(*packet) == expected);
+  auto &header = packet->GetHeader();
+  header.SetWindow(header.Window() ^ 1);
+  assert(CalculateChecksum(*packet) != expected);
+}
+
+void test_checksum() {
+  TestChecksumRfc1071Example();
+  TestChecksumKernels();
+  TestChecksumIncrementalUpdate();
+  TestChecksumCopiedPacket();
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,188 @@
+#include <cassert>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "congestion-control.h"
+#include "network-service.h"
+
+using namespace tcp_stack;
+
+// Slow start adds what is acked, congestion avoidance a segment per window,
+// a loss halves what was in flight and a timeout starts over from one
+// segment
+void TestNewReno() {
+  constexpr uint32_t kMss = 1000;
+  const auto now = CongestionControl::Clock::now();
+  const auto rtt = std::chrono::milliseconds(10);
+  NewReno reno(kMss);
+  assert(reno.Window() == kInitialCongestionWindow * kMss);
+
+  // Not using the window does not grow it
+  reno.OnAck(kMss, kMss, rtt, now);
+  assert(reno.Window() == kInitialCongestionWindow * kMss);
+
+  for (int i=0; i<10; ++i)
+    reno.OnAck(kMss, reno.Window(), rtt, now);
+  assert(reno.Window() == 20 * kMss);
+
+  reno.OnLoss(20 * kMss, now);
+  assert(reno.Window() == 10 * kMss && reno.SlowStartThreshold() == 10 * kMss);
+  for (int i=0; i<10; ++i)
+    reno.OnAck(kMss, reno.Window(), rtt, now);
+  assert(reno.Window() == 11 * kMss);
+
+  reno.OnTimeout(11 * kMss);
+  assert(reno.Window() == kMss && reno.SlowStartThreshold() == 5500);
+  reno.OnLoss(kMss, now);
+  assert(reno.Window() == 2 * kMss);
+}
+
+// After a loss the window grows back fast, flattens around where the loss
+// happened, then probes past it
+void TestCubic() {
+  constexpr uint32_t kMss = 1000;
+  const auto rtt = std::chrono::milliseconds(100);
+  auto now = CongestionControl::Clock::now();
+  Cubic cubic(kMss);
+
+  // A window of acks every round trip
+  auto round = [&]() {
+    now += rtt;
+    const auto segments = cubic.Window() / kMss;
+    for (uint32_t i=0; i<segments; ++i)
+      cubic.OnAck(kMss, cubic.Window(), rtt, now);
+  };
+
+  while (cubic.Window() < 100 * kMss)
+    round();
+  const auto before = cubic.Window();
+  cubic.OnLoss(before, now);
+  assert(cubic.WindowMax() == before);
+  assert(cubic.Window() == static_cast<uint32_t>(before * 0.7));
+
+  // K, the time back to the maximum, is the cube root of w_max * 0.3 / 0.4
+  const double k = std::cbrt(before / kMss * 0.3 / 0.4);
+  const auto rounds = static_cast<int>(k / 0.1);
+  uint32_t halfway = 0;
+  for (int i=0; i<rounds; ++i) {
+    round();
+    if (i == rounds / 2)
+      halfway = cubic.Window();
+  }
+  // Concave, most of the way back in the first half
+  assert(halfway > before * 0.9 && halfway < before);
+  assert(cubic.Window() > before * 0.98 && cubic.Window() < before * 1.02);
+  for (int i=0; i<rounds; ++i)
+    round();
+  assert(cubic.Window() > before * 1.2);
+
+  // Fast convergence, losing below the last maximum lowers it further
+  const auto window = cubic.Window();
+  cubic.OnLoss(window, now);
+  const auto lower = cubic.Window();
+  cubic.OnLoss(lower, now);
+  assert(cubic.WindowMax() < lower);
+
+  cubic.OnTimeout(lower);
+  assert(cubic.Window() == kMss);
+}
+
+// A path of kBandwidth bytes per second and kRtt round trip, the window
+// beyond the bandwidth delay product queues, and acks come evenly over
+// the round
+void TestBbr() {
+  constexpr uint32_t kMss = 1000;
+  constexpr double kBandwidth = 1000 * kMss;
+  const auto kRtt = std::chrono::milliseconds(20);
+  const double bdp = kBandwidth * 0.02;
+  auto now = CongestionControl::Clock::now();
+  Bbr bbr(kMss);
+
+  bool probed_rtt = false;
+  for (int i=0; i<400; ++i) {
+    const uint32_t segments = bbr.Window() / kMss;
+    const auto duration = std::max<CongestionControl::Clock::duration>(
+        kRtt, std::chrono::microseconds(
+                  static_cast<int64_t>(segments * kMss / kBandwidth * 1e6)));
+    const auto start = now;
+    for (uint32_t j=1; j<=segments; ++j) {
+      now = start + duration * j / segments;
+      bbr.OnAck(kMss, (segments - j + 1) * kMss, duration, now);
+    }
+    probed_rtt |= bbr.GetMode() == Bbr::Mode::kProbeRtt;
+    if (i == 100) {
+      assert(bbr.GetMode() == Bbr::Mode::kProbeBandwidth);
+      assert(bbr.MinRtt() == kRtt);
+      assert(bbr.Bandwidth() > kBandwidth * 0.9 &&
+             bbr.Bandwidth() < kBandwidth * 1.1);
+      assert(bbr.Window() >= bdp && bbr.Window() <= 3 * bdp);
+
+      // A loss leaves the model alone
+      bbr.OnLoss(bbr.Window(), now);
+      assert(bbr.Bandwidth() > kBandwidth * 0.9);
+    }
+  }
+  // Past 10 seconds the round trip is measured again, at 4 segments
+  assert(probed_rtt);
+  assert(bbr.GetMode() == Bbr::Mode::kProbeBandwidth);
+  assert(bbr.MinRtt() == kRtt);
+}
+
+// A megabyte crosses a connection of each algorithm
+void TestLoopbackCongestion(CongestionAlgorithm algorithm, uint16_t port) {
+  constexpr size_t kSize = 1 << 20;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    SocketOptions socket_options;
+    socket_options.congestion_control = algorithm;
+    server_socket.SetOptions(socket_options);
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    std::mt19937 random(17);
+    std::string stream(kSize, '\0');
+    for (auto &c : stream)
+      c = static_cast<char>(random());
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread sender([&]() {
+          client_socket.Send(stream.data(), stream.size());
+        });
+    auto server_connection = server_socket.Accept();
+    assert(server_connection.GetOptions().congestion_control == algorithm);
+    std::string received(kSize, '\0');
+    server_connection.Recv(received.data(), kSize);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+
+    assert(received == stream);
+    assert(elapsed < std::chrono::seconds(5));
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_congestion() {
+  TestNewReno();
+  TestCubic();
+  TestBbr();
+  TestLoopbackCongestion(CongestionAlgorithm::kNewReno, 15526);
+  TestLoopbackCongestion(CongestionAlgorithm::kCubic, 15528);
+  TestLoopbackCongestion(CongestionAlgorithm::kBbr, 15530);
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,127 @@
+#include <cassert>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "network-service.h"
+#include "state.h"
+
+using namespace tcp_stack;
+
+// Records how the state machine asked for the last ACK
+class AckInternal final : public SocketInternalInterface {
+public:
+  void SendSyn(uint32_t, uint16_t) override {}
+  void SendSynAck(uint32_t, uint32_t, uint16_t) override {}
+  void SendAck(uint32_t, uint32_t, uint16_t) override {
+    last_ack = __func__;
+  }
+  void DelayAck(uint32_t, uint32_t, uint16_t) override {
+    last_ack = __func__;
+  }
+  void SendFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void RecvSyn(uint32_t, uint16_t) override {}
+  void RecvAck(uint32_t, uint32_t, uint16_t) override {}
+  void RecvFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void Listen() override {}
+  void Connected() override {}
+
+  void Accept() override {}
+  void Discard() override {}
+  void Hold(uint32_t) override {}
+  void Reassemble(uint32_t, uint32_t) override {}
+  void SeqOutofRange(uint16_t) override {}
+  void SendRst(uint32_t) override {}
+
+  void InvalidOperation() override {}
+
+  void NewConnection() override {}
+  void Close() override {}
+  void TimeWait() override {}
+
+  std::string last_ack;
+};
+
+// In order data may wait for its ACK, a push, a segment out of order and
+// the one filling the gap are acked at once
+void TestDelayedAckTransitions() {
+  TcpControlBlock b;
+  b.state = State::kEstab;
+  b.snd_una = b.snd_nxt = 1;
+  b.snd_wnd = 1024;
+  b.rcv_nxt = 1000;
+  AckInternal internal;
+
+  auto receive = [&](uint32_t seq, bool push) {
+    TcpHeader segment;
+    segment.SetAck(true);
+    segment.SetPsh(push);
+    segment.SetSequenceNumber(seq);
+    segment.SetAcknowledgementNumber(1);
+    segment.SetTcpLength(100);
+    internal.last_ack.clear();
+    Transition(segment, b)(&internal);
+  };
+
+  receive(1000, false);
+  assert(internal.last_ack == "DelayAck");
+  receive(1100, true);
+  assert(internal.last_ack == "SendAck");
+  receive(1300, false);
+  assert(internal.last_ack == "SendAck");
+  receive(1200, false);
+  assert(internal.last_ack == "SendAck");
+  assert(b.rcv_nxt == 1400);
+  receive(1400, false);
+  assert(internal.last_ack == "DelayAck");
+}
+
+// One segment alone is acked after the delay, or at once without it
+void TestLoopbackDelayedAck(std::chrono::milliseconds delay, uint16_t port) {
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    SocketOptions socket_options;
+    socket_options.delayed_ack = delay;
+    server_socket.SetOptions(socket_options);
+    auto client_socket = client->NewSocket();
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+    auto server_connection = server_socket.Accept();
+    assert(server_connection.GetOptions().delayed_ack == delay);
+    // Accept returns on the SYN, lets the handshake finish
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const auto before = client->GetReceiveStatistics().datagrams;
+    client_socket.Send("Delayed", 7);
+    char buff[8] = {0};
+    server_connection.Recv(buff, 7);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const auto early = client->GetReceiveStatistics().datagrams;
+    std::this_thread::sleep_for(delay + std::chrono::milliseconds(100));
+    const auto late = client->GetReceiveStatistics().datagrams;
+
+    assert(early - before == (delay.count() ? 0 : 1));
+    assert(late - before == 1);
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_delayed_ack() {
+  TestDelayedAckTransitions();
+  TestLoopbackDelayedAck(std::chrono::milliseconds(100), 15508);
+  TestLoopbackDelayedAck(std::chrono::milliseconds(0), 15510);
+  std::clog << __func__ << " Passed" << std::endl;
+}
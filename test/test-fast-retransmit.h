@@ -0,0 +1,73 @@
+#include <cassert>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "network-service.h"
+
+using namespace tcp_stack;
+
+// One packet in kLoss is lost both ways, and the retransmission timeout is
+// kept long. Duplicate ACKs tell of most losses, with or without SACK,
+// well before the timer would.
+void TestLoopbackFastRetransmit(bool selective_ack, uint16_t port) {
+  constexpr size_t kSize = 512 * 1024;
+  constexpr uint32_t kLoss = 100;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    SocketOptions socket_options;
+    socket_options.selective_ack = selective_ack;
+    socket_options.min_rto = std::chrono::seconds(1);
+    server_socket.SetOptions(socket_options);
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+    auto server_connection = server_socket.Accept();
+    // Accept returns on the SYN, lets the handshake finish
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::mt19937 random(23);
+    std::string stream(kSize, '\0');
+    for (auto &c : stream)
+      c = static_cast<char>(random());
+
+    options.loopback->SetLoss(kLoss);
+    const auto start = std::chrono::steady_clock::now();
+    std::thread sender([&]() {
+          client_socket.Send(stream.data(), stream.size());
+        });
+    std::string received(kSize, '\0');
+    server_connection.Recv(received.data(), kSize);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+    options.loopback->SetLoss(0);
+
+    assert(received == stream);
+    const auto statistics = client_socket.GetRttStatistics();
+    assert(statistics.fast_retransmits > 0);
+    // The timer alone would take a second for each of the losses
+    assert(options.loopback->GetDropped() >= 4);
+    assert(elapsed < std::chrono::seconds(3));
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_fast_retransmit() {
+  TestLoopbackFastRetransmit(true, 15534);
+  TestLoopbackFastRetransmit(false, 15536);
+  std::clog << __func__ << " Passed" << std::endl;
+}
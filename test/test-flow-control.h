@@ -0,0 +1,153 @@
+#include <cassert>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "network-service.h"
+#include "state.h"
+
+using namespace tcp_stack;
+
+// Records the ACKs, and what was discarded
+class WindowInternal final : public SocketInternalInterface {
+public:
+  void SendSyn(uint32_t, uint16_t) override {}
+  void SendSynAck(uint32_t, uint32_t, uint16_t) override {}
+  void SendAck(uint32_t, uint32_t ack, uint16_t window) override {
+    last_ack = ack;
+    last_window = window;
+    ++acks;
+  }
+  void DelayAck(uint32_t seq, uint32_t ack, uint16_t window) override {
+    SendAck(seq, ack, window);
+  }
+  void SendFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void RecvSyn(uint32_t, uint16_t) override {}
+  void RecvAck(uint32_t, uint32_t, uint16_t) override {}
+  void RecvFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void Listen() override {}
+  void Connected() override {}
+
+  void Accept() override {}
+  void Discard() override {
+    ++discarded;
+  }
+  void Hold(uint32_t) override {}
+  void Reassemble(uint32_t, uint32_t) override {}
+  void SeqOutofRange(uint16_t) override {}
+  void SendRst(uint32_t) override {}
+
+  void InvalidOperation() override {}
+
+  void NewConnection() override {}
+  void Close() override {}
+  void TimeWait() override {}
+
+  uint32_t last_ack = 0;
+  uint16_t last_window = 0;
+  size_t acks = 0;
+  size_t discarded = 0;
+};
+
+// The window shrinks by what arrives, and what does not fit, or was had
+// already, is acked with the window instead
+void TestReceiveWindow() {
+  TcpControlBlock b;
+  b.state = State::kEstab;
+  b.snd_una = b.snd_nxt = 1;
+  b.snd_wnd = 1000;
+  b.rcv_nxt = 5000;
+  WindowInternal internal;
+
+  auto receive = [&](uint32_t seq, uint16_t length) {
+    TcpHeader segment;
+    segment.SetAck(true);
+    segment.SetSequenceNumber(seq);
+    segment.SetAcknowledgementNumber(1);
+    segment.SetTcpLength(length);
+    if (Predict(segment, b) == Prediction::kMiss)
+      Transition(segment, b)(&internal);
+  };
+
+  receive(5000, 600);
+  assert(b.rcv_nxt == 5600 && b.snd_wnd == 400);
+  receive(5600, 500);
+  assert(b.rcv_nxt == 5600 && b.snd_wnd == 400);
+  assert(internal.discarded == 1);
+  assert(internal.last_ack == 5600 && internal.last_window == 400);
+
+  // Out of order past the window
+  receive(5700, 400);
+  assert(internal.discarded == 2 && b.out_of_order.Empty());
+  receive(5600, 400);
+  assert(b.rcv_nxt == 6000 && b.snd_wnd == 0);
+
+  // A probe of the closed window
+  const auto acks = internal.acks;
+  receive(5999, 0);
+  assert(internal.acks == acks + 1);
+  assert(internal.last_ack == 6000 && internal.last_window == 0);
+}
+
+// A reader which does not keep up holds at most its receive buffer, and
+// the sender, blocked on a closed window, resumes as it reads
+void TestLoopbackSlowReader(uint16_t port) {
+  constexpr size_t kSize = 256 * 1024;
+  constexpr uint32_t kBuffer = 8 * 1024;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    SocketOptions socket_options;
+    socket_options.receive_buffer = kBuffer;
+    server_socket.SetOptions(socket_options);
+    auto client_socket = client->NewSocket();
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    std::mt19937 random(13);
+    std::string stream(kSize, '\0');
+    for (auto &c : stream)
+      c = static_cast<char>(random());
+    std::thread sender([&]() {
+          client_socket.Send(stream.data(), stream.size());
+        });
+
+    auto server_connection = server_socket.Accept();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    assert(server_connection.Available() <= kBuffer);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::string received(kSize, '\0');
+    for (size_t i=0; i<kSize; i+=kBuffer / 4) {
+      server_connection.Recv(received.data() + i, kBuffer / 4);
+      assert(server_connection.Available() <= kBuffer);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+
+    assert(received == stream);
+    // Far less than the persist timer probing the window every 200 ms
+    assert(elapsed < std::chrono::seconds(3));
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_flow_control() {
+  TestReceiveWindow();
+  TestLoopbackSlowReader(15524);
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,158 @@
+#include <cassert>
+#include <cstring>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "loopback-transport.h"
+#include "network-service.h"
+
+using namespace tcp_stack;
+
+void TestLoopbackChannel() {
+  LoopbackChannel channel(4);
+
+  for (uint16_t i=0; i<4; ++i) {
+    auto packet = MakeTcpPacket(0);
+    packet->GetHeader().SetSourcePort(i);
+    assert(channel.Push(packet));
+    assert(!packet);
+  }
+  auto packet = MakeTcpPacket(0);
+  assert(!channel.Push(packet));
+  assert(packet);
+
+  PacketBatch packets;
+  assert(channel.Pop(packets, 3) == 3);
+  assert(channel.Pop(packets, 3) == 1);
+  assert(channel.Pop(packets, 3) == 0);
+  for (uint16_t i=0; i<4; ++i)
+    assert(packets[i]->GetHeader().SourcePort() == i);
+
+  // Wraps around
+  assert(channel.Push(packet));
+  channel.Wait(std::chrono::milliseconds(1000));
+  assert(channel.Pop(packets, 4) == 1);
+}
+
+// A data segment the sender keeps for a resend reaches the peer as the same
+// packet, payload slices and all
+void TestLoopbackHandover() {
+  LoopbackNetwork network;
+  sockaddr_in host_addr{AF_INET, htons(15504)};
+  sockaddr_in peer_addr{AF_INET, htons(15505)};
+  LoopbackTransport sender(network, host_addr, peer_addr, 8,
+                           std::chrono::microseconds(0));
+  LoopbackTransport receiver(network, peer_addr, host_addr, 8,
+                             std::chrono::microseconds(0));
+
+  auto chunk = SendChunk::New();
+  chunk->Append("Abcdefghij", 10);
+  auto packet = MakeSegmentPacket(2);
+  packet->AddSlice(chunk, chunk->Data(), 4);
+  packet->AddSlice(chunk, chunk->Data() + 4, 6);
+  auto kept = packet.Share();
+
+  PacketBatch packets;
+  packets.push_back(std::move(packet));
+  sender.Send(packets);
+  PacketBatch received;
+  receiver.Receive(0, std::chrono::milliseconds(1000), received);
+  assert(received.size() == 1);
+  assert(received[0].get() == kept.get());
+
+  std::string payload;
+  received[0]->ForEachPayloadSpan([&payload](const char *data, size_t size) {
+        payload.append(data, size);
+      });
+  assert(payload == "Abcdefghij");
+}
+
+void TestLoopbackConnection() {
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", 15500, "127.0.0.1", 15501, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", 15501, "127.0.0.1", 15500, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    client_socket.Send("Abcdefghijklmno", 15);
+    client_socket.Send("pqrstuvwxyz", 11);
+
+    char buff[27] = {0};
+    auto server_connection = server_socket.Accept();
+    server_connection.Recv(buff, 10);
+    assert(!strcmp(buff, "Abcdefghij"));
+
+    server_connection.Recv(buff, 16);
+    assert(!strcmp(buff, "klmnopqrstuvwxyz"));
+  }
+
+  assert(server->GetReceiveStatistics().datagrams > 0);
+  assert(client->GetReceiveStatistics().datagrams > 0);
+  server->Terminate();
+  client->Terminate();
+}
+
+// Once established, a one way transfer is all data on one side and pure
+// ACKs on the other, both predicted.
+void TestLoopbackHeaderPrediction() {
+  constexpr size_t kMessages = 8;
+  constexpr size_t kSize = 200;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", 15502, "127.0.0.1", 15503, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", 15503, "127.0.0.1", 15502, options);
+
+  auto server_socket = server->NewSocket();
+  auto client_socket = client->NewSocket();
+  server_socket.Listen(10);
+  client_socket.Connect("127.0.0.1", 10);
+  auto server_connection = server_socket.Accept();
+  // Accept returns on the SYN, lets the handshake finish
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  const auto server_before = server->GetHeaderPredictionStatistics();
+  const auto client_before = client->GetHeaderPredictionStatistics();
+  char message[kSize] = {0};
+  for (size_t i=0; i<kMessages; ++i) {
+    message[0] = static_cast<char>(i);
+    client_socket.Send(message, kSize);
+    char buff[kSize];
+    server_connection.Recv(buff, kSize);
+    assert(buff[0] == static_cast<char>(i));
+  }
+  // The last ACK may still be on its way
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  const auto server_after = server->GetHeaderPredictionStatistics();
+  const auto client_after = client->GetHeaderPredictionStatistics();
+  assert(server_after.hits - server_before.hits == kMessages);
+  assert(server_after.misses == server_before.misses);
+  assert(client_after.hits - client_before.hits == kMessages);
+  assert(client_after.misses == client_before.misses);
+
+  server_connection.Close();
+  client_socket.Close();
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_loopback_transport() {
+  TestLoopbackChannel();
+  TestLoopbackHandover();
+  TestLoopbackConnection();
+  TestLoopbackHeaderPrediction();
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,151 @@
+#include <cassert>
+#include <cstring>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "network-service.h"
+
+using namespace tcp_stack;
+
+enum class SmallWrites {
+  kNagle = 0,
+  kNoDelay,
+  kCork
+};
+
+// Three small Sends, counted as the data segments the server receives.
+// Nagle sends the first and holds the others for its ACK, no delay sends
+// each at once, and a corked socket sends them together on Uncork.
+void TestLoopbackSmallWrites(SmallWrites mode, uint16_t port) {
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    SocketOptions socket_options;
+    socket_options.no_delay = mode == SmallWrites::kNoDelay;
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+    auto server_connection = server_socket.Accept();
+    // Accept returns on the SYN, lets the handshake finish
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const auto before = server->GetReceiveStatistics().datagrams;
+    if (mode == SmallWrites::kCork)
+      client_socket.Cork();
+    client_socket.Send("Sm", 2);
+    client_socket.Send("al", 2);
+    client_socket.Send("l!", 2);
+    if (mode == SmallWrites::kCork) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      assert(server->GetReceiveStatistics().datagrams == before);
+      client_socket.Uncork();
+    }
+
+    char buff[7] = {0};
+    server_connection.Recv(buff, 6);
+    assert(!strcmp(buff, "Small!"));
+    const auto segments = server->GetReceiveStatistics().datagrams - before;
+    switch (mode) {
+    case SmallWrites::kNagle:
+      assert(segments == 2);
+      break;
+    case SmallWrites::kNoDelay:
+      assert(segments == 3);
+      break;
+    case SmallWrites::kCork:
+      assert(segments == 1);
+      break;
+    }
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+// More than the peer's window of small writes waits for ACKs instead of
+// overrunning the window
+void TestLoopbackWindowLimit(uint16_t port) {
+  constexpr size_t kSize = 3000;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    SocketOptions socket_options;
+    socket_options.receive_buffer = 1024;
+    server_socket.SetOptions(socket_options);
+    socket_options.no_delay = true;
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    std::string stream;
+    for (size_t i=0; i<kSize; ++i)
+      stream.push_back(static_cast<char>('a' + i % 26));
+    for (size_t i=0; i<kSize; i+=100)
+      client_socket.Send(stream.data() + i, 100);
+
+    auto server_connection = server_socket.Accept();
+    std::string received(kSize, '\0');
+    server_connection.Recv(received.data(), kSize);
+    assert(received == stream);
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+// The server closes first, the client still sends in CLOSE-WAIT
+void TestLoopbackSendAfterFin(uint16_t port) {
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+    auto server_connection = server_socket.Accept();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    server_connection.Close();
+    // Lets the FIN arrive
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const auto before = server->GetReceiveStatistics().datagrams;
+    client_socket.Send("late", 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(server->GetReceiveStatistics().datagrams > before);
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_nagle() {
+  TestLoopbackSmallWrites(SmallWrites::kNagle, 15512);
+  TestLoopbackSmallWrites(SmallWrites::kNoDelay, 15514);
+  TestLoopbackSmallWrites(SmallWrites::kCork, 15516);
+  TestLoopbackWindowLimit(15518);
+  TestLoopbackSendAfterFin(15538);
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,65 @@
+#include <cassert>
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "packet-pool.h"
+#include "tcp-header.h"
+
+using namespace tcp_stack;
+
+void TestPacketPoolReuse() {
+  auto &pool = PacketPool::Instance();
+
+  // Warms up the size classes, a packet is one block
+  for (int i=0; i<4; ++i) {
+    std::vector<PacketPtr> packets;
+    for (int j=0; j<256; ++j)
+      packets.push_back(MakeTcpPacket(1000));
+  }
+
+  const auto before = pool.GetStatistics();
+  for (int i=0; i<1000; ++i) {
+    auto packet = MakeTcpPacket(1000);
+    auto ack = MakeTcpPacket(0);
+  }
+  const auto after = pool.GetStatistics();
+  assert(after.misses == before.misses);
+  assert(after.hits >= before.hits + 2000);
+}
+
+void TestPacketPoolCrossThread() {
+  // Allocated on one thread, freed on another
+  std::vector<PacketPtr> packets;
+  for (int i=0; i<1000; ++i)
+    packets.push_back(MakeTcpPacket(i));
+
+  std::thread th([packets = std::move(packets)]() mutable {
+        for (size_t i=0; i<packets.size(); ++i)
+          assert(packets[i]->end() - packets[i]->begin() ==
+                 static_cast<ptrdiff_t>(i));
+        packets.clear();
+      });
+  th.join();
+
+  const auto before = PacketPool::Instance().GetStatistics();
+  for (int i=0; i<100; ++i)
+    packets.push_back(MakeTcpPacket(i));
+  assert(PacketPool::Instance().GetStatistics().misses == before.misses);
+}
+
+void TestPacketPoolOversized() {
+  auto packet = MakeTcpPacket(PacketPool::kMaxBlockSize);
+  std::fill(packet->begin(), packet->end(), 'x');
+  assert(packet->end() - packet->begin() ==
+         static_cast<ptrdiff_t>(PacketPool::kMaxBlockSize));
+}
+
+void test_packet_pool() {
+  TestPacketPoolReuse();
+  TestPacketPoolCrossThread();
+  TestPacketPoolOversized();
+  std::clog << __func__ << " Passed" << std::endl;
+}
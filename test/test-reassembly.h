@@ -0,0 +1,292 @@
+#include <cassert>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "reassembly-queue.h"
+#include "state.h"
+
+using namespace tcp_stack;
+
+void TestSequenceRanges() {
+  SequenceRanges ranges;
+  assert(ranges.Add(100, 200));
+  assert(ranges.Add(300, 400));
+  assert(ranges.Add(500, 600));
+  assert(ranges.Size() == 3);
+
+  // Touching and overlapping ranges merge
+  assert(ranges.Add(200, 250));
+  assert(ranges.Add(350, 550));
+  assert(ranges.Size() == 2);
+  assert(ranges.begin()[0].begin == 100 && ranges.begin()[0].end == 250);
+  assert(ranges.begin()[1].begin == 300 && ranges.begin()[1].end == 600);
+
+  // Full, a new hole is refused but merging still works
+  for (uint32_t i=0; ranges.Size() < SequenceRanges::kCapacity; ++i)
+    assert(ranges.Add(1000 + 100 * i, 1050 + 100 * i));
+  assert(!ranges.Add(50, 60));
+  assert(ranges.Add(250, 300));
+  assert(ranges.Add(50, 60));
+
+  assert(ranges.Advance(40) == 40);
+  assert(ranges.Advance(50) == 60);
+  assert(ranges.Advance(100) == 600);
+  assert(ranges.Size() == SequenceRanges::kCapacity - 2);
+
+  // Across the wrap
+  SequenceRanges wrapped;
+  assert(wrapped.Add(0xfffffff0, 0x10));
+  assert(wrapped.Add(0x20, 0x30));
+  assert(wrapped.Add(0xffffffe0, 0xfffffff0));
+  assert(wrapped.Size() == 2);
+  assert(wrapped.Advance(0xffffffe0) == 0x10);
+  assert(wrapped.Advance(0x20) == 0x30);
+  assert(wrapped.Empty());
+}
+
+void TestReassemblyBuffer() {
+  ReassemblyBuffer buffer;
+  assert(buffer.Capacity() == ReassemblyBuffer::kDefaultCapacity);
+  const std::string data = "0123456789";
+  const uint32_t seq = ReassemblyBuffer::kDefaultCapacity * 3 - 4;
+  buffer.Store(seq, data.data(), data.data() + data.size());
+
+  std::string loaded;
+  buffer.Load(seq + 1, seq + 9, [&loaded](const char *data, size_t size) {
+        loaded.append(data, size);
+      });
+  assert(loaded == "12345678");
+
+  // Sized to a window, and across the wrap of the sequence numbers
+  buffer.Resize(200 * 1024);
+  assert(buffer.Capacity() == 256 * 1024);
+  buffer.Store(0 - 4, data.data(), data.data() + data.size());
+  loaded.clear();
+  buffer.Load(0 - 3, 5, [&loaded](const char *data, size_t size) {
+        loaded.append(data, size);
+      });
+  assert(loaded == "12345678");
+}
+
+// Plays the socket, segments are taken from the stream by sequence number
+class ReorderInternal final : public SocketInternalInterface {
+public:
+  ReorderInternal(const std::string &stream, uint32_t base,
+                  size_t window = ReassemblyBuffer::kDefaultCapacity)
+      : stream_(stream), base_(base), reassembly_(window) {}
+
+  void SendSyn(uint32_t, uint16_t) override {}
+  void SendSynAck(uint32_t, uint32_t, uint16_t) override {}
+  void SendAck(uint32_t, uint32_t ack, uint16_t) override {
+    acks.push_back(ack);
+  }
+  void DelayAck(uint32_t, uint32_t ack, uint16_t) override {
+    acks.push_back(ack);
+  }
+  void SendFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void RecvSyn(uint32_t, uint16_t) override {}
+  void RecvAck(uint32_t, uint32_t, uint16_t) override {}
+  void RecvFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void Listen() override {}
+  void Connected() override {}
+
+  void Accept() override {
+    received += Payload();
+  }
+  void Discard() override {
+    ++discarded;
+  }
+  void Hold(uint32_t seq) override {
+    const auto payload = Payload();
+    const auto skip = seq - current->SequenceNumber();
+    reassembly_.Store(seq, payload.data() + skip,
+                      payload.data() + payload.size());
+  }
+  void Reassemble(uint32_t seq, uint32_t end) override {
+    reassembly_.Load(seq, end, [this](const char *data, size_t size) {
+          received.append(data, size);
+        });
+  }
+  void SeqOutofRange(uint16_t) override {}
+  void SendRst(uint32_t) override {}
+
+  void InvalidOperation() override {}
+
+  void NewConnection() override {}
+  void Close() override {}
+  void TimeWait() override {}
+
+  const TcpHeader *current = nullptr;
+  std::string received;
+  std::vector<uint32_t> acks;
+  size_t discarded = 0;
+
+private:
+  std::string Payload() const {
+    return stream_.substr(current->SequenceNumber() - base_,
+                          current->TcpLength());
+  }
+
+  const std::string &stream_;
+  const uint32_t base_;
+  ReassemblyBuffer reassembly_;
+};
+
+// Segments of a stream arrive shuffled within windows, some twice and some
+// overlapping their neighbours, with the sequence numbers wrapping halfway.
+// The receiver acks every out of order one with rcv_nxt, and the stream
+// comes out whole without any retransmission.
+void TestReorderedStream() {
+  constexpr size_t kSegments = 2000;
+  constexpr size_t kWindow = 8;
+  std::mt19937 random(7);
+
+  std::string stream;
+  std::vector<std::pair<uint32_t, uint16_t>> segments;
+  for (size_t i=0; i<kSegments; ++i) {
+    const uint16_t length = 1 + random() % 1000;
+    segments.emplace_back(stream.size(), length);
+    for (size_t j=0; j<length; ++j)
+      stream.push_back(static_cast<char>(random()));
+  }
+  // A few overlap the next one
+  for (size_t i=0; i+1<kSegments; i+=7)
+    segments[i].second += std::min<uint16_t>(segments[i + 1].second, 100);
+
+  const uint32_t base = 0 - static_cast<uint32_t>(stream.size() / 2);
+  TcpControlBlock b;
+  b.state = State::kEstab;
+  b.snd_una = b.snd_nxt = 1;
+  b.snd_wnd = ReassemblyBuffer::kDefaultCapacity;
+  b.rcv_nxt = base;
+  ReorderInternal internal(stream, base);
+
+  auto order = segments;
+  for (size_t i=0; i<kSegments; i+=kWindow) {
+    const auto last = order.begin() + std::min(i + kWindow, kSegments);
+    std::shuffle(order.begin() + i, last, random);
+  }
+  for (size_t i=0; i<kSegments; i+=13) {
+    const auto again = order[i];
+    order.insert(order.begin() + i, again);
+  }
+
+  size_t duplicate_acks = 0;
+  for (auto [offset, length] : order) {
+    TcpHeader segment;
+    segment.SetAck(true);
+    segment.SetSequenceNumber(base + offset);
+    segment.SetAcknowledgementNumber(b.snd_nxt);
+    segment.SetTcpLength(length);
+    internal.current = &segment;
+
+    const auto rcv_nxt = b.rcv_nxt;
+    const auto acks = internal.acks.size();
+    Transition(segment, b)(&internal);
+    // The reader keeps up
+    b.snd_wnd = ReassemblyBuffer::kDefaultCapacity;
+    assert(b.state == State::kEstab);
+    if (internal.acks.size() > acks) {
+      assert(internal.acks.back() == b.rcv_nxt);
+      duplicate_acks += b.rcv_nxt == rcv_nxt;
+    }
+    assert(internal.received.size() == b.rcv_nxt - base);
+  }
+
+  assert(b.out_of_order.Empty());
+  assert(b.rcv_nxt == static_cast<uint32_t>(base + stream.size()));
+  assert(internal.received == stream);
+  assert(duplicate_acks > 0);
+}
+
+// More holes than the control block tracks, the segment which would open
+// one more is dropped and comes again later
+void TestReassemblyBound() {
+  const std::string stream(100 * (SequenceRanges::kCapacity + 2), 'r');
+  TcpControlBlock b;
+  b.state = State::kEstab;
+  b.snd_una = b.snd_nxt = 1;
+  b.snd_wnd = ReassemblyBuffer::kDefaultCapacity;
+  b.rcv_nxt = 1000;
+  ReorderInternal internal(stream, b.rcv_nxt);
+
+  auto receive = [&](uint32_t offset) {
+    TcpHeader segment;
+    segment.SetAck(true);
+    segment.SetSequenceNumber(1000 + offset);
+    segment.SetAcknowledgementNumber(1);
+    segment.SetTcpLength(50);
+    internal.current = &segment;
+    Transition(segment, b)(&internal);
+    b.snd_wnd = ReassemblyBuffer::kDefaultCapacity;
+  };
+  for (uint32_t i=1; i<=SequenceRanges::kCapacity + 1; ++i)
+    receive(100 * i);
+  assert(internal.discarded == 1);
+  assert(b.out_of_order.Size() == SequenceRanges::kCapacity);
+
+  // Past the right edge of the window
+  receive(b.snd_wnd);
+  assert(internal.discarded == 2);
+
+  receive(0);
+  assert(b.rcv_nxt == 1050);
+  for (uint32_t i=0; i<SequenceRanges::kCapacity; ++i)
+    receive(100 * i + 50);
+  assert(b.rcv_nxt == 1000 + 100 * SequenceRanges::kCapacity + 50);
+  receive(100 * SequenceRanges::kCapacity + 50);
+  receive(100 * SequenceRanges::kCapacity + 100);
+  assert(b.out_of_order.Empty());
+  assert(b.rcv_nxt == 1000 + 100 * SequenceRanges::kCapacity + 150);
+  assert(internal.received == stream.substr(0, b.rcv_nxt - 1000));
+}
+
+// A window wider than 64 KiB is held whole past a gap
+void TestReassemblyWideWindow() {
+  constexpr uint32_t kWindow = 256 * 1024;
+  constexpr uint32_t kLength = 1024;
+  const std::string stream(kWindow, 'w');
+  TcpControlBlock b;
+  b.state = State::kEstab;
+  b.snd_una = b.snd_nxt = 1;
+  b.snd_wnd = kWindow;
+  b.rcv_nxt = 1000;
+  ReorderInternal internal(stream, b.rcv_nxt, kWindow);
+
+  auto receive = [&](uint32_t offset) {
+    TcpHeader segment;
+    segment.SetAck(true);
+    segment.SetSequenceNumber(1000 + offset);
+    segment.SetAcknowledgementNumber(1);
+    segment.SetTcpLength(kLength);
+    internal.current = &segment;
+    Transition(segment, b)(&internal);
+    b.snd_wnd = kWindow;
+  };
+  receive(kWindow - kLength);
+  receive(kWindow / 2);
+  assert(internal.discarded == 0);
+  assert(b.out_of_order.Size() == 2);
+  receive(kWindow);
+  assert(internal.discarded == 1);
+
+  for (uint32_t offset=0; offset<kWindow; offset+=kLength)
+    receive(offset);
+  assert(b.out_of_order.Empty());
+  assert(internal.received.size() == stream.size());
+}
+
+void test_reassembly() {
+  TestSequenceRanges();
+  TestReassemblyBuffer();
+  TestReorderedStream();
+  TestReassemblyBound();
+  TestReassemblyWideWindow();
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,118 @@
+#include <cassert>
+#include <cstring>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "network-service.h"
+#include "rtt-estimator.h"
+
+using namespace tcp_stack;
+
+void TestRttEstimator() {
+  using std::chrono::milliseconds;
+  using std::chrono::seconds;
+  RttEstimator rtt(milliseconds(200), seconds(60));
+  assert(rtt.Rto() == seconds(1));
+
+  // RFC 6298 2.2 and 2.3
+  rtt.Sample(milliseconds(100));
+  assert(rtt.GetStatistics().srtt == milliseconds(100));
+  assert(rtt.GetStatistics().rttvar == milliseconds(50));
+  assert(rtt.Rto() == milliseconds(300));
+  rtt.Sample(milliseconds(200));
+  assert(rtt.GetStatistics().srtt == std::chrono::microseconds(112500));
+  assert(rtt.GetStatistics().rttvar == std::chrono::microseconds(62500));
+  assert(rtt.Rto() == std::chrono::microseconds(362500));
+
+  // A steady short round trip is clamped
+  for (int i=0; i<100; ++i)
+    rtt.Sample(milliseconds(1));
+  assert(rtt.Rto() == milliseconds(200));
+
+  rtt.Backoff();
+  rtt.Backoff();
+  assert(rtt.Rto() == milliseconds(800));
+  for (int i=0; i<20; ++i)
+    rtt.Backoff();
+  assert(rtt.Rto() == seconds(60));
+  assert(rtt.GetStatistics().timeouts == 22);
+
+  // Until the next sample
+  rtt.Sample(milliseconds(1));
+  assert(rtt.Rto() == milliseconds(200));
+  assert(rtt.GetStatistics().backoffs == 0);
+}
+
+// Messages of one segment each way, one packet in kLoss lost. No later
+// segment tells of a loss, the timer does, after the short timeout the
+// measured round trip allows rather than seconds later.
+void TestLoopbackLossRecovery(uint16_t port) {
+  constexpr size_t kRounds = 400;
+  constexpr size_t kSize = 100;
+  constexpr uint32_t kLoss = 50;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    SocketOptions socket_options;
+    socket_options.min_rto = std::chrono::milliseconds(50);
+    server_socket.SetOptions(socket_options);
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+    auto server_connection = server_socket.Accept();
+
+    char message[kSize] = {0};
+    char reply[kSize] = {0};
+    auto exchange = [&]() {
+      client_socket.Send(message, kSize);
+      server_connection.Recv(reply, kSize);
+      assert(!std::memcmp(message, reply, kSize));
+      server_connection.Send(reply, kSize);
+      client_socket.Recv(message, kSize);
+    };
+
+    // The first round trips are measured without loss, or the resends
+    // would wait out the initial timeout of a second
+    exchange();
+    exchange();
+    assert(client_socket.GetRttStatistics().samples > 0);
+    assert(server_connection.GetRttStatistics().samples > 0);
+
+    options.loopback->SetLoss(kLoss);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<kRounds; ++i) {
+      message[i % kSize] = static_cast<char>(i);
+      exchange();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    options.loopback->SetLoss(0);
+
+    assert(options.loopback->GetDropped() >= kRounds * 2 / kLoss);
+    const auto client_statistics = client_socket.GetRttStatistics();
+    const auto server_statistics = server_connection.GetRttStatistics();
+    assert(client_statistics.timeouts + server_statistics.timeouts > 0);
+    assert(client_statistics.srtt < std::chrono::milliseconds(50));
+    assert(client_statistics.rto >= std::chrono::milliseconds(50));
+    // A fixed 5 second timeout would take that long for each loss
+    assert(elapsed < std::chrono::seconds(4));
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_rto() {
+  TestRttEstimator();
+  TestLoopbackLossRecovery(15532);
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,126 @@
+#include <cassert>
+#include <cstring>
+
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "network-service.h"
+#include "tcp-options.h"
+
+using namespace tcp_stack;
+
+void TestSackOptions() {
+  TcpOptions syn_options;
+  syn_options.AddSackPermitted();
+  auto syn = MakeOptionPacket(syn_options.Data(), syn_options.Size());
+  assert(syn->GetHeader().DataOffset() == 6);
+  assert(syn->OptionsSize() == 4);
+  assert(syn->begin() == syn->end());
+  assert(HasSackPermitted(*syn));
+  assert(!HasSackPermitted(*MakeTcpPacket(0)));
+
+  // One range more than fits
+  SequenceRanges ranges;
+  for (uint32_t i=0; i<=TcpOptions::kMaxSackBlocks; ++i)
+    assert(ranges.Add(0xfffffc00 + 0x200 * i, 0xfffffd00 + 0x200 * i));
+  TcpOptions ack_options;
+  ack_options.AddSack(ranges);
+  assert(ack_options.Size() == 4 + 8 * TcpOptions::kMaxSackBlocks);
+  auto ack = MakeOptionPacket(ack_options.Data(), ack_options.Size());
+  assert(!HasSackPermitted(*ack));
+  std::vector<std::pair<uint32_t, uint32_t>> blocks;
+  ForEachSackBlock(*ack, [&blocks](uint32_t begin, uint32_t end) {
+        blocks.emplace_back(begin, end);
+      });
+  assert(blocks.size() == TcpOptions::kMaxSackBlocks);
+  for (size_t i=0; i<blocks.size(); ++i) {
+    assert(blocks[i].first == ranges.begin()[i].begin);
+    assert(blocks[i].second == ranges.begin()[i].end);
+  }
+  assert(ranges.Covers(0xfffffc10, 0xfffffd00));
+  assert(!ranges.Covers(0xfffffc10, 0xfffffe10));
+}
+
+// The payload of a received packet starts after its options, whatever they
+// are, and a bad data offset or option length stays within the packet
+void TestReceivedOptions() {
+  const char options[] = {1, 1, 8, 10, 0, 0, 0, 0, 0, 0, 0, 0};
+  const char payload[] = "payload";
+
+  TcpHeader header;
+  header.SetDataOffset(5 + sizeof(options) / 4);
+  header.SetTcpLength(sizeof(payload));
+  char bytes[sizeof(header) + sizeof(options) + sizeof(payload)];
+  std::memcpy(bytes, &header, sizeof(header));
+  std::memcpy(bytes + sizeof(header), options, sizeof(options));
+  std::memcpy(bytes + sizeof(header) + sizeof(options), payload,
+              sizeof(payload));
+
+  auto packet = MakeNetPacket(bytes, sizeof(bytes));
+  assert(packet->OptionsSize() == sizeof(options));
+  assert(!std::strcmp(packet->begin(), payload));
+  size_t count = 0;
+  ForEachOption(packet->Options(), packet->OptionsSize(),
+                [&count](uint8_t kind, const char *, size_t length) {
+        assert(kind == 8 && length == 8);
+        ++count;
+      });
+  assert(count == 1);
+
+  // An option running past the others
+  char truncated[sizeof(header) + 4];
+  header.SetDataOffset(6);
+  std::memcpy(truncated, &header, sizeof(header));
+  const char sack[] = {5, 10, 0, 0};
+  std::memcpy(truncated + sizeof(header), sack, sizeof(sack));
+  auto bad = MakeNetPacket(truncated, sizeof(truncated));
+  ForEachSackBlock(*bad, [](uint32_t, uint32_t) { assert(false); });
+
+  header.SetDataOffset(15);
+  std::memcpy(truncated, &header, sizeof(header));
+  bad = MakeNetPacket(truncated, sizeof(truncated));
+  assert(bad->OptionsSize() == 4);
+  assert(bad->begin() == bad->end());
+}
+
+// Options go through the handshake of both a SACK and a plain connection,
+// and data flows as before either way
+void TestLoopbackSackNegotiation(bool server_sack, uint16_t port) {
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    SocketOptions socket_options;
+    socket_options.selective_ack = server_sack;
+    server_socket.SetOptions(socket_options);
+    auto client_socket = client->NewSocket();
+    assert(client_socket.GetOptions().selective_ack);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    client_socket.Send("Selective", 9);
+    auto server_connection = server_socket.Accept();
+    assert(server_connection.GetOptions().selective_ack == server_sack);
+    char buff[10] = {0};
+    server_connection.Recv(buff, 9);
+    assert(!strcmp(buff, "Selective"));
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_sack() {
+  TestSackOptions();
+  TestReceivedOptions();
+  TestLoopbackSackNegotiation(true, 15504);
+  TestLoopbackSackNegotiation(false, 15506);
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,65 @@
+#include <cassert>
+
+#include <iostream>
+#include <string>
+
+#include "tcp-buffer.h"
+
+using namespace tcp_stack;
+
+void TestSendBufferSlices() {
+  TcpSendingBuffer buffer;
+  buffer.InitializeAckNumber(1);
+
+  std::string data;
+  for (size_t i=0; i<3*SendChunk::Capacity(); ++i)
+    data.push_back('a' + i % 26);
+  buffer.Push(data.data(), 100);
+  buffer.Push(data.data() + 100, data.size() - 100);
+
+  // Straddles the first chunk boundary
+  buffer.GetAsTcpPacket(0, SendChunk::Capacity() - 10);
+  auto packet = buffer.GetAsTcpPacket(0, 20);
+  assert(packet->SpanCount() == 3);
+  assert(packet->Size() == sizeof(TcpHeader) + 20);
+  assert(packet->GetHeader().TcpLength() == 20);
+
+  auto copy = MakeNetPacket(*packet);
+  assert(!copy->Sliced());
+  assert(std::string(copy->begin(), copy->end()) ==
+         data.substr(SendChunk::Capacity() - 10, 20));
+  assert(CalculateChecksum(*copy) == CalculateChecksum(*packet));
+
+  // Acked bytes leave the buffer, the packet keeps its chunks
+  buffer.Ack(1 + SendChunk::Capacity() + 10);
+  assert(buffer.Size() == data.size() - SendChunk::Capacity() - 10);
+  auto again = MakeNetPacket(*packet);
+  assert(std::string(again->begin(), again->end()) ==
+         data.substr(SendChunk::Capacity() - 10, 20));
+
+  auto rest = buffer.GetAsTcpPacket(0, data.size());
+  assert(rest->Size() == sizeof(TcpHeader) + buffer.Size());
+  assert(buffer.Empty());
+}
+
+void TestChecksumOddSpans() {
+  // The checksum of a packet does not depend on how its bytes are split
+  TcpSendingBuffer buffer;
+  buffer.InitializeAckNumber(1);
+  std::string data(2 * SendChunk::Capacity(), 'x');
+  for (size_t i=0; i<data.size(); ++i)
+    data[i] = static_cast<char>(i * 7);
+  buffer.Push(data.data(), data.size());
+
+  buffer.GetAsTcpPacket(0, SendChunk::Capacity() - 3);
+  auto packet = buffer.GetAsTcpPacket(0, 9);
+  assert(packet->SpanCount() == 3);
+  assert(CalculateChecksum(*packet) ==
+         CalculateChecksum(*MakeNetPacket(*packet)));
+}
+
+void test_send_buffer() {
+  TestSendBufferSlices();
+  TestChecksumOddSpans();
+  std::clog << __func__ << " Passed" << std::endl;
+}
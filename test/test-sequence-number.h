@@ -0,0 +1,181 @@
+#include <cassert>
+
+#include <iostream>
+#include <string>
+
+#include "sequence-number.h"
+#include "state.h"
+#include "tcp-buffer.h"
+
+using namespace tcp_stack;
+
+void TestSequenceCompare() {
+  static_assert(SeqLt(1, 2) && !SeqLt(2, 1) && !SeqLt(2, 2));
+  static_assert(SeqLt(0xffffffff, 0) && SeqGt(0, 0xffffffff));
+  static_assert(SeqLe(0xfffffff0, 0x10) && SeqGe(0x10, 0xfffffff0));
+  static_assert(SeqLt(0, 0x7fffffff) && SeqGt(0, 0x80000001));
+  static_assert(SeqMax(0xfffffff0, 0x10) == 0x10);
+  static_assert(SeqMax(0x10, 0xfffffff0) == 0x10);
+}
+
+// Records what the reacts ask for, acks go to a sending buffer as they do
+// in SocketInternal
+class WrapInternal final : public SocketInternalInterface {
+public:
+  explicit WrapInternal(TcpSendingBuffer *buffer) : buffer_(buffer) {}
+
+  void SendSyn(uint32_t, uint16_t) override {}
+  void SendSynAck(uint32_t, uint32_t, uint16_t) override {}
+  void SendAck(uint32_t, uint32_t ack, uint16_t) override {
+    last_ack = ack;
+  }
+  void DelayAck(uint32_t, uint32_t ack, uint16_t) override {
+    last_ack = ack;
+  }
+  void SendFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void RecvSyn(uint32_t, uint16_t) override {}
+  void RecvAck(uint32_t, uint32_t ack, uint16_t) override {
+    if (buffer_)
+      buffer_->Ack(ack);
+  }
+  void RecvFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void Listen() override {}
+  void Connected() override {}
+
+  void Accept() override {
+    ++accepted;
+  }
+  void Discard() override {
+    ++discarded;
+  }
+  void Hold(uint32_t) override {}
+  void Reassemble(uint32_t, uint32_t) override {}
+  void SeqOutofRange(uint16_t) override {
+    ++out_of_range;
+  }
+  void SendRst(uint32_t) override {}
+
+  void InvalidOperation() override {}
+
+  void NewConnection() override {}
+  void Close() override {}
+  void TimeWait() override {}
+
+  size_t accepted = 0;
+  size_t discarded = 0;
+  size_t out_of_range = 0;
+  uint32_t last_ack = 0;
+
+private:
+  TcpSendingBuffer *buffer_;
+};
+
+// Streams data both ways over an established connection whose sequence
+// numbers start just below 2^32, through the state machine and through
+// header prediction in turns, until both directions have wrapped.
+void TestSequenceWrapStress() {
+  constexpr size_t kRounds = 4000;
+  constexpr uint32_t kLength = 1000;
+  constexpr uint32_t kStart = 0xffffffff - 64 * kLength;
+
+  TcpControlBlock a;
+  a.state = State::kEstab;
+  a.snd_una = a.snd_nxt = kStart;
+  a.snd_wnd = 1024;
+  a.rcv_wnd = 1024;
+  a.rcv_nxt = kStart - 12345;
+
+  TcpControlBlock b = a;
+  std::swap(b.snd_una, b.rcv_nxt);
+  b.snd_nxt = b.snd_una;
+
+  TcpSendingBuffer a_buffer;
+  a_buffer.InitializeAckNumber(a.snd_una);
+  WrapInternal a_internal(&a_buffer);
+  WrapInternal b_internal(nullptr);
+
+  const std::string data(kLength, 'x');
+  size_t a_wraps = 0;
+  size_t b_wraps = 0;
+  for (size_t i=0; i<kRounds; ++i) {
+    // a sends
+    a_buffer.Push(data.data(), data.size());
+    auto packet = a_buffer.GetAsTcpPacket(0, kLength);
+    auto &header = packet->GetHeader();
+    Transition(Event::kSend, &header, a)(&a_internal);
+    assert(header.TcpLength() == kLength);
+    assert(header.SequenceNumber() + kLength == a.snd_nxt);
+    assert(a_internal.out_of_range == 0);
+    if (a.snd_nxt < header.SequenceNumber())
+      ++a_wraps;
+
+    // b receives it, and acks it with data of its own now and then
+    TcpHeader segment;
+    segment.SetAck(true);
+    segment.SetSequenceNumber(header.SequenceNumber());
+    segment.SetAcknowledgementNumber(b.snd_nxt);
+    segment.SetWindow(header.Window());
+    segment.SetTcpLength(kLength);
+    if (i % 2) {
+      assert(Predict(segment, b) == Prediction::kData);
+    } else {
+      Transition(segment, b)(&b_internal);
+      assert(b_internal.last_ack == b.rcv_nxt);
+    }
+    assert(b.state == State::kEstab);
+    assert(b.rcv_nxt == a.snd_nxt);
+    // The reader takes it
+    b.snd_wnd = 1024;
+
+    const bool b_sends = i % 4 == 1;
+    TcpHeader ack;
+    if (b_sends) {
+      ack.SetTcpLength(kLength / 2);
+      Transition(Event::kSend, &ack, b)(&b_internal);
+      assert(b_internal.out_of_range == 0);
+      if (b.snd_nxt < ack.SequenceNumber())
+        ++b_wraps;
+    } else {
+      ack.SetAck(true);
+      ack.SetSequenceNumber(b.snd_nxt);
+      ack.SetAcknowledgementNumber(b.rcv_nxt);
+      ack.SetWindow(WindowField(b));
+    }
+
+    // a takes the ack
+    if (i % 2) {
+      assert(Predict(ack, a) ==
+             (b_sends ? Prediction::kData : Prediction::kAck));
+      a_buffer.Ack(ack.AcknowledgementNumber());
+    } else {
+      Transition(ack, a)(&a_internal);
+    }
+    assert(a.state == State::kEstab);
+    assert(a.snd_una == a.snd_nxt);
+    assert(a.rcv_nxt == b.snd_nxt);
+    assert(a_buffer.Size() == 0);
+    a.snd_wnd = 1024;
+
+    // An old ACK from before the wrap moves nothing back
+    TcpHeader stale = ack;
+    stale.SetAcknowledgementNumber(a.snd_una - 3 * kLength);
+    stale.SetTcpLength(0);
+    stale.SetSequenceNumber(a.rcv_nxt);
+    assert(Predict(stale, a) == Prediction::kMiss);
+    Transition(stale, a)(&a_internal);
+    assert(a.snd_una == a.snd_nxt);
+  }
+
+  assert(a_wraps == 1);
+  assert(b_wraps == 1);
+  assert(a_internal.discarded == 0);
+  assert(b_internal.discarded == 0);
+}
+
+void test_sequence_number() {
+  TestSequenceCompare();
+  TestSequenceWrapStress();
+  std::clog << __func__ << " Passed" << std::endl;
+}
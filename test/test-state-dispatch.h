@@ -0,0 +1,149 @@
+#include <cassert>
+#include <cstddef>
+
+#include <chrono>
+#include <iostream>
+
+#include "state.h"
+
+using namespace tcp_stack;
+
+// The allocations of this thread, counted by the operator new of test.cc
+extern thread_local size_t allocation_count;
+
+class NullInternal final : public SocketInternalInterface {
+public:
+  void SendSyn(uint32_t, uint16_t) override {}
+  void SendSynAck(uint32_t, uint32_t, uint16_t) override {}
+  void SendAck(uint32_t, uint32_t ack, uint16_t) override {
+    last_ack = ack;
+  }
+  void DelayAck(uint32_t, uint32_t ack, uint16_t) override {
+    last_ack = ack;
+  }
+  void SendFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void RecvSyn(uint32_t, uint16_t) override {}
+  void RecvAck(uint32_t, uint32_t, uint16_t) override {}
+  void RecvFin(uint32_t, uint32_t, uint16_t) override {}
+
+  void Listen() override {}
+  void Connected() override {}
+
+  void Accept() override {
+    ++accepted;
+  }
+  void Discard() override {}
+  void Hold(uint32_t) override {}
+  void Reassemble(uint32_t, uint32_t) override {}
+  void SeqOutofRange(uint16_t) override {}
+  void SendRst(uint32_t) override {}
+
+  void InvalidOperation() override {}
+
+  void NewConnection() override {}
+  void Close() override {}
+  void TimeWait() override {}
+
+  size_t accepted = 0;
+  uint32_t last_ack = 0;
+};
+
+// Drives an established connection with data segments and sends, the
+// transitions which run for every packet, and reports the cost of one.
+void TestStateDispatchAllocationFree() {
+  constexpr size_t kRounds = 100000;
+  constexpr uint16_t kLength = 100;
+
+  TcpControlBlock b;
+  b.snd_una = b.snd_nxt = 1000;
+  b.snd_wnd = 1024;
+  b.rcv_nxt = 5000;
+  b.state = State::kEstab;
+  NullInternal internal;
+
+  TcpHeader segment;
+  segment.SetAck(true);
+  segment.SetWindow(1024);
+  segment.SetTcpLength(kLength);
+  TcpHeader send;
+  send.SetTcpLength(kLength);
+
+  const auto allocations = allocation_count;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i=0; i<kRounds; ++i) {
+    segment.SetSequenceNumber(b.rcv_nxt);
+    segment.SetAcknowledgementNumber(b.snd_nxt);
+    auto react = Transition(segment, b);
+    assert(b.state == State::kEstab);
+    react(&internal);
+
+    auto send_react = Transition(Event::kSend, &send, b);
+    send_react(&internal);
+    // The peer acks, and the reader makes room
+    b.snd_una = b.snd_nxt;
+    b.snd_wnd = 1024;
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  assert(allocation_count == allocations);
+  assert(internal.accepted == kRounds);
+  assert(internal.last_ack == b.rcv_nxt);
+  std::clog << __func__ << ": " << elapsed.count() / (2 * kRounds)
+            << " ns per transition, "
+            << allocation_count - allocations << " allocations" << std::endl;
+}
+
+void TestHeaderPrediction() {
+  TcpStateManager tcp;
+  NullInternal internal;
+  tcp(Event::kConnect, nullptr)(&internal);
+  const auto iss = tcp.GetControlBlock().snd_nxt;
+
+  TcpHeader header;
+  header.SetSyn(true);
+  header.SetAck(true);
+  header.SetSequenceNumber(7000);
+  header.SetAcknowledgementNumber(iss);
+  header.SetWindow(1024);
+  // Not established yet
+  assert(tcp.Predict(header) == Prediction::kMiss);
+  tcp(header)(&internal);
+  assert(tcp.GetState() == State::kEstab);
+
+  header = TcpHeader();
+  header.SetAck(true);
+  header.SetPsh(true);
+  header.SetSequenceNumber(7001);
+  header.SetAcknowledgementNumber(iss);
+  header.SetWindow(1024);
+  header.SetTcpLength(100);
+  assert(tcp.Predict(header) == Prediction::kData);
+  assert(tcp.GetControlBlock().rcv_nxt == 7101);
+
+  // Out of order, and a FIN
+  header.SetSequenceNumber(7201);
+  assert(tcp.Predict(header) == Prediction::kMiss);
+  header.SetSequenceNumber(7101);
+  header.SetFin(true);
+  assert(tcp.Predict(header) == Prediction::kMiss);
+  header.SetFin(false);
+
+  // A duplicate ACK, then the ACK of new data
+  header.SetTcpLength(0);
+  assert(tcp.Predict(header) == Prediction::kMiss);
+  TcpHeader send;
+  send.SetTcpLength(10);
+  tcp(Event::kSend, &send)(&internal);
+  header.SetAcknowledgementNumber(iss + 10);
+  assert(tcp.Predict(header) == Prediction::kAck);
+  assert(tcp.GetControlBlock().snd_una == iss + 10);
+  assert(tcp.GetControlBlock().rcv_nxt == 7101);
+}
+
+void test_state_dispatch() {
+  TestStateDispatchAllocationFree();
+  TestHeaderPrediction();
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,43 @@
+#include <cassert>
+#include <cstring>
+
+#include <iostream>
+
+#include "tcp-header.h"
+
+using namespace tcp_stack;
+
+void TestTcpHeaderWireOrder() {
+  TcpHeader header;
+  header.SetSourceAddress(0x7f000001);
+  header.SetTcpLength(0x0102);
+  header.SetSourcePort(0x0304);
+  header.SetSequenceNumber(0x05060708);
+  header.SetAcknowledgementNumber(0x090a0b0c);
+  header.SetSyn(true);
+  header.SetAck(true);
+  header.SetWindow(0x0d0e);
+
+  unsigned char bytes[sizeof(TcpHeader)];
+  std::memcpy(bytes, &header, sizeof(bytes));
+  const unsigned char expected[] = {
+    0x7f, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x00, 0x00,
+    0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c,
+    0x00, 0x12, 0x0d, 0x0e, 0x00, 0x00, 0x00, 0x00,
+  };
+  assert(std::memcmp(bytes, expected, sizeof(bytes)) == 0);
+
+  assert(header.SourceAddress() == 0x7f000001);
+  assert(header.TcpLength() == 0x0102);
+  assert(header.SequenceNumber() == 0x05060708);
+  assert(header.AcknowledgementNumber() == 0x090a0b0c);
+  assert(header.Syn() && header.Ack() && !header.Fin() && !header.Rst());
+  header.SetAck(false);
+  assert(!header.Ack() && header.Syn());
+}
+
+void test_tcp_header() {
+  TestTcpHeaderWireOrder();
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -2,6 +2,8 @@
 #include <cassert>
 #include <cstddef>
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -16,8 +18,8 @@ public:
     called_.push_back(__func__);
     header_ = TcpHeader();
     header_.SetSyn(true);
-    header_.SequenceNumber() = seq;
-    header_.Window() = window;
+    header_.SetSequenceNumber(seq);
+    header_.SetWindow(window);
   }
 
   void SendSynAck(uint32_t seq, uint32_t ack, uint16_t window) override {
@@ -25,18 +27,22 @@ public:
     header_ = TcpHeader();
     header_.SetSyn(true);
     header_.SetAck(true);
-    header_.SequenceNumber() = seq;
-    header_.AcknowledgementNumber() = ack;
-    header_.Window() = window;
+    header_.SetSequenceNumber(seq);
+    header_.SetAcknowledgementNumber(ack);
+    header_.SetWindow(window);
   }
 
   void SendAck(uint32_t seq, uint32_t ack, uint16_t window) override {
     called_.push_back(__func__);
     header_ = TcpHeader();
     header_.SetAck(true);
-    header_.SequenceNumber() = seq;
-    header_.AcknowledgementNumber() = ack;
-    header_.Window() = window;
+    header_.SetSequenceNumber(seq);
+    header_.SetAcknowledgementNumber(ack);
+    header_.SetWindow(window);
+  }
+  void DelayAck(uint32_t seq, uint32_t ack, uint16_t window) override {
+    SendAck(seq, ack, window);
+    called_.back() = __func__;
   }
   
   void SendFin(uint32_t seq, uint32_t ack, uint16_t window) override {
@@ -44,9 +50,9 @@ public:
     header_ = TcpHeader();
     header_.SetAck(true);
     header_.SetFin(true);
-    header_.SequenceNumber() = seq;
-    header_.AcknowledgementNumber() = ack;
-    header_.Window() = window;
+    header_.SetSequenceNumber(seq);
+    header_.SetAcknowledgementNumber(ack);
+    header_.SetWindow(window);
   }
 
   void RecvSyn(uint32_t seq_recv, uint16_t window_recv) override {
@@ -78,6 +84,14 @@ public:
   void Discard() override {
     called_.push_back(__func__);
   }
+
+  void Hold(uint32_t seq) override {
+    called_.push_back(__func__);
+  }
+
+  void Reassemble(uint32_t seq, uint32_t end) override {
+    called_.push_back(__func__);
+  }
   
   void SeqOutofRange(uint16_t window) override {
     called_.push_back(__func__);
@@ -127,10 +141,11 @@ private:
   TcpHeader header_;
 };
 
-auto GetReturn(std::function<void(SocketInternalInterface *)> react,
-               TcpStateManager tcp) {
+auto GetReturn(TcpState::ReactType react, TcpStateManager tcp) {
+  // std::function needs a copyable callable, the react is not
+  auto shared_react = std::make_shared<TcpState::ReactType>(std::move(react));
   return std::function([=](SocketInternalInterface *internal) mutable {
-        react(internal);
+        (*shared_react)(internal);
         return tcp;
       });
 }
@@ -144,14 +159,14 @@ auto TestConnection(State state = State::kClosed) {
 
   auto react = tcp1(Event::kConnect, nullptr);
   if (state == State::kSynSent)
-    return GetReturn(react, tcp1);
+    return GetReturn(std::move(react), tcp1);
   react(&internal1);
   assert(internal1[-1] == "SendSyn"s);
   assert(tcp1.GetState() == State::kSynSent);
 
   react = tcp2(internal1.GetHeader());
   if (state == State::kSynRcvd)
-    return GetReturn(react, tcp2);
+    return GetReturn(std::move(react), tcp2);
   react(&internal2);
   assert(internal2[-1] == "SendSynAck"s);
   assert(internal2[-2] == "Accept"s);
@@ -159,7 +174,7 @@ auto TestConnection(State state = State::kClosed) {
 
   react = tcp1(internal2.GetHeader());
   if (state == State::kEstab)
-    return GetReturn(react, tcp1);
+    return GetReturn(std::move(react), tcp1);
   react(&internal1);
   assert(internal1[-1] == "Connected"s);
   assert(internal1[-2] == "SendAck"s);
@@ -238,14 +253,14 @@ auto TestConnection(State state = State::kClosed) {
 
   react = tcp2(Event::kClose, nullptr);
   if (state == State::kFinWait1)
-    return GetReturn(react, tcp2);
+    return GetReturn(std::move(react), tcp2);
   react(&internal2);
   assert(internal2[-1] == "SendFin"s);
   assert(tcp2.GetState() == State::kFinWait1);
 
   react = tcp1(internal2.GetHeader());
   if (state == State::kCloseWait)
-    return GetReturn(react, tcp1);
+    return GetReturn(std::move(react), tcp1);
   react(&internal1);
   assert(internal1[-1] == "SendAck"s);
   assert(internal1[-2] == "Accept"s);
@@ -253,21 +268,21 @@ auto TestConnection(State state = State::kClosed) {
 
   react = tcp2(internal1.GetHeader());
   if (state == State::kFinWait2)
-    return GetReturn(react, tcp2);
+    return GetReturn(std::move(react), tcp2);
   react(&internal2);
   assert(internal2[-1] == "Accept"s);
   assert(tcp2.GetState() == State::kFinWait2);
 
   react = tcp1(Event::kClose, nullptr);
   if (state == State::kLastAck)
-    return GetReturn(react, tcp1);
+    return GetReturn(std::move(react), tcp1);
   react(&internal1);
   assert(internal1[-1] == "SendFin"s);
   assert(tcp1.GetState() == State::kLastAck);
 
   react = tcp2(internal1.GetHeader());
   if (state == State::kTimeWait)
-    return GetReturn(react, tcp2);
+    return GetReturn(std::move(react), tcp2);
   react(&internal2);
   assert(internal2[-1] == "TimeWait"s);
   assert(internal2[-2] == "SendAck"s);
@@ -282,7 +297,48 @@ auto TestConnection(State state = State::kClosed) {
   return GetReturn([](auto){}, TcpStateManager());
 }
 
+// After the peer's FIN the connection still sends, and takes the ACKs of
+// what it sent. Text past the FIN is ignored.
+void TestSendInCloseWait() {
+  TcpStateManager tcp1, tcp2;
+  TestInternal internal1, internal2;
+
+  tcp1(Event::kConnect, nullptr)(&internal1);
+  tcp2(internal1.GetHeader())(&internal2);
+  tcp1(internal2.GetHeader())(&internal1);
+  tcp2(internal1.GetHeader())(&internal2);
+  tcp2(Event::kClose, nullptr)(&internal2);
+  tcp1(internal2.GetHeader())(&internal1);
+  assert(tcp1.GetState() == State::kCloseWait);
+
+  const auto seq = tcp1.GetNextSend();
+  TcpHeader data;
+  data.SetTcpLength(100);
+  tcp1(Event::kSend, &data)(&internal1);
+  assert(internal1[-1] != "InvalidOperation"s);
+  assert(data.SequenceNumber() == seq);
+  assert(tcp1.GetNextSend() == seq + 100);
+  assert(tcp1.GetState() == State::kCloseWait);
+
+  TcpHeader ack;
+  ack.SetAck(true);
+  ack.SetSequenceNumber(tcp1.GetControlBlock().rcv_nxt);
+  ack.SetAcknowledgementNumber(seq + 100);
+  ack.SetWindow(1024);
+  tcp1(ack)(&internal1);
+  assert(internal1[-1] == "RecvAck"s);
+  assert(internal1[-2] == "Accept"s);
+  assert(tcp1.GetControlBlock().snd_una == seq + 100);
+  assert(tcp1.GetState() == State::kCloseWait);
+
+  ack.SetTcpLength(10);
+  tcp1(ack)(&internal1);
+  assert(internal1[-1] == "Discard"s);
+  assert(tcp1.GetState() == State::kCloseWait);
+}
+
 void test_tcp_state_machine() {
   TestConnection();
+  TestSendInCloseWait();
   std::clog << __func__ << " Passed" << std::endl;
 }
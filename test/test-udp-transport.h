@@ -0,0 +1,96 @@
+#include <cassert>
+#include <cstring>
+
+#include <iostream>
+#include <vector>
+
+#include "network-service.h"
+#include "udp-transport.h"
+
+using namespace tcp_stack;
+
+// An exchange over UDP on the io_uring backend, or on poll where the kernel
+// falls short of it
+void TestIoUringBackend() {
+  NetworkService::Options options;
+  options.backend = IoBackend::kIoUring;
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", 15540, "127.0.0.1", 15541, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", 15541, "127.0.0.1", 15540, options);
+  assert(server->GetBackend() == client->GetBackend());
+
+  {
+    auto server_socket = server->NewSocket();
+    auto client_socket = client->NewSocket();
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    client_socket.Send("Abcdefghijklmno", 15);
+    client_socket.Send("pqrstuvwxyz", 11);
+
+    char buff[27] = {0};
+    auto server_connection = server_socket.Accept();
+    server_connection.Recv(buff, 26);
+    assert(!strcmp(buff, "Abcdefghijklmnopqrstuvwxyz"));
+  }
+
+  assert(server->GetReceiveStatistics().datagrams > 0);
+  server->Terminate();
+  client->Terminate();
+}
+
+// A short datagram and then a GSO train, on a socket which refuses
+// UDP_SEGMENT. The first message goes out and the train fails, it is resent
+// without GSO, and the first is not resent. On poll sendmmsg stops at the
+// train, on io_uring its sendmsg alone fails.
+void TestGsoFallback(IoBackend backend, uint16_t port) {
+  sockaddr_in host_addr{AF_INET, htons(port)};
+  sockaddr_in peer_addr{AF_INET, htons(port + 1)};
+  inet_pton(AF_INET, "127.0.0.1", &host_addr.sin_addr);
+  inet_pton(AF_INET, "127.0.0.1", &peer_addr.sin_addr);
+  const int peer_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  assert(peer_socket >= 0);
+  assert(!bind(peer_socket, (sockaddr *)&peer_addr, sizeof(sockaddr_in)));
+
+  NetworkServiceOptions options;
+  options.backend = backend;
+  UdpTransport transport(host_addr, peer_addr, options);
+  transport.Open(0);
+  // The kernel refuses to segment without UDP checksums, and still sends
+  // plain datagrams
+  const int enable = 1;
+  assert(!setsockopt(transport.GetSocket(0), SOL_SOCKET, SO_NO_CHECK,
+                     &enable, sizeof(enable)));
+
+  constexpr uint16_t kPackets = 4;
+  PacketBatch packets;
+  for (uint16_t i=0; i<kPackets; ++i) {
+    packets.push_back(MakeTcpPacket(i ? 500 : 100));
+    packets.back()->GetHeader().SetSourcePort(i);
+  }
+  transport.Send(packets);
+
+  std::vector<uint16_t> received;
+  char buff[kMaxDatagramSize];
+  pollfd fdarray[1] = {{peer_socket, POLLIN, 0}};
+  while (poll(fdarray, 1, 100) == 1) {
+    const auto size = recv(peer_socket, buff, sizeof(buff), 0);
+    assert(size >= static_cast<ssize_t>(sizeof(TcpHeader)));
+    received.push_back(
+        MakeNetPacket(buff, size)->GetHeader().SourcePort());
+  }
+  assert(received.size() == kPackets);
+  for (uint16_t i=0; i<kPackets; ++i)
+    assert(received[i] == i);
+
+  transport.Close(0);
+  close(peer_socket);
+}
+
+void test_udp_transport() {
+  TestIoUringBackend();
+  TestGsoFallback(IoBackend::kPoll, 15542);
+  TestGsoFallback(IoBackend::kIoUring, 15544);
+  std::clog << __func__ << " Passed" << std::endl;
+}
@@ -0,0 +1,125 @@
+#include <cassert>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "network-service.h"
+#include "state.h"
+#include "tcp-options.h"
+
+using namespace tcp_stack;
+
+void TestWindowScaleOption() {
+  static_assert(WindowScaleFor(0xffff) == 0);
+  static_assert(WindowScaleFor(0x10000) == 1);
+  static_assert(WindowScaleFor(256 * 1024) == 3);
+  static_assert(WindowScaleFor(0xffffffff) == kMaxWindowScale);
+
+  TcpOptions options;
+  options.AddSackPermitted();
+  options.AddWindowScale(7);
+  auto syn = MakeOptionPacket(options.Data(), options.Size());
+  assert(syn->GetHeader().DataOffset() == 7);
+  assert(WindowScaleOf(*syn) == 7);
+  assert(HasSackPermitted(*syn));
+  assert(WindowScaleOf(*MakeTcpPacket(0)) == -1);
+
+  // Past 14 is taken as 14
+  TcpOptions large;
+  large.AddWindowScale(20);
+  assert(WindowScaleOf(*MakeOptionPacket(large.Data(), large.Size())) == 14);
+}
+
+// The windows of SYNs are taken as they are, those of other segments
+// shifted, both ways
+void TestScaledWindows() {
+  TcpStateManager tcp;
+  tcp.SetWindow(1 << 20, WindowScaleFor(1 << 20));
+  tcp(Event::kConnect, nullptr);
+  const auto iss = tcp.GetControlBlock().snd_nxt;
+  assert(SynWindowField(tcp.GetControlBlock()) == 0xffff);
+
+  TcpHeader header;
+  header.SetSyn(true);
+  header.SetAck(true);
+  header.SetSequenceNumber(7000);
+  header.SetAcknowledgementNumber(iss);
+  header.SetWindow(1000);
+  tcp.SetWindowScale(tcp.GetControlBlock().snd_wscale, 2);
+  tcp(header);
+  assert(tcp.GetState() == State::kEstab);
+  assert(tcp.GetControlBlock().rcv_wnd == 1000);
+
+  header = TcpHeader();
+  header.SetAck(true);
+  header.SetSequenceNumber(7001);
+  header.SetAcknowledgementNumber(iss);
+  header.SetWindow(30000);
+  header.SetTcpLength(100);
+  assert(tcp.Predict(header) == Prediction::kData);
+  assert(tcp.GetControlBlock().rcv_wnd == 120000);
+
+  // More than the unscaled field holds is in flight
+  TcpHeader send;
+  send.SetTcpLength(kMaxSegmentSize);
+  for (uint32_t i=0; i<100; ++i)
+    tcp(Event::kSend, &send);
+  assert(tcp.GetControlBlock().snd_nxt - iss == 100 * kMaxSegmentSize);
+  // Less the 100 bytes received
+  assert(send.Window() == ((1 << 20) - 100) >> WindowScaleFor(1 << 20));
+}
+
+// A megabyte crosses one connection in far less time than a 1 KiB window
+// and delayed ACKs would allow, with the sender blocking on its buffer
+void TestLoopbackLargeWindow(bool window_scale, uint16_t port) {
+  constexpr size_t kSize = 1 << 20;
+
+  NetworkService::Options options;
+  options.loopback = std::make_shared<LoopbackNetwork>();
+  auto server = NetworkService::AsyncRun(
+      "127.0.0.1", port, "127.0.0.1", port + 1, options);
+  auto client = NetworkService::AsyncRun(
+      "127.0.0.1", port + 1, "127.0.0.1", port, options);
+
+  {
+    auto server_socket = server->NewSocket();
+    SocketOptions socket_options;
+    socket_options.window_scale = window_scale;
+    socket_options.receive_buffer = 4 << 20;
+    server_socket.SetOptions(socket_options);
+    auto client_socket = client->NewSocket();
+    socket_options.window_scale = true;
+    socket_options.send_buffer = 128 * 1024;
+    client_socket.SetOptions(socket_options);
+    server_socket.Listen(10);
+    client_socket.Connect("127.0.0.1", 10);
+
+    std::mt19937 random(11);
+    std::string stream(kSize, '\0');
+    for (auto &c : stream)
+      c = static_cast<char>(random());
+
+    const auto start = std::chrono::steady_clock::now();
+    client_socket.Send(stream.data(), stream.size());
+    auto server_connection = server_socket.Accept();
+    std::string received(kSize, '\0');
+    server_connection.Recv(received.data(), kSize);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    assert(received == stream);
+    assert(elapsed < std::chrono::seconds(5));
+  }
+
+  server->Terminate();
+  client->Terminate();
+}
+
+void test_window_scale() {
+  TestWindowScaleOption();
+  TestScaledWindows();
+  TestLoopbackLargeWindow(true, 15520);
+  TestLoopbackLargeWindow(false, 15522);
+  std::clog << __func__ << " Passed" << std::endl;
+}
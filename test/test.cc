@@ -1,8 +1,64 @@
+#include <cstdlib>
+
+#include <new>
 
 #include "test-tcp-state-machine.h"
+#include "test-loopback-transport.h"
+#include "test-udp-transport.h"
+#include "test-packet-pool.h"
+#include "test-send-buffer.h"
+#include "test-checksum.h"
+#include "test-tcp-header.h"
+#include "test-state-dispatch.h"
+#include "test-sequence-number.h"
+#include "test-reassembly.h"
+#include "test-sack.h"
+#include "test-delayed-ack.h"
+#include "test-nagle.h"
+#include "test-window-scale.h"
+#include "test-flow-control.h"
+#include "test-congestion.h"
+#include "test-rto.h"
+#include "test-fast-retransmit.h"
+
+// Replaces the allocator of the test binary, once, to count the
+// allocations of each thread for test_state_dispatch
+thread_local size_t allocation_count = 0;
+
+void *operator new(size_t size) {
+  ++allocation_count;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
 
 int main() {
   test_tcp_state_machine();
+  test_loopback_transport();
+  test_udp_transport();
+  test_packet_pool();
+  test_send_buffer();
+  test_checksum();
+  test_tcp_header();
+  test_state_dispatch();
+  test_sequence_number();
+  test_reassembly();
+  test_sack();
+  test_delayed_ack();
+  test_nagle();
+  test_window_scale();
+  test_flow_control();
+  test_congestion();
+  test_rto();
+  test_fast_retransmit();
 
   return 0;
 }